@@ -0,0 +1,268 @@
+#include "Animator.hpp"
+#include "SimdMath.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+static glm::vec4 loadKey(const float* values, uint32_t components) {
+	glm::vec4 value(0.0f);
+	for (uint32_t i = 0; i < components && i < 4; i++) {
+		value[i] = values[i];
+	}
+	return value;
+}
+
+// Screen size scaled by how overdue the character is. The overdue part keeps growing while it is deferred, so even the
+// smallest visible character outranks the rest after a bounded number of frames. The floor keeps that true for characters
+// without a priority, which then take turns
+static float urgency(const Animator::Character& character) {
+	float overdue = float(character.framesSinceUpdate) / float(std::max<uint32_t>(character.updateInterval, 1));
+	return std::max(character.priority, 0.01f) * overdue;
+}
+
+// Rotations come back as x, y, z, w like glTF stores them
+static glm::vec4 sampleChannel(const VRM::AnimationClip& clip, const VRM::AnimationChannel& channel, uint32_t cursor, float time) {
+	const float* times = clip.times.data() + channel.timeOffset;
+	const float* values = clip.values.data() + channel.valueOffset;
+	uint32_t components = channel.components;
+	uint32_t next = std::min(cursor + 1, channel.keyCount - 1);
+
+	// Before the first key and after the last one the value is held
+	float keyDelta = times[next] - times[cursor];
+	float t = keyDelta > 0.0f ? glm::clamp((time - times[cursor]) / keyDelta, 0.0f, 1.0f) : 0.0f;
+
+	switch (channel.interpolation) {
+		case VRM::INTERPOLATION_STEP:
+			return loadKey(values + cursor * components, components);
+		case VRM::INTERPOLATION_CUBICSPLINE: {
+			// Every key stores in-tangent, value and out-tangent, the tangents are scaled by the key distance
+			glm::vec4 p0 = loadKey(values + (cursor * 3 + 1) * components, components);
+			glm::vec4 m0 = loadKey(values + (cursor * 3 + 2) * components, components) * keyDelta;
+			glm::vec4 p1 = loadKey(values + (next * 3 + 1) * components, components);
+			glm::vec4 m1 = loadKey(values + (next * 3) * components, components) * keyDelta;
+			float t2 = t * t;
+			float t3 = t2 * t;
+			return (2 * t3 - 3 * t2 + 1) * p0 + (t3 - 2 * t2 + t) * m0 + (-2 * t3 + 3 * t2) * p1 + (t3 - t2) * m1;
+		}
+		default: {
+			glm::vec4 a = loadKey(values + cursor * components, components);
+			glm::vec4 b = loadKey(values + next * components, components);
+			if (channel.path != VRM::ANIMATION_PATH_ROTATION)
+				return glm::mix(a, b, t);
+			glm::quat q = glm::slerp(glm::quat(a.w, a.x, a.y, a.z), glm::quat(b.w, b.x, b.y, b.z), t);
+			return glm::vec4(q.x, q.y, q.z, q.w);
+		}
+	}
+}
+
+void Animator::init(VRMImporter* importer, ThreadPool* threadPool) {
+	m_Importer = importer;
+	m_ThreadPool = threadPool;
+	m_SpringBones.init(*importer);
+}
+
+uint32_t Animator::addCharacter(int clip, float startTime) {
+	uint32_t character;
+	if (!m_FreeCharacters.empty()) {
+		character = m_FreeCharacters.back();
+		m_FreeCharacters.pop_back();
+	} else {
+		character = static_cast<uint32_t>(m_Characters.size());
+		m_Characters.emplace_back();
+	}
+	m_Characters[character].active = true;
+	setClip(character, clip, startTime);
+	return character;
+}
+
+void Animator::removeCharacter(uint32_t character) {
+	m_Characters[character].active = false;
+	m_Characters[character].nodes.clear();
+	m_FreeCharacters.push_back(character);
+}
+
+void Animator::setClip(uint32_t character, int clip, float startTime) {
+	if (clip >= static_cast<int>(m_Importer->m_Animations.size())) {
+		throw std::runtime_error("[Animator#setClip]: Error: Model has no animation " + std::to_string(clip));
+	}
+
+	// Start from the rest pose, properties the new clip does not animate must not keep the old clip's values
+	Character& c = m_Characters[character];
+	c.clip = clip;
+	c.time = startTime;
+	c.nodes = m_Importer->m_Nodes;
+	c.cursors.assign(clip == -1 ? 0 : m_Importer->m_Animations[clip].channels.size(), 0);
+	c.version = m_Importer->m_TransformVersion;
+	c.springs = SpringBones::State();
+	c.evaluated = false;
+	c.framesSinceUpdate = 0;
+}
+
+void Animator::setLod(uint32_t character, uint32_t updateInterval, float priority) {
+	m_Characters[character].updateInterval = updateInterval;
+	m_Characters[character].priority = priority;
+}
+
+void Animator::update(double dt, const glm::mat4& basis) {
+	m_Stats = {};
+	m_Due.clear();
+	for (size_t i = 0; i < m_Characters.size(); i++) {
+		Character& character = m_Characters[i];
+		if (!character.active)
+			continue;
+
+		// Time keeps running for skipped and frozen characters, so they resume in step
+		if (character.clip != -1) {
+			const VRM::AnimationClip& clip = m_Importer->m_Animations[character.clip];
+			character.time += float(dt) * character.speed;
+			if (clip.duration > 0.0f) {
+				character.time = std::fmod(character.time, clip.duration);
+				if (character.time < 0.0f)
+					character.time += clip.duration;
+			}
+		}
+
+		// Spring bones catch up on the whole time since the last evaluation in fixed steps
+		character.springs.accumulator += float(dt);
+		character.framesSinceUpdate++;
+		if (!character.evaluated || (character.updateInterval != 0 && character.framesSinceUpdate >= character.updateInterval))
+			m_Due.push_back(static_cast<uint32_t>(i));
+		else if (character.updateInterval == 0)
+			m_Stats.frozen++;
+		else
+			m_Stats.interpolated++;
+	}
+
+	size_t count = m_Due.size();
+	if (m_BudgetMicroseconds > 0.0f && m_EvaluationMicroseconds > 0.0) {
+		size_t affordable = std::max<size_t>(1, size_t(m_BudgetMicroseconds / m_EvaluationMicroseconds * m_ThreadPool->threadCount()));
+		// Characters that never had a pose have nothing to show yet, so they are evaluated regardless of the budget
+		size_t unevaluated = std::count_if(m_Due.begin(), m_Due.end(), [&](uint32_t i) { return !m_Characters[i].evaluated; });
+		affordable = std::max(affordable, unevaluated);
+		if (count > affordable) {
+			// Those go first, after them the most visible ones weighted by how long they have waited
+			std::sort(m_Due.begin(), m_Due.end(), [&](uint32_t a, uint32_t b) {
+				if (m_Characters[a].evaluated != m_Characters[b].evaluated)
+					return !m_Characters[a].evaluated;
+				return urgency(m_Characters[a]) > urgency(m_Characters[b]);
+			});
+			count = affordable;
+		}
+	}
+	m_Stats.deferred = static_cast<uint32_t>(m_Due.size() - count);
+	m_Stats.evaluated = static_cast<uint32_t>(count);
+	if (count == 0)
+		return;
+
+	auto startTime = std::chrono::high_resolution_clock::now();
+	m_ThreadPool->parallelFor(count, [&](size_t i) {
+		evaluate(m_Characters[m_Due[i]], basis);
+	});
+	auto endTime = std::chrono::high_resolution_clock::now();
+
+	double cost = std::chrono::duration<double, std::micro>(endTime - startTime).count() * m_ThreadPool->threadCount() / count;
+	m_EvaluationMicroseconds = m_EvaluationMicroseconds > 0.0 ? m_EvaluationMicroseconds * 0.9 + cost * 0.1 : cost;
+}
+
+void Animator::evaluate(Character& character, const glm::mat4& basis) {
+	if (character.clip != -1 || !m_SpringBones.empty()) {
+		if (character.clip != -1)
+			sample(m_Importer->m_Animations[character.clip], character.time, character.cursors, character.nodes);
+		character.version++;
+		VRMImporter::propagateTransforms(character.nodes, character.version);
+		// Springs hang from the animated pose, so they need it propagated first and only their own subtrees again after.
+		// Already running on a worker, so the chains stay on this thread
+		if (m_SpringBones.simulate(character.springs, character.nodes, nullptr))
+			VRMImporter::propagateTransforms(character.nodes, character.version);
+	}
+
+	std::swap(character.previousPalette, character.palette);
+	character.palette.resize(m_Importer->m_PaletteSize * m_Importer->getPaletteStride());
+	m_Importer->writePalette(character.nodes, character.palette.data(), basis, 0);
+	if (!character.evaluated)
+		character.previousPalette = character.palette;
+	character.evaluated = true;
+	character.framesSinceUpdate = 0;
+}
+
+void Animator::writePalettes(glm::vec4* palette) {
+	size_t paletteSize = m_Importer->m_PaletteSize;
+	size_t stride = m_Importer->getPaletteStride();
+	bool dualQuaternion = m_Importer->m_SkinningMethod == VRM::SKINNING_METHOD_DUAL_QUATERNION;
+	if (paletteSize == 0)
+		return;
+
+	m_ThreadPool->parallelFor(m_Characters.size(), [&](size_t i) {
+		const Character& character = m_Characters[i];
+		if (!character.active || !character.evaluated)
+			return;
+
+		glm::vec4* target = palette + i * paletteSize * stride;
+		// Characters updated every n frames show the last evaluation 1/n of the way in and reach it after n frames
+		float blend = character.updateInterval > 1 ? float(character.framesSinceUpdate + 1) / float(character.updateInterval) : 1.0f;
+		if (blend >= 1.0f) {
+			memcpy(target, character.palette.data(), sizeof(glm::vec4) * paletteSize * stride);
+			return;
+		}
+		if (!dualQuaternion) {
+			for (size_t j = 0; j < paletteSize * stride; j++) {
+				target[j] = glm::mix(character.previousPalette[j], character.palette[j], blend);
+			}
+			return;
+		}
+		// Dual quaternions blend along the shorter arc and have to stay unit length
+		for (size_t j = 0; j < paletteSize * stride; j += 2) {
+			const glm::vec4* previous = &character.previousPalette[j];
+			const glm::vec4* current = &character.palette[j];
+			float sign = glm::dot(previous[0], current[0]) < 0.0f ? -1.0f : 1.0f;
+			glm::vec4 real = glm::mix(previous[0], current[0] * sign, blend);
+			glm::vec4 dual = glm::mix(previous[1], current[1] * sign, blend);
+			float length = glm::length(real);
+			target[j] = real / length;
+			target[j + 1] = dual / length;
+		}
+	});
+}
+
+void Animator::sample(const VRM::AnimationClip& clip, float time, std::vector<uint32_t>& cursors, std::vector<VRM::FCNSNode>& nodes) {
+	for (size_t c = 0; c < clip.channels.size(); c++) {
+		const VRM::AnimationChannel& channel = clip.channels[c];
+		// Blend shape weights belong to the meshes, which every character shares
+		if (channel.path == VRM::ANIMATION_PATH_WEIGHTS)
+			continue;
+
+		// Only a wrap back to the start of the clip needs to rewind
+		const float* times = clip.times.data() + channel.timeOffset;
+		uint32_t& cursor = cursors[c];
+		if (time < times[cursor])
+			cursor = 0;
+		while (cursor + 1 < channel.keyCount && times[cursor + 1] <= time)
+			cursor++;
+
+		glm::vec4 value = sampleChannel(clip, channel, cursor, time);
+		VRM::FCNSNode& node = nodes[channel.node];
+		switch (channel.path) {
+			case VRM::ANIMATION_PATH_TRANSLATION:
+				node.translation = glm::vec3(value);
+				break;
+			case VRM::ANIMATION_PATH_ROTATION:
+				node.rotation = SimdMath::normalize(glm::quat(value.w, value.x, value.y, value.z));
+				break;
+			case VRM::ANIMATION_PATH_SCALE:
+				node.scale = glm::vec3(value);
+				break;
+			default:
+				break;
+		}
+		VRMImporter::markDirty(nodes, channel.node);
+	}
+
+	for (auto& node : nodes) {
+		if (node.dirty)
+			SimdMath::composeTRS(node.translation, node.rotation, node.scale, node.localTransform);
+	}
+}
@@ -0,0 +1,77 @@
+#ifndef ANIMATOR_HPP
+#define ANIMATOR_HPP
+
+#include <vector>
+#include "SpringBones.hpp"
+#include "ThreadPool.hpp"
+#include "importer/VRMImporter.hpp"
+
+// Plays the glTF animation clips of the model on any number of characters.
+// Every character owns a copy of the node hierarchy and gets its own block of the skinning palette.
+class Animator {
+public:
+	struct Character {
+		bool active = false;
+		// Index into VRMImporter::m_Animations, -1 holds the rest pose
+		int clip = -1;
+		float time = 0.0f;
+		float speed = 1.0f;
+		// Key index every channel sampled last, playback only moves forward so finding the next key is amortized O(1)
+		std::vector<uint32_t> cursors;
+		std::vector<VRM::FCNSNode> nodes;
+		uint64_t version = 0;
+		SpringBones::State springs;
+
+		// Frames between pose evaluations, 0 freezes the pose
+		uint32_t updateInterval = 1;
+		uint32_t framesSinceUpdate = 0;
+		// Higher goes first when the time budget does not cover every character that is due, together with how overdue it is
+		float priority = 0.0f;
+		bool evaluated = false;
+		// Palettes of the last two evaluations, the frames in between blend from one to the other
+		std::vector<glm::vec4> previousPalette;
+		std::vector<glm::vec4> palette;
+	};
+
+	// What happened to the characters during the last update
+	struct Stats {
+		uint32_t evaluated = 0;
+		uint32_t interpolated = 0;
+		uint32_t frozen = 0;
+		// Due but left for the next frame because the budget ran out
+		uint32_t deferred = 0;
+	};
+
+	VRMImporter* m_Importer = nullptr;
+	// Chain layout of the model's spring bones, shared by every character and the shared pose
+	SpringBones m_SpringBones;
+	std::vector<Character> m_Characters;
+	std::vector<uint32_t> m_FreeCharacters;
+	// CPU time pose evaluation may take per frame, 0 means no limit
+	float m_BudgetMicroseconds = 0.0f;
+	Stats m_Stats;
+
+	// The pool is shared with the rest of the scene and has to outlive the animator
+	void init(VRMImporter* importer, ThreadPool* threadPool);
+	uint32_t addCharacter(int clip, float startTime);
+	void removeCharacter(uint32_t character);
+	void setClip(uint32_t character, int clip, float startTime);
+	void setLod(uint32_t character, uint32_t updateInterval, float priority);
+
+	// Advances every character and evaluates the poses that are due, spread over the thread pool
+	void update(double dt, const glm::mat4& basis);
+	// Writes character i's palette i * m_PaletteSize joints into palette
+	void writePalettes(glm::vec4* palette);
+
+	static void sample(const VRM::AnimationClip& clip, float time, std::vector<uint32_t>& cursors, std::vector<VRM::FCNSNode>& nodes);
+
+private:
+	void evaluate(Character& character, const glm::mat4& basis);
+
+	ThreadPool* m_ThreadPool = nullptr;
+	std::vector<uint32_t> m_Due;
+	// Smoothed cost of one evaluation on one thread, used to turn the budget into a character count
+	double m_EvaluationMicroseconds = 0.0;
+};
+
+#endif // ANIMATOR_HPP
@@ -1,4 +1,18 @@
 #include "Application.hpp"
+#include "SimdMath.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iterator>
+
+// Seconds on a monotonic clock. GLFW's timer would need GLFW initialized, which headless runs never do
+static double getTime() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Seconds an idle headless run sleeps before looking for changes again when there is no keep-alive
+static const double g_IDLE_TIMEOUT = 0.25;
 
 void Application::initWindow() {
 	glfwInit();
@@ -12,16 +26,63 @@ void Application::initWindow() {
 }
 
 void Application::initVulkan() {
-	uint32_t glfwExtensionCount = 0;
-	const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
-	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	std::vector<const char*> extensions;
+	if (!options.headless) {
+		uint32_t glfwExtensionCount = 0;
+		const char** glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+		extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+	}
 
-	vulkan.init(extensions, g_WIDTH, g_HEIGHT);
-	createSurface();
-	loadScene();
-	vulkan.init2();
-	scene.setup();
-	vulkan.setup();
+	vulkan.m_Headless = options.headless;
+	vulkan.m_DeviceOverride = options.device;
+	vulkan.m_DepthPrepass = options.depthPrepass;
+	vulkan.m_CollectPipelineStatistics = options.pipelineStatistics;
+	if (options.skinning == "vertex")
+		vulkan.m_Skinning = SKINNING_VERTEX_SHADER;
+	else if (options.skinning == "compute")
+		vulkan.m_Skinning = SKINNING_COMPUTE;
+	else if (options.skinning == "cpu")
+		vulkan.m_Skinning = SKINNING_CPU;
+	else
+		vulkan.m_Skinning = SKINNING_AUTO;
+	vulkan.m_AsyncCompute = options.asyncCompute;
+	vulkan.m_ReuseCommandBuffers = options.reuseCommandBuffers;
+	vulkan.m_FramesInFlight = options.framesInFlight;
+	if (options.presentMode == "fifo")
+		vulkan.m_PresentPolicy.mode = VK_PRESENT_MODE_FIFO_KHR;
+	else if (options.presentMode == "fifo-relaxed")
+		vulkan.m_PresentPolicy.mode = VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+	else if (options.presentMode == "mailbox")
+		vulkan.m_PresentPolicy.mode = VK_PRESENT_MODE_MAILBOX_KHR;
+	else if (options.presentMode == "immediate")
+		vulkan.m_PresentPolicy.mode = VK_PRESENT_MODE_IMMEDIATE_KHR;
+	vulkan.m_PresentPolicy.presentWait = options.lowLatency;
+	_framePacer.setFrameRate(options.frameCap);
+	if (!options.capture.empty()) {
+		_frameCapture.start(options.capture == "raw" ? FrameCapture::FORMAT_RAW : FrameCapture::FORMAT_PNG, options.captureDirectory);
+		vulkan.m_ReadbackConsumer = [this](const ReadbackFrame& frame) { _frameCapture.consume(frame); };
+	}
+	scene.animationLod = options.animationLod;
+	scene.animator.m_BudgetMicroseconds = float(options.animationBudget);
+
+	// Reading and decoding the model needs no device and the device needs no model, so both are brought up at the same
+	// time and only wait for each other where their results meet. Vulkan calls that need external synchronization
+	// stay on this thread, apart from pipeline creation which only shares the internally synchronized pipeline cache
+	uint32_t model = _startup.add("load model", {}, [this]() { loadScene(); });
+	uint32_t instance = _startup.add("instance", {}, [this, &extensions]() { vulkan.init(extensions, g_WIDTH, g_HEIGHT); }, true);
+	uint32_t surface = _startup.add("surface", {instance}, [this]() {
+		if (!options.headless)
+			createSurface();
+	}, true);
+	uint32_t device = _startup.add("device", {surface}, [this]() { vulkan.init2(); }, true);
+	uint32_t layouts = _startup.add("layouts", {model, device}, [this]() { scene.setupLayouts(); }, true);
+	uint32_t upload = _startup.add("upload", {layouts}, [this]() { scene.uploadAssets(); }, true);
+	uint32_t pipelines = _startup.add("pipelines", {layouts}, [this]() { scene.createPipelines(); });
+	_startup.add("frame graph", {upload, pipelines}, [this]() {
+		scene.createFrameGraph();
+		vulkan.setup();
+	}, true);
+	_startup.run();
 }
 
 void Application::createSurface() {
@@ -31,29 +92,221 @@ void Application::createSurface() {
 }
 
 void Application::mainLoop() {
-	while (!glfwWindowShouldClose(window)) {
-		double time_now = glfwGetTime();
+	_currentTime = getTime();
+	if (options.simulationThread)
+		_simulationThread = std::thread(&Application::simulationLoop, this);
+
+	while (running()) {
+		_framePacer.wait();
+		// Nothing new gets started before the previous frame is visible, so at most one frame waits for the display
+		// Rendering on demand may come around again without having presented anything new
+		if (vulkan.m_LastPresentId != _measuredPresentId && vulkan.waitForPresent(vulkan.m_LastPresentId, 100000000)) {
+			_latencyAccumulator += getTime() - _presentedInputTime;
+			_latencySamples++;
+			_measuredPresentId = vulkan.m_LastPresentId;
+		}
+
+		double time_now = getTime();
 		_deltaTime = time_now - _currentTime;
 		_currentTime = time_now;
 
-		glfwPollEvents();
-		scene.update(vulkan.m_CurrentFrame, _keystates, _deltaTime);
+		if (!options.headless)
+			glfwPollEvents();
+		FrameSnapshot* snapshot = &_serialFrame;
+		if (options.simulationThread) {
+			// Frame N+1 gets simulated while this one is recorded and submitted
+			snapshot = _frames.acquire();
+			if (_snapshotStale) {
+				// Whatever changed in the stale one still has to reach the screen
+				bool changed = snapshot->changed;
+				snapshot = _frames.acquire();
+				snapshot->changed |= changed;
+				_snapshotStale = false;
+			}
+		} else {
+			snapshot->inputTime = getTime();
+			scene.simulate(_keystates, _deltaTime, *snapshot);
+		}
+
+		if (options.renderOnDemand && !needsRender(*snapshot)) {
+			_framesSkipped++;
+			_idleSamples++;
+			waitForChange();
+			continue;
+		}
+
+		// The per frame buffers scene.upload writes have to be out of the GPU's hands first
+		vulkan.waitForFrame();
+		scene.upload(*snapshot, vulkan.m_CurrentFrame);
 		uint32_t imageIndex;
-		vulkan.beginDrawFrame(&imageIndex);
-		scene.draw();
+		if (!vulkan.beginDrawFrame(&imageIndex))
+			continue;
+		if (!options.capture.empty() && _framesRendered % options.captureInterval == 0)
+			vulkan.requestReadback();
+		scene.record(*snapshot, imageIndex);
 		vulkan.endDrawFrame(&imageIndex);
+		_framesRendered++;
+		if (_framesRendered == 1) {
+			double startup = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - _startTime).count();
+			std::cout << "[Application#mainLoop]: Info: First frame submitted after " << startup << "ms" << std::endl;
+			_startup.report();
+		}
+		_redrawPending = false;
+		_lastRenderTime = getTime();
+		_presentedInputTime = snapshot->inputTime;
+		if (vulkan.m_LastPresentId == 0) {
+			// Without present wait only the way to the presentation engine can be measured
+			_latencyAccumulator += getTime() - snapshot->inputTime;
+			_latencySamples++;
+		}
+
+		if (options.stressInstances > 0 || options.pipelineStatistics || options.frameCap > 0 || options.lowLatency || options.headless || options.renderOnDemand)
+			reportStatistics(_deltaTime, *snapshot);
 	}
+	if (options.renderOnDemand)
+		std::cout << "[Application#mainLoop]: Info: Rendered " << _framesRendered << " frames, skipped " << _framesSkipped << " where nothing changed" << std::endl;
 
+	if (_simulationThread.joinable()) {
+		_frames.stop();
+		_simulationThread.join();
+	}
 	vulkan.deviceWaitIdle();
+	// The last frames in flight were never waited for by their slot
+	vulkan.flushReadbacks();
+	_frameCapture.stop();
+}
+
+bool Application::needsRender(const FrameSnapshot& snapshot) {
+	_redrawPending |= snapshot.changed;
+	if (_redrawPending)
+		return true;
+	return options.keepAliveRate > 0 && getTime() - _lastRenderTime >= 1.0 / options.keepAliveRate;
+}
+
+void Application::waitForChange() {
+	// Without a keep-alive only input or a resize can end the wait, headless runs have neither and look again now and then
+	double timeout = g_IDLE_TIMEOUT;
+	if (options.keepAliveRate > 0)
+		timeout = std::max(0.0, _lastRenderTime + 1.0 / options.keepAliveRate - getTime());
+	if (options.headless)
+		std::this_thread::sleep_for(std::chrono::duration<double>(timeout));
+	else if (options.keepAliveRate > 0)
+		glfwWaitEventsTimeout(timeout);
+	else
+		glfwWaitEvents();
+	_snapshotStale = options.simulationThread;
+	// Time spent asleep is not frame time, a camera key held on waking would otherwise jump
+	_currentTime = getTime();
+	_simulationSlept = true;
+}
+
+bool Application::running() {
+	if (options.frames > 0 && _framesRendered >= options.frames)
+		return false;
+	return options.headless || !glfwWindowShouldClose(window);
+}
+
+void Application::simulationLoop() {
+	double lastTime = _currentTime;
+	bool keystates[400];
+	do {
+		double now = getTime();
+		double dt = _simulationSlept.exchange(false) ? 0.0 : now - lastTime;
+		lastTime = now;
+		{
+			std::lock_guard<std::mutex> lock(_inputMutex);
+			std::copy(std::begin(_keystates), std::end(_keystates), keystates);
+		}
+		_frames.back().inputTime = getTime();
+		scene.simulate(keystates, dt, _frames.back());
+	} while (_frames.publish());
 }
 
 void Application::loadScene() {
+	std::cout << "[Application#loadScene]: Info: Using " << SimdMath::getLevelName(SimdMath::getLevel()) << " matrix kernels" << std::endl;
+	// Decided per model, since it depends on whether its rig relies on scaled joints
+	scene.vrmImporter.m_SkinningMethod = options.dualQuaternionSkinning ? VRM::SKINNING_METHOD_DUAL_QUATERNION : VRM::SKINNING_METHOD_LINEAR;
 	scene.load("Evelynn.vrm", &vulkan);
+
+	// The expression the model has always been shown with
+	for (const auto& mesh : scene.meshes) {
+		for (size_t target : {17, 32}) {
+			if (target < mesh.m_Anims.size())
+				scene.setMorphWeight(mesh.m_MeshIndex, target, 1.0f);
+		}
+	}
+
+	std::vector<uint32_t> ids;
+	if (options.stressInstances == 0) {
+		ids.push_back(scene.spawnInstance(glm::mat4(1.0f)));
+	} else {
+		// Square grid on the floor, centered in front of the default camera
+		uint32_t side = static_cast<uint32_t>(std::ceil(std::sqrt(double(options.stressInstances))));
+		float spacing = 0.8f;
+		for (uint32_t i = 0; i < options.stressInstances; i++) {
+			float x = (float(i % side) - float(side - 1) * 0.5f) * spacing;
+			float z = -float(i / side) * spacing;
+			ids.push_back(scene.spawnInstance(glm::translate(glm::mat4(1.0f), glm::vec3(x, 0, z))));
+		}
+		std::cout << "[Application#loadScene]: Info: Spawned " << options.stressInstances << " instances" << std::endl;
+	}
+
+	// Every instance plays the first clip, out of step with its neighbours
+	if (!scene.vrmImporter.m_Animations.empty()) {
+		for (size_t i = 0; i < ids.size(); i++) {
+			scene.playAnimation(ids[i], 0, float(i) * 0.37f);
+		}
+	}
+}
+
+void Application::reportStatistics(double dt, const FrameSnapshot& snapshot) {
+	_frameTimeAccumulator += dt;
+	_frameTimeSamples++;
+	_skeletonsEvaluated += snapshot.animationStats.evaluated;
+	_cpuSkinningMicroseconds += scene.cpuSkinner.m_LastMicroseconds;
+	if (_frameTimeAccumulator < 1.0)
+		return;
+
+	double average = _frameTimeAccumulator / _frameTimeSamples;
+	std::cout << "[Application#reportStatistics]: Info: " << snapshot.instances.size() << " instances, "
+		<< average * 1000.0 << "ms per frame (" << 1.0 / average << " fps)";
+	if (vulkan.m_StatisticsFrames > 0) {
+		std::cout << ", " << vulkan.m_FragmentInvocations / vulkan.m_StatisticsFrames << " fragment invocations per frame";
+		vulkan.m_FragmentInvocations = 0;
+		vulkan.m_StatisticsFrames = 0;
+	}
+	// The animator belongs to the simulation thread, the snapshot's stats tell whether any character is animated
+	const Animator::Stats& stats = snapshot.animationStats;
+	if (stats.evaluated + stats.interpolated + stats.frozen + stats.deferred > 0) {
+		std::cout << ", " << _skeletonsEvaluated / _frameTimeSamples << " skeletons evaluated per frame (last frame "
+			<< stats.interpolated << " interpolated, " << stats.frozen << " frozen, " << stats.deferred << " deferred)";
+	}
+	if (options.renderOnDemand) {
+		std::cout << ", " << _idleSamples << " frames skipped while idle";
+		_idleSamples = 0;
+	}
+	if (vulkan.m_ReuseCommandBuffers) {
+		std::cout << ", scene commands recorded " << vulkan.m_SceneCommandsRecorded << " times in " << _frameTimeSamples << " frames";
+		vulkan.m_SceneCommandsRecorded = 0;
+	}
+	if (vulkan.m_Skinning == SKINNING_CPU)
+		std::cout << ", " << _cpuSkinningMicroseconds / _frameTimeSamples / 1000.0 << "ms CPU skinning per frame";
+	if (_latencySamples > 0)
+		std::cout << ", " << _latencyAccumulator / _latencySamples * 1000.0 << "ms input to " << (vulkan.m_PresentPolicy.presentWait ? "display" : "present call");
+	std::cout << ", depth pre-pass " << (vulkan.m_DepthPrepass ? "on" : "off") << std::endl;
+	_frameTimeAccumulator = 0;
+	_frameTimeSamples = 0;
+	_skeletonsEvaluated = 0;
+	_cpuSkinningMicroseconds = 0;
+	_latencyAccumulator = 0;
+	_latencySamples = 0;
 }
 
 void Application::cleanup() {
 	scene.cleanup();
 	vulkan.cleanup();
-	glfwDestroyWindow(window);
-	glfwTerminate();
+	if (window != nullptr) {
+		glfwDestroyWindow(window);
+		glfwTerminate();
+	}
 }
@@ -4,11 +4,21 @@
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
 
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+
 #include "Camera.hpp"
+#include "FrameCapture.hpp"
+#include "FrameHandoff.hpp"
+#include "FramePacer.hpp"
 #include "structs.hpp"
 #include "Mesh.hpp"
 #include "Vulkan.hpp"
 #include "Scene.hpp"
+#include "Options.hpp"
+#include "TaskGraph.hpp"
 
 #include "importer/VRMImporter.hpp"
 
@@ -24,36 +34,85 @@ const uint32_t g_HEIGHT = 600;
 class Application {
 public:
 	void run() {
-		initWindow();
+		_startTime = std::chrono::steady_clock::now();
+		if (!options.headless)
+			initWindow();
 		initVulkan();
 		mainLoop();
 		cleanup();
 	}
 public:
-	GLFWwindow* window;
+	// Stays null in headless runs
+	GLFWwindow* window = nullptr;
+	Options options;
 	Vulkan vulkan;
 	Scene scene;
 
 	double _currentTime{};
 	double _deltaTime{};
+	// Written by GLFW on the main thread, the simulation thread copies it under _inputMutex
 	bool _keystates[400]{};
+	std::mutex _inputMutex;
+
+	// Snapshots from the simulation thread to the render loop, or the one snapshot both use in turn without it
+	FrameHandoff<FrameSnapshot> _frames;
+	FrameSnapshot _serialFrame;
+	std::thread _simulationThread;
+
+	FramePacer _framePacer;
+	// Input time of the last frame handed to the presentation engine, for measuring latency once it is on screen
+	double _presentedInputTime{};
+	// Present id the latency was last measured for
+	uint64_t _measuredPresentId{};
+	double _latencyAccumulator{};
+	uint32_t _latencySamples{};
+	double _frameTimeAccumulator{};
+	uint32_t _frameTimeSamples{};
+	uint64_t _skeletonsEvaluated{};
+	double _cpuSkinningMicroseconds{};
+	uint64_t _framesRendered{};
+	// Loop iterations that found nothing changed and rendered nothing, see Options::renderOnDemand
+	uint64_t _framesSkipped{};
+	// Frames skipped since the last statistics line
+	uint32_t _idleSamples{};
+	// A change was seen but has not made it to the screen yet, like a snapshot dropped by a swap chain recreation
+	bool _redrawPending = true;
+	// The loop slept, so the snapshot the simulation thread finished meanwhile predates whatever woke it up
+	bool _snapshotStale = false;
+	// Tells the simulation thread the time since its last step was spent asleep, so it is not simulated
+	std::atomic<bool> _simulationSlept{false};
+	double _lastRenderTime{};
+	FrameCapture _frameCapture;
+	// Startup steps, kept around to report their timings once the first frame is submitted
+	TaskGraph _startup;
+	std::chrono::steady_clock::time_point _startTime;
 public:
 	void initWindow();
 
 	static void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
 		auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
+		std::lock_guard<std::mutex> lock(app->_inputMutex);
 		app->_keystates[key] = action == GLFW_PRESS || action == GLFW_REPEAT;
 	}
 
 	static void framebufferResizeCallback(GLFWwindow* window, int width, int height) {
 		auto app = reinterpret_cast<Application*>(glfwGetWindowUserPointer(window));
 		app->vulkan.invalidate(width, height);
+		app->_redrawPending = true;
 	}
 
 	void initVulkan();
 	void createSurface();
 	void mainLoop();
+	// Until the window is closed or options.frames frames were rendered
+	bool running();
+	// Whether the frame of snapshot has to be rendered when rendering on demand
+	bool needsRender(const FrameSnapshot& snapshot);
+	// Sleeps until an event arrives or the keep-alive frame is due
+	void waitForChange();
+	void simulationLoop();
 	void loadScene();
+	void reportStatistics(double dt, const FrameSnapshot& snapshot);
 	void cleanup();
 };
 
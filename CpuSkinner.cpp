@@ -0,0 +1,154 @@
+#include "CpuSkinner.hpp"
+#include "SimdMath.hpp"
+
+#include <algorithm>
+#include <chrono>
+
+// Vertices per work item, small enough to balance the threads and for the morphed copy to stay in L1
+static const size_t g_RANGE_SIZE = 2048;
+
+// Same as the DUAL_QUATERNION branch of deformPosition in skinning.glsl
+static void skinDualQuaternion(const SimdMath::SkinningStreams& streams, size_t count, const glm::vec4* palette, glm::vec4* out) {
+	for (size_t i = 0; i < count; i++) {
+		glm::vec3 pos(streams.x[i], streams.y[i], streams.z[i]);
+		glm::vec4 pivot = palette[streams.joints[0][i] * 2];
+		glm::vec4 real(0.0f);
+		glm::vec4 dual(0.0f);
+		for (int k = 0; k < 4; k++) {
+			const glm::vec4* joint = palette + streams.joints[k][i] * 2;
+			// q and -q are the same rotation, blending has to use the one on the pivot's side
+			float weight = glm::dot(joint[0], pivot) < 0.0f ? -streams.weights[k][i] : streams.weights[k][i];
+			real += weight * joint[0];
+			dual += weight * joint[1];
+		}
+		float length = glm::length(real);
+		if (length == 0.0f) {
+			out[i] = glm::vec4(pos, 1.0f);
+			continue;
+		}
+		real /= length;
+		dual /= length;
+
+		glm::vec3 axis(real);
+		glm::vec3 rotated = pos + 2.0f * glm::cross(axis, glm::cross(axis, pos) + real.w * pos);
+		glm::vec3 translation = 2.0f * (real.w * glm::vec3(dual) - dual.w * axis + glm::cross(axis, glm::vec3(dual)));
+		out[i] = glm::vec4(rotated + translation, 1.0f);
+	}
+}
+
+void CpuSkinner::init(const std::vector<Mesh>& meshes, ThreadPool* threadPool) {
+	m_ThreadPool = threadPool;
+	m_Streams.clear();
+	m_Streams.resize(meshes.size());
+	for (size_t m = 0; m < meshes.size(); m++) {
+		const Mesh& mesh = meshes[m];
+		MeshStreams& streams = m_Streams[m];
+		size_t numVertices = mesh.m_Vertices.size();
+
+		streams.x.resize(numVertices);
+		streams.y.resize(numVertices);
+		streams.z.resize(numVertices);
+		for (int k = 0; k < 4; k++) {
+			streams.joints[k].resize(numVertices);
+			streams.weights[k].resize(numVertices);
+		}
+		for (size_t i = 0; i < numVertices; i++) {
+			const Vertex& vertex = mesh.m_Vertices[i];
+			streams.x[i] = vertex.pos.x;
+			streams.y[i] = vertex.pos.y;
+			streams.z[i] = vertex.pos.z;
+			for (int k = 0; k < 4; k++) {
+				streams.joints[k][i] = vertex.joints[k];
+				streams.weights[k][i] = vertex.weights[k];
+			}
+		}
+
+		// Targets are stored like the glTF file has them, the vertices have y and z swapped (see skinning.glsl)
+		streams.morphX.resize(mesh.m_Anims.size() * numVertices);
+		streams.morphY.resize(mesh.m_Anims.size() * numVertices);
+		streams.morphZ.resize(mesh.m_Anims.size() * numVertices);
+		for (size_t target = 0; target < mesh.m_Anims.size(); target++) {
+			for (size_t i = 0; i < numVertices; i++) {
+				const glm::vec4& delta = mesh.m_Anims[target].verts[mesh.m_Vertices[i].index];
+				streams.morphX[target * numVertices + i] = delta.x;
+				streams.morphY[target * numVertices + i] = delta.z;
+				streams.morphZ[target * numVertices + i] = delta.y;
+			}
+		}
+	}
+}
+
+void CpuSkinner::deform(const std::vector<Mesh>& meshes, const std::vector<PoseData>& poses, const glm::vec4* palette, VRM::SkinningMethod method, size_t frame) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+
+	m_Ranges.clear();
+	for (size_t m = 0; m < meshes.size(); m++) {
+		size_t numVertices = meshes[m].m_Vertices.size();
+		for (size_t pose = 0; pose < poses.size(); pose++) {
+			for (size_t begin = 0; begin < numVertices; begin += g_RANGE_SIZE) {
+				m_Ranges.push_back({static_cast<uint32_t>(m), static_cast<uint32_t>(pose), begin, std::min(begin + g_RANGE_SIZE, numVertices)});
+			}
+		}
+	}
+
+	m_ThreadPool->parallelFor(m_Ranges.size(), [&](size_t r) {
+		const Range& range = m_Ranges[r];
+		const Mesh& mesh = meshes[range.mesh];
+		const MeshStreams& streams = m_Streams[range.mesh];
+		const PoseData& pose = poses[range.pose];
+		size_t numVertices = mesh.m_Vertices.size();
+		size_t count = range.end - range.begin;
+		glm::vec4* out = static_cast<glm::vec4*>(mesh.m_DeformedBuffersMapped[frame]) + range.pose * numVertices + range.begin;
+
+		SimdMath::SkinningStreams input;
+		input.x = streams.x.data() + range.begin;
+		input.y = streams.y.data() + range.begin;
+		input.z = streams.z.data() + range.begin;
+		for (int k = 0; k < 4; k++) {
+			input.joints[k] = streams.joints[k].data() + range.begin;
+			input.weights[k] = streams.weights[k].data() + range.begin;
+		}
+
+		// Morph targets are defined in the bind pose, so they go before skinning
+		thread_local std::vector<float> morphed;
+		if (pose.morphWeight != 0.0f && !mesh.m_ActiveMorphs.empty()) {
+			morphed.resize(count * 3);
+			float* x = morphed.data();
+			float* y = x + count;
+			float* z = y + count;
+			std::copy(input.x, input.x + count, x);
+			std::copy(input.y, input.y + count, y);
+			std::copy(input.z, input.z + count, z);
+			for (const ActiveMorph& morph : mesh.m_ActiveMorphs) {
+				float weight = pose.morphWeight * morph.weight;
+				size_t offset = morph.target * numVertices + range.begin;
+				const float* dx = streams.morphX.data() + offset;
+				const float* dy = streams.morphY.data() + offset;
+				const float* dz = streams.morphZ.data() + offset;
+				for (size_t i = 0; i < count; i++) {
+					x[i] += weight * dx[i];
+					y[i] += weight * dy[i];
+					z[i] += weight * dz[i];
+				}
+			}
+			input.x = x;
+			input.y = y;
+			input.z = z;
+		}
+
+		if (mesh.m_SkinOffset < 0) {
+			for (size_t i = 0; i < count; i++) {
+				out[i] = glm::vec4(input.x[i], input.y[i], input.z[i], 1.0f);
+			}
+			return;
+		}
+		if (method == VRM::SKINNING_METHOD_DUAL_QUATERNION) {
+			skinDualQuaternion(input, count, palette + (pose.paletteOffset + mesh.m_SkinOffset) * 2, out);
+			return;
+		}
+		SimdMath::skinVertices(input, count, palette + (pose.paletteOffset + mesh.m_SkinOffset) * 3, out);
+	});
+
+	auto endTime = std::chrono::high_resolution_clock::now();
+	m_LastMicroseconds = std::chrono::duration<double, std::micro>(endTime - startTime).count();
+}
@@ -0,0 +1,48 @@
+#ifndef CPUSKINNER_HPP
+#define CPUSKINNER_HPP
+
+#include <array>
+#include <vector>
+#include "Mesh.hpp"
+#include "ThreadPool.hpp"
+
+// Skins and morphs every pose of every mesh on the CPU, for devices that would run the shaders on the CPU anyway.
+// The results go straight into the persistently mapped deformed buffers the vertex shaders read.
+class CpuSkinner {
+public:
+	// Copy of one mesh's vertices with one array per component, see SimdMath::SkinningStreams
+	struct MeshStreams {
+		std::vector<float> x;
+		std::vector<float> y;
+		std::vector<float> z;
+		std::array<std::vector<uint32_t>, 4> joints;
+		std::array<std::vector<float>, 4> weights;
+		// numVertices deltas per blend shape, already in vertex space like the positions
+		std::vector<float> morphX;
+		std::vector<float> morphY;
+		std::vector<float> morphZ;
+	};
+
+	std::vector<MeshStreams> m_Streams;
+	// Wall time of the last deform call
+	double m_LastMicroseconds = 0.0;
+
+	// The pool is shared with the rest of the scene and has to outlive the skinner
+	void init(const std::vector<Mesh>& meshes, ThreadPool* threadPool);
+	// Writes every pose of every mesh into the meshes' deformed buffers of frame, laid out like deform.comp does
+	void deform(const std::vector<Mesh>& meshes, const std::vector<PoseData>& poses, const glm::vec4* palette, VRM::SkinningMethod method, size_t frame);
+
+private:
+	// Vertex range of one pose of one mesh, the unit of work handed to the thread pool
+	struct Range {
+		uint32_t mesh;
+		uint32_t pose;
+		size_t begin;
+		size_t end;
+	};
+
+	ThreadPool* m_ThreadPool = nullptr;
+	std::vector<Range> m_Ranges;
+};
+
+#endif // CPUSKINNER_HPP
@@ -0,0 +1,192 @@
+#include "FrameCapture.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+
+// Frames that may wait for the worker before new ones get dropped
+static const size_t g_MAX_QUEUED_FRAMES = 8;
+
+static const std::array<uint32_t, 256>& crcTable() {
+	static const std::array<uint32_t, 256> table = []() {
+		std::array<uint32_t, 256> t{};
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+			}
+			t[n] = c;
+		}
+		return t;
+	}();
+	return table;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back(uint8_t(value >> 24));
+	out.push_back(uint8_t(value >> 16));
+	out.push_back(uint8_t(value >> 8));
+	out.push_back(uint8_t(value));
+}
+
+// Length, type, data and the CRC of type and data
+static void appendChunk(std::vector<uint8_t>& out, const char* type, const std::vector<uint8_t>& data) {
+	appendBigEndian(out, static_cast<uint32_t>(data.size()));
+	size_t start = out.size();
+	out.insert(out.end(), type, type + 4);
+	out.insert(out.end(), data.begin(), data.end());
+	uint32_t crc = 0xFFFFFFFFu;
+	for (size_t i = start; i < out.size(); i++) {
+		crc = crcTable()[(crc ^ out[i]) & 0xFF] ^ (crc >> 8);
+	}
+	appendBigEndian(out, crc ^ 0xFFFFFFFFu);
+}
+
+void FrameCapture::start(Format format, const std::string& directory) {
+	m_Format = format;
+	m_Directory = directory.empty() ? "." : directory;
+	m_Stopping = false;
+	m_Thread = std::thread(&FrameCapture::run, this);
+}
+
+void FrameCapture::consume(const ReadbackFrame& frame) {
+	size_t size = size_t(frame.width) * frame.height * 4;
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	if (m_Jobs.size() >= g_MAX_QUEUED_FRAMES) {
+		m_Dropped++;
+		return;
+	}
+	Job job;
+	if (!m_FreeBuffers.empty()) {
+		job.pixels = std::move(m_FreeBuffers.back());
+		m_FreeBuffers.pop_back();
+	}
+	// The copy happens outside the lock, the worker only touches jobs once they are queued
+	lock.unlock();
+	job.pixels.assign(frame.pixels, frame.pixels + size);
+	job.width = frame.width;
+	job.height = frame.height;
+	job.bgra = frame.bgra;
+	job.frameNumber = frame.frameNumber;
+	lock.lock();
+	m_Jobs.push_back(std::move(job));
+	m_Wake.notify_one();
+}
+
+void FrameCapture::stop() {
+	if (!m_Thread.joinable())
+		return;
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_Wake.notify_one();
+	m_Thread.join();
+	std::cout << "[FrameCapture#stop]: Info: Wrote " << m_Written << " frames to " << m_Directory;
+	if (m_Dropped > 0)
+		std::cout << ", dropped " << m_Dropped << " the writer could not keep up with";
+	std::cout << std::endl;
+}
+
+void FrameCapture::run() {
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	while (true) {
+		m_Wake.wait(lock, [this]() { return !m_Jobs.empty() || m_Stopping; });
+		if (m_Jobs.empty())
+			return;
+		Job job = std::move(m_Jobs.front());
+		m_Jobs.pop_front();
+		lock.unlock();
+		write(job);
+		lock.lock();
+		m_Written++;
+		m_FreeBuffers.push_back(std::move(job.pixels));
+	}
+}
+
+void FrameCapture::write(Job& job) {
+	if (job.bgra) {
+		for (size_t i = 0; i < job.pixels.size(); i += 4) {
+			std::swap(job.pixels[i], job.pixels[i + 2]);
+		}
+	}
+
+	char name[64];
+	if (m_Format == FORMAT_PNG) {
+		std::snprintf(name, sizeof(name), "/frame_%06llu.png", static_cast<unsigned long long>(job.frameNumber));
+		writePng(m_Directory + name, job.pixels, job.width, job.height);
+		return;
+	}
+	std::snprintf(name, sizeof(name), "/frame_%06llu_%ux%u.rgba", static_cast<unsigned long long>(job.frameNumber), job.width, job.height);
+	std::ofstream file(m_Directory + name, std::ios::binary);
+	if (!file.is_open()) {
+		// Nothing up the worker's stack could handle an exception
+		std::cerr << "[FrameCapture#write]: Error: Failed to open " << m_Directory << name << "!" << std::endl;
+		return;
+	}
+	file.write(reinterpret_cast<const char*>(job.pixels.data()), static_cast<std::streamsize>(job.pixels.size()));
+}
+
+void FrameCapture::writePng(const std::string& path, const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height) {
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	// 8 bits per channel, RGBA, deflate, adaptive filtering, no interlacing
+	header.insert(header.end(), {8, 6, 0, 0, 0});
+
+	// Rows each get filter type 0, and the zlib stream uses stored blocks only: writing stays far cheaper than
+	// rendering the frame, at the cost of files as big as the raw pixels
+	size_t rowSize = size_t(width) * 4;
+	size_t rawSize = (rowSize + 1) * height;
+	std::vector<uint8_t> raw;
+	raw.reserve(rawSize);
+	for (uint32_t y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), rgba.begin() + y * rowSize, rgba.begin() + (y + 1) * rowSize);
+	}
+
+	std::vector<uint8_t> data;
+	data.reserve(rawSize + rawSize / 65535 * 5 + 11);
+	// Deflate with a 32K window, no preset dictionary
+	data.push_back(0x78);
+	data.push_back(0x01);
+	size_t offset = 0;
+	do {
+		size_t length = std::min<size_t>(raw.size() - offset, 65535);
+		bool last = offset + length == raw.size();
+		data.push_back(last ? 1 : 0);
+		data.push_back(uint8_t(length));
+		data.push_back(uint8_t(length >> 8));
+		data.push_back(uint8_t(~length));
+		data.push_back(uint8_t(~length >> 8));
+		data.insert(data.end(), raw.begin() + offset, raw.begin() + offset + length);
+		offset += length;
+	} while (offset < raw.size());
+	// Adler-32, reduced every 5552 bytes, the most that can be summed before b overflows
+	uint32_t a = 1;
+	uint32_t b = 0;
+	for (size_t begin = 0; begin < raw.size(); begin += 5552) {
+		size_t end = std::min<size_t>(begin + 5552, raw.size());
+		for (size_t i = begin; i < end; i++) {
+			a += raw[i];
+			b += a;
+		}
+		a %= 65521;
+		b %= 65521;
+	}
+	appendBigEndian(data, (b << 16) | a);
+
+	std::vector<uint8_t> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n'};
+	appendChunk(png, "IHDR", header);
+	appendChunk(png, "IDAT", data);
+	appendChunk(png, "IEND", {});
+
+	std::ofstream file(path, std::ios::binary);
+	if (!file.is_open()) {
+		std::cerr << "[FrameCapture#writePng]: Error: Failed to open " << path << "!" << std::endl;
+		return;
+	}
+	file.write(reinterpret_cast<const char*>(png.data()), static_cast<std::streamsize>(png.size()));
+}
@@ -0,0 +1,58 @@
+#ifndef FRAMECAPTURE_HPP
+#define FRAMECAPTURE_HPP
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "structs.hpp"
+
+// Writes frames read back from the GPU to files on a worker thread, so encoding never holds up rendering.
+// Frames arrive through consume, which only copies them; when the worker falls too far behind frames are dropped instead
+class FrameCapture {
+public:
+	enum Format {
+		// Bare RGBA bytes, named after the frame and its size
+		FORMAT_RAW,
+		FORMAT_PNG
+	};
+
+	// Also ends the worker when startup fails after it was started
+	~FrameCapture() { stop(); }
+
+	void start(Format format, const std::string& directory);
+	void consume(const ReadbackFrame& frame);
+	// Writes whatever is still queued, then ends the worker
+	void stop();
+
+private:
+	struct Job {
+		std::vector<uint8_t> pixels;
+		uint32_t width;
+		uint32_t height;
+		bool bgra;
+		uint64_t frameNumber;
+	};
+
+	void run();
+	void write(Job& job);
+	static void writePng(const std::string& path, const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height);
+
+	Format m_Format = FORMAT_PNG;
+	std::string m_Directory;
+	std::thread m_Thread;
+	std::mutex m_Mutex;
+	std::condition_variable m_Wake;
+	std::deque<Job> m_Jobs;
+	// Pixel buffers of written frames, handed back to consume so capturing does not allocate every frame
+	std::vector<std::vector<uint8_t>> m_FreeBuffers;
+	bool m_Stopping = false;
+	uint64_t m_Written = 0;
+	uint64_t m_Dropped = 0;
+};
+
+#endif // FRAMECAPTURE_HPP
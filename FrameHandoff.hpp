@@ -0,0 +1,66 @@
+#ifndef FRAMEHANDOFF_HPP
+#define FRAMEHANDOFF_HPP
+
+#include <array>
+#include <condition_variable>
+#include <mutex>
+#include <utility>
+
+// Passes whole frames from a producer thread to a consumer thread through three slots.
+// The producer fills back() while the consumer reads the frame it acquired last, the third slot holds the frame published in between
+template <typename T>
+class FrameHandoff {
+public:
+	T& back() {
+		return m_Slots[m_Back];
+	}
+
+	// Makes back() the latest frame and hands out a free slot as the new back(), then blocks until the consumer took it,
+	// so the producer stays at most one frame ahead. Returns false once stop was called
+	bool publish() {
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		std::swap(m_Back, m_Ready);
+		m_Fresh = true;
+		m_Published.notify_one();
+		m_Consumed.wait(lock, [this]() { return !m_Fresh || m_Stopped; });
+		return !m_Stopped;
+	}
+
+	// Blocks until a frame newer than the last acquired one is published, the previous one is handed back to the producer.
+	// Returns nullptr once stop was called
+	T* acquire() {
+		std::unique_lock<std::mutex> lock(m_Mutex);
+		m_Published.wait(lock, [this]() { return m_Fresh || m_Stopped; });
+		if (m_Stopped)
+			return nullptr;
+		std::swap(m_Front, m_Ready);
+		m_Fresh = false;
+		m_Consumed.notify_one();
+		return &m_Slots[m_Front];
+	}
+
+	// Wakes both sides up for good
+	void stop() {
+		{
+			std::lock_guard<std::mutex> lock(m_Mutex);
+			m_Stopped = true;
+		}
+		m_Published.notify_all();
+		m_Consumed.notify_all();
+	}
+
+private:
+	std::array<T, 3> m_Slots;
+	size_t m_Front = 0;
+	size_t m_Ready = 1;
+	size_t m_Back = 2;
+	// The ready slot holds a frame the consumer has not acquired yet
+	bool m_Fresh = false;
+	bool m_Stopped = false;
+
+	std::mutex m_Mutex;
+	std::condition_variable m_Published;
+	std::condition_variable m_Consumed;
+};
+
+#endif // FRAMEHANDOFF_HPP
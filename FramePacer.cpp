@@ -0,0 +1,33 @@
+#include "FramePacer.hpp"
+
+#include <thread>
+
+// How early to wake up before a deadline, sleeps on a desktop scheduler overshoot by up to about this much
+static const std::chrono::microseconds g_SPIN_MARGIN(500);
+
+void FramePacer::setFrameRate(double framesPerSecond) {
+	if (framesPerSecond <= 0.0) {
+		m_Interval = std::chrono::steady_clock::duration::zero();
+		return;
+	}
+	m_Interval = std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(1.0 / framesPerSecond));
+	m_Deadline = std::chrono::steady_clock::time_point{};
+}
+
+void FramePacer::wait() {
+	if (m_Interval == std::chrono::steady_clock::duration::zero())
+		return;
+
+	auto now = std::chrono::steady_clock::now();
+	// More than a whole frame late, start a new grid from here instead of rushing frames out to catch up
+	if (now > m_Deadline + m_Interval)
+		m_Deadline = now;
+
+	if (now < m_Deadline - g_SPIN_MARGIN)
+		std::this_thread::sleep_until(m_Deadline - g_SPIN_MARGIN);
+	while (std::chrono::steady_clock::now() < m_Deadline) {
+		std::this_thread::yield();
+	}
+	// Deadlines stay on the grid, a frame that started a little late does not push the following ones back
+	m_Deadline += m_Interval;
+}
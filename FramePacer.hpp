@@ -0,0 +1,20 @@
+#ifndef FRAMEPACER_HPP
+#define FRAMEPACER_HPP
+
+#include <chrono>
+
+// Holds a loop to a fixed frame rate on an even grid of deadlines. Sleeps for most of every interval and only spins
+// through the last stretch, where the scheduler would wake it up too late
+class FramePacer {
+public:
+	// 0 turns the cap off
+	void setFrameRate(double framesPerSecond);
+	// Returns once the next frame may start
+	void wait();
+
+private:
+	std::chrono::steady_clock::duration m_Interval{0};
+	std::chrono::steady_clock::time_point m_Deadline{};
+};
+
+#endif // FRAMEPACER_HPP
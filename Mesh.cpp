@@ -1,6 +1,7 @@
 #include "Mesh.hpp"
 
 #include <glm/gtc/matrix_transform.hpp>
+#include <algorithm>
 #include <chrono>
 #include <stdexcept>
 
@@ -11,7 +12,7 @@ void Mesh::updateUniformBuffer(const Camera& camera, uint32_t currentImage) {
 	float time = std::chrono::duration<float, std::chrono::seconds::period>(currentTime - startTime).count();
 
 	UniformBufferObject ubo{};
-	ubo.model = glm::rotate(glm::mat4(1.0f), (float)glm::radians(90.0), glm::vec3(-1, 0, 0));
+	ubo.model = m_ModelMatrix;
 	ubo.view = camera.m_View;
 	ubo.proj = camera.m_Projection;
 	ubo.proj[1][1] *= -1; // Compensate for OpenGL being y upside-down
@@ -31,7 +32,8 @@ void Mesh::createVertexBuffer(Vulkan& vulkan) {
 	memcpy(data, m_Vertices.data(), (size_t) bufferSize);
 	vkUnmapMemory(vulkan.m_Device, stagingBufferMemory);
 
-	vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
+	// Also read as a storage buffer by the deformation pass
+	vulkan.createSharedBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_VertexBuffer, m_VertexBufferMemory);
 	vulkan.copyBuffer(stagingBuffer, m_VertexBuffer, bufferSize);
 	//vkBindBufferMemory(vulkan.device, vertexBuffer, vertexBufferMemory, 0);
 
@@ -39,6 +41,98 @@ void Mesh::createVertexBuffer(Vulkan& vulkan) {
 	vkFreeMemory(vulkan.m_Device, stagingBufferMemory, nullptr);
 }
 
+void Mesh::createDepthVertexBuffer(Vulkan& vulkan) {
+	std::vector<DepthVertex> depthVertices(m_Vertices.size());
+	for (size_t i = 0; i < m_Vertices.size(); i++) {
+		depthVertices[i].pos = m_Vertices[i].pos;
+		depthVertices[i].joints = m_Vertices[i].joints;
+		depthVertices[i].weights = m_Vertices[i].weights;
+		depthVertices[i].index = m_Vertices[i].index;
+	}
+	VkDeviceSize bufferSize = sizeof(depthVertices[0]) * depthVertices.size();
+
+	VkBuffer stagingBuffer;
+	VkDeviceMemory stagingBufferMemory;
+	vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
+
+	void* data;
+	vkMapMemory(vulkan.m_Device, stagingBufferMemory, 0, bufferSize, 0, &data);
+	memcpy(data, depthVertices.data(), (size_t) bufferSize);
+	vkUnmapMemory(vulkan.m_Device, stagingBufferMemory);
+
+	vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_DepthVertexBuffer, m_DepthVertexBufferMemory);
+	vulkan.copyBuffer(stagingBuffer, m_DepthVertexBuffer, bufferSize);
+
+	vkDestroyBuffer(vulkan.m_Device, stagingBuffer, nullptr);
+	vkFreeMemory(vulkan.m_Device, stagingBufferMemory, nullptr);
+}
+
+void Mesh::createDeformedBuffers(Vulkan& vulkan, size_t poseCapacity) {
+	m_DeformedBuffers.resize(vulkan.m_FramesInFlight);
+	m_DeformedBuffersMemory.resize(vulkan.m_FramesInFlight);
+	m_DeformedBuffersMapped.assign(vulkan.m_FramesInFlight, nullptr);
+	m_PoseCapacity.resize(vulkan.m_FramesInFlight);
+	for (uint32_t i = 0; i < vulkan.m_FramesInFlight; i++) {
+		createDeformedBuffer(vulkan, i, poseCapacity);
+	}
+}
+
+void Mesh::createDeformedBuffer(Vulkan& vulkan, uint32_t frame, size_t poseCapacity) {
+	// Written by the deformation pass every frame, so nothing to upload here
+	VkDeviceSize bufferSize = sizeof(glm::vec4) * m_Vertices.size() * poseCapacity;
+	m_PoseCapacity[frame] = poseCapacity;
+	m_DeformedBuffersMapped[frame] = nullptr;
+	if (vulkan.m_Skinning != SKINNING_CPU) {
+		vulkan.createSharedBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_DeformedBuffers[frame], m_DeformedBuffersMemory[frame]);
+		return;
+	}
+	// CpuSkinner writes every vertex once per frame, so it goes straight into memory the device can read
+	vulkan.createSharedBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_DeformedBuffers[frame], m_DeformedBuffersMemory[frame]);
+	vkMapMemory(vulkan.m_Device, m_DeformedBuffersMemory[frame], 0, bufferSize, 0, &m_DeformedBuffersMapped[frame]);
+}
+
+void Mesh::retireDeformedBuffer(Vulkan& vulkan, uint32_t frame) {
+	vulkan.retireBuffer(m_DeformedBuffers[frame], m_DeformedBuffersMemory[frame]);
+	m_DeformedBuffers[frame] = VK_NULL_HANDLE;
+	m_DeformedBuffersMemory[frame] = VK_NULL_HANDLE;
+	m_DeformedBuffersMapped[frame] = nullptr;
+}
+
+void Mesh::destroyDeformedBuffers(Vulkan& vulkan) {
+	for (size_t i = 0; i < m_DeformedBuffers.size(); i++) {
+		vkDestroyBuffer(vulkan.m_Device, m_DeformedBuffers[i], nullptr);
+		vkFreeMemory(vulkan.m_Device, m_DeformedBuffersMemory[i], nullptr);
+	}
+	m_DeformedBuffers.clear();
+	m_DeformedBuffersMemory.clear();
+	m_DeformedBuffersMapped.clear();
+	m_PoseCapacity.clear();
+}
+
+void Mesh::writeDeformedDescriptors(Vulkan& vulkan) {
+	for (uint32_t i = 0; i < vulkan.m_FramesInFlight; i++) {
+		writeDeformedDescriptor(vulkan, i);
+	}
+}
+
+void Mesh::writeDeformedDescriptor(Vulkan& vulkan, uint32_t frame) {
+	VkDescriptorBufferInfo deformedBufferInfo{};
+	deformedBufferInfo.buffer = m_DeformedBuffers[frame];
+	deformedBufferInfo.offset = 0;
+	deformedBufferInfo.range = sizeof(glm::vec4) * m_Vertices.size() * m_PoseCapacity[frame];
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = m_DescriptorSets[frame];
+	descriptorWrite.dstBinding = 3;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &deformedBufferInfo;
+
+	vkUpdateDescriptorSets(vulkan.m_Device, 1, &descriptorWrite, 0, nullptr);
+}
+
 void Mesh::createIndexBuffer(Vulkan& vulkan) {
 
 	VkDeviceSize bufferSize = sizeof(m_Indices[0]) * m_Indices.size();
@@ -64,11 +158,11 @@ void Mesh::createIndexBuffer(Vulkan& vulkan) {
 void Mesh::createUniformBuffers(Vulkan& vulkan) {
 	VkDeviceSize bufferSize = sizeof(UniformBufferObject);
 
-	m_UniformBuffers.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_UniformBuffersMemory.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_UniformBuffersMapped.resize(g_MAX_FRAMES_IN_FLIGHT);
+	m_UniformBuffers.resize(vulkan.m_FramesInFlight);
+	m_UniformBuffersMemory.resize(vulkan.m_FramesInFlight);
+	m_UniformBuffersMapped.resize(vulkan.m_FramesInFlight);
 
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
 		vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_UniformBuffers[i], m_UniformBuffersMemory[i]);
 
 		vkMapMemory(vulkan.m_Device, m_UniformBuffersMemory[i], 0, bufferSize, 0, &m_UniformBuffersMapped[i]);
@@ -78,9 +172,9 @@ void Mesh::createUniformBuffers(Vulkan& vulkan) {
 void Mesh::createMaterialBuffers(Vulkan& vulkan) {
 	VkDeviceSize bufferSize = sizeof(VRM::Material);
 
-	m_MaterialBuffers.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_MaterialBuffersMemory.resize(g_MAX_FRAMES_IN_FLIGHT);
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	m_MaterialBuffers.resize(vulkan.m_FramesInFlight);
+	m_MaterialBuffersMemory.resize(vulkan.m_FramesInFlight);
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
 		VkBuffer stagingBuffer;
 		VkDeviceMemory stagingBufferMemory;
 		vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
@@ -105,9 +199,9 @@ void Mesh::createAnimBuffers(Vulkan& vulkan) {
 	}
 	VkDeviceSize bufferSize = m_Anims[0].verts.size() * sizeof(glm::vec4) * m_Anims.size();
 
-	m_AnimBuffers.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_AnimBuffersMemory.resize(g_MAX_FRAMES_IN_FLIGHT);
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	m_AnimBuffers.resize(vulkan.m_FramesInFlight);
+	m_AnimBuffersMemory.resize(vulkan.m_FramesInFlight);
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
 		VkBuffer stagingBuffer;
 		VkDeviceMemory stagingBufferMemory;
 		vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, stagingBuffer, stagingBufferMemory);
@@ -120,7 +214,7 @@ void Mesh::createAnimBuffers(Vulkan& vulkan) {
 			memcpy((uint8_t*)data + elementSize * j, m_Anims[j].verts.data(), elementSize);
 		vkUnmapMemory(vulkan.m_Device, stagingBufferMemory);
 
-		vulkan.createBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_AnimBuffers[i], m_AnimBuffersMemory[i]);
+		vulkan.createSharedBuffer(bufferSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_AnimBuffers[i], m_AnimBuffersMemory[i]);
 
 		vulkan.copyBuffer(stagingBuffer, m_AnimBuffers[i], bufferSize);
 
@@ -129,6 +223,42 @@ void Mesh::createAnimBuffers(Vulkan& vulkan) {
 	}
 }
 
+void Mesh::createMorphBuffers(Vulkan& vulkan) {
+	// Room for every target to be active at once, meshes without blend shapes still need a valid buffer to bind
+	VkDeviceSize bufferSize = sizeof(ActiveMorph) * std::max<size_t>(m_Anims.size(), 1);
+
+	m_MorphBuffers.resize(vulkan.m_FramesInFlight);
+	m_MorphBuffersMemory.resize(vulkan.m_FramesInFlight);
+	m_MorphBuffersMapped.resize(vulkan.m_FramesInFlight);
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
+		vulkan.createSharedBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, m_MorphBuffers[i], m_MorphBuffersMemory[i]);
+
+		vkMapMemory(vulkan.m_Device, m_MorphBuffersMemory[i], 0, bufferSize, 0, &m_MorphBuffersMapped[i]);
+	}
+}
+
+void Mesh::setMorphWeight(size_t target, float weight) {
+	if (target >= m_Anims.size()) {
+		throw std::runtime_error("[Mesh#setMorphWeight]: Error: Mesh has no blend shape " + std::to_string(target));
+	}
+	m_MorphWeights[target] = weight;
+}
+
+void Mesh::collectActiveMorphs(std::vector<ActiveMorph>& activeMorphs) const {
+	// The shaders loop over this list, so the cost follows the number of active expressions instead of the number of targets
+	activeMorphs.clear();
+	for (size_t i = 0; i < m_MorphWeights.size(); i++) {
+		if (m_MorphWeights[i] != 0.0f)
+			activeMorphs.push_back({static_cast<int>(i), m_MorphWeights[i]});
+	}
+}
+
+void Mesh::updateMorphBuffer(const std::vector<ActiveMorph>& activeMorphs, uint32_t currentImage) {
+	m_ActiveMorphs = activeMorphs;
+	if (!m_ActiveMorphs.empty())
+		memcpy(m_MorphBuffersMapped[currentImage], m_ActiveMorphs.data(), sizeof(ActiveMorph) * m_ActiveMorphs.size());
+}
+
 void Mesh::createDescriptorSetLayout(Vulkan& vulkan) {
 	VkDescriptorSetLayoutBinding uboLayoutBinding{};
 	uboLayoutBinding.binding = 0;
@@ -148,10 +278,31 @@ void Mesh::createDescriptorSetLayout(Vulkan& vulkan) {
 	animLayoutBinding.binding = 2;
 	animLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	animLayoutBinding.descriptorCount = 1;
-	animLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	animLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
 	animLayoutBinding.pImmutableSamplers = nullptr; // Optional
 
-	std::array<VkDescriptorSetLayoutBinding, 3> bindings = {uboLayoutBinding, materialLayoutBinding, animLayoutBinding};
+	VkDescriptorSetLayoutBinding deformedLayoutBinding{};
+	deformedLayoutBinding.binding = 3;
+	deformedLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	deformedLayoutBinding.descriptorCount = 1;
+	deformedLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	deformedLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	VkDescriptorSetLayoutBinding sourceLayoutBinding{};
+	sourceLayoutBinding.binding = 4;
+	sourceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	sourceLayoutBinding.descriptorCount = 1;
+	sourceLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	sourceLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	VkDescriptorSetLayoutBinding morphLayoutBinding{};
+	morphLayoutBinding.binding = 5;
+	morphLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	morphLayoutBinding.descriptorCount = 1;
+	morphLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	morphLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	std::array<VkDescriptorSetLayoutBinding, 6> bindings = {uboLayoutBinding, materialLayoutBinding, animLayoutBinding, deformedLayoutBinding, sourceLayoutBinding, morphLayoutBinding};
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -164,25 +315,25 @@ void Mesh::createDescriptorSetLayout(Vulkan& vulkan) {
 }
 
 void Mesh::createDescriptorSets(Vulkan& vulkan) {
-	std::vector<VkDescriptorSetLayout> layouts(g_MAX_FRAMES_IN_FLIGHT, m_DescriptorSetLayout);
+	std::vector<VkDescriptorSetLayout> layouts(vulkan.m_FramesInFlight, m_DescriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = m_DescriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
 	allocInfo.pSetLayouts = layouts.data();
 
-	m_DescriptorSets.resize(g_MAX_FRAMES_IN_FLIGHT);
+	m_DescriptorSets.resize(vulkan.m_FramesInFlight);
 	if (vkAllocateDescriptorSets(vulkan.m_Device, &allocInfo, m_DescriptorSets.data()) != VK_SUCCESS) {
 		throw std::runtime_error("[HelloTriangleApplication#createDescriptorSet]: Error: Failed to allocate descriptor sets!");
 	}
 
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
 		VkDescriptorBufferInfo bufferInfo{};
 		bufferInfo.buffer = m_UniformBuffers[i];
 		bufferInfo.offset = 0;
 		bufferInfo.range = sizeof(UniformBufferObject);
 
-		std::vector<VkWriteDescriptorSet> descriptorWrites(3);
+		std::vector<VkWriteDescriptorSet> descriptorWrites(5);
 
 		descriptorWrites[0].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
 		descriptorWrites[0].dstSet = m_DescriptorSets[i];
@@ -223,25 +374,58 @@ void Mesh::createDescriptorSets(Vulkan& vulkan) {
 		descriptorWrites[2].descriptorCount = 1;
 		descriptorWrites[2].pBufferInfo = &animBufferInfo;
 
+		VkDescriptorBufferInfo sourceBufferInfo{};
+		sourceBufferInfo.buffer = m_VertexBuffer;
+		sourceBufferInfo.offset = 0;
+		sourceBufferInfo.range = sizeof(Vertex) * m_Vertices.size();
+
+		descriptorWrites[3].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[3].dstSet = m_DescriptorSets[i];
+		descriptorWrites[3].dstBinding = 4;
+		descriptorWrites[3].dstArrayElement = 0;
+		descriptorWrites[3].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[3].descriptorCount = 1;
+		descriptorWrites[3].pBufferInfo = &sourceBufferInfo;
+
+		VkDescriptorBufferInfo morphBufferInfo{};
+		morphBufferInfo.buffer = m_MorphBuffers[i];
+		morphBufferInfo.offset = 0;
+		morphBufferInfo.range = sizeof(ActiveMorph) * std::max<size_t>(m_Anims.size(), 1);
+
+		descriptorWrites[4].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrites[4].dstSet = m_DescriptorSets[i];
+		descriptorWrites[4].dstBinding = 5;
+		descriptorWrites[4].dstArrayElement = 0;
+		descriptorWrites[4].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		descriptorWrites[4].descriptorCount = 1;
+		descriptorWrites[4].pBufferInfo = &morphBufferInfo;
 
 		vkUpdateDescriptorSets(vulkan.m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
 	}
+
+	writeDeformedDescriptors(vulkan);
 }
 
 void Mesh::createDescriptorPool(Vulkan& vulkan) {
-	std::array<VkDescriptorPoolSize, 3> poolSizes{};
+	std::array<VkDescriptorPoolSize, 6> poolSizes{};
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
 	poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[2].descriptorCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolSizes[2].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
+	poolSizes[3].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[3].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
+	poolSizes[4].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[4].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
+	poolSizes[5].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[5].descriptorCount = static_cast<uint32_t>(vulkan.m_FramesInFlight);
 
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolInfo.maxSets = static_cast<uint32_t>(vulkan.m_FramesInFlight);
 
 	if (vkCreateDescriptorPool(vulkan.m_Device, &poolInfo, nullptr, &m_DescriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("[HelloTriangleApplication#createDescriptorPool]: Error: Failed to create descriptor pool!");
@@ -249,7 +433,7 @@ void Mesh::createDescriptorPool(Vulkan& vulkan) {
 }
 
 void Mesh::cleanup(Vulkan& vulkan) {
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < vulkan.m_FramesInFlight; i++) {
 		vkDestroyBuffer(vulkan.m_Device, m_UniformBuffers[i], nullptr);
 		vkFreeMemory(vulkan.m_Device, m_UniformBuffersMemory[i], nullptr);
 
@@ -260,6 +444,9 @@ void Mesh::cleanup(Vulkan& vulkan) {
 			vkDestroyBuffer(vulkan.m_Device, m_AnimBuffers[i], nullptr);
 			vkFreeMemory(vulkan.m_Device, m_AnimBuffersMemory[i], nullptr);
 		}
+
+		vkDestroyBuffer(vulkan.m_Device, m_MorphBuffers[i], nullptr);
+		vkFreeMemory(vulkan.m_Device, m_MorphBuffersMemory[i], nullptr);
 	}
 
 	vkDestroyBuffer(vulkan.m_Device, m_IndexBuffer, nullptr);
@@ -268,6 +455,11 @@ void Mesh::cleanup(Vulkan& vulkan) {
 	vkDestroyBuffer(vulkan.m_Device, m_VertexBuffer, nullptr);
 	vkFreeMemory(vulkan.m_Device, m_VertexBufferMemory, nullptr);
 
+	vkDestroyBuffer(vulkan.m_Device, m_DepthVertexBuffer, nullptr);
+	vkFreeMemory(vulkan.m_Device, m_DepthVertexBufferMemory, nullptr);
+
+	destroyDeformedBuffers(vulkan);
+
 	vkDestroyDescriptorPool(vulkan.m_Device, m_DescriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(vulkan.m_Device, m_DescriptorSetLayout, nullptr);
 }
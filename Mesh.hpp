@@ -8,16 +8,27 @@
 #include "Vulkan.hpp"
 #include "importer/VRMImporter.hpp"
 
-extern const int g_MAX_FRAMES_IN_FLIGHT;
-
 class Mesh {
 public:
 	void updateUniformBuffer(const Camera& camera, uint32_t currentImage);
 	void createVertexBuffer(Vulkan& vulkan);
+	void createDepthVertexBuffer(Vulkan& vulkan);
 	void createIndexBuffer(Vulkan& vulkan);
 	void createUniformBuffers(Vulkan& vulkan);
 	void createMaterialBuffers(Vulkan& vulkan);
 	void createAnimBuffers(Vulkan& vulkan);
+	void createMorphBuffers(Vulkan& vulkan);
+	// Fills activeMorphs from m_MorphWeights, runs on the simulation thread
+	void collectActiveMorphs(std::vector<ActiveMorph>& activeMorphs) const;
+	void updateMorphBuffer(const std::vector<ActiveMorph>& activeMorphs, uint32_t currentImage);
+	void setMorphWeight(size_t target, float weight);
+	void createDeformedBuffers(Vulkan& vulkan, size_t poseCapacity);
+	// Replaces a single frame slot's buffer when the poses outgrow it: retire the old one, then create and write the new one
+	void createDeformedBuffer(Vulkan& vulkan, uint32_t frame, size_t poseCapacity);
+	void retireDeformedBuffer(Vulkan& vulkan, uint32_t frame);
+	void destroyDeformedBuffers(Vulkan& vulkan);
+	void writeDeformedDescriptors(Vulkan& vulkan);
+	void writeDeformedDescriptor(Vulkan& vulkan, uint32_t frame);
 	void cleanup(Vulkan& vulkan);
 
 	void createDescriptorSets(Vulkan& vulkan);
@@ -27,15 +38,25 @@ public:
 public:
 	int m_MeshIndex;
 	int m_PrimitiveIndex;
+	// First palette matrix of this mesh's skin, -1 when it is not skinned
+	int m_SkinOffset = -1;
 
 	std::vector<Vertex> m_Vertices;
 	std::vector<uint32_t> m_Indices;
 	VRM::Material m_Material;
 	std::vector<AnimMesh> m_Anims;
+	// One weight per blend shape, edited under Scene::editMutex
+	std::vector<float> m_MorphWeights;
+	// The list of the snapshot last uploaded, only the render thread touches it
+	std::vector<ActiveMorph> m_ActiveMorphs;
 	std::vector<glm::mat4> m_Joints;
+	glm::mat4 m_ModelMatrix{1.0f};
+	glm::vec3 m_Center{0.0f};
 
 	VkBuffer m_VertexBuffer;
 	VkDeviceMemory m_VertexBufferMemory;
+	VkBuffer m_DepthVertexBuffer;
+	VkDeviceMemory m_DepthVertexBufferMemory;
 	VkBuffer m_IndexBuffer;
 	VkDeviceMemory m_IndexBufferMemory;
 
@@ -49,6 +70,17 @@ public:
 	std::vector<VkBuffer> m_AnimBuffers;
 	std::vector<VkDeviceMemory> m_AnimBuffersMemory;
 
+	std::vector<VkBuffer> m_MorphBuffers;
+	std::vector<VkDeviceMemory> m_MorphBuffersMemory;
+	std::vector<void*> m_MorphBuffersMapped;
+
+	// Output of the deformation pass, room for m_PoseCapacity copies of the vertices in each frame slot
+	std::vector<VkBuffer> m_DeformedBuffers;
+	std::vector<VkDeviceMemory> m_DeformedBuffersMemory;
+	// Only mapped when the CPU does the deforming
+	std::vector<void*> m_DeformedBuffersMapped;
+	std::vector<size_t> m_PoseCapacity;
+
 	VkDescriptorPool m_DescriptorPool;
 	std::vector<VkDescriptorSet> m_DescriptorSets;
 	VkDescriptorSetLayout m_DescriptorSetLayout;
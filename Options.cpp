@@ -0,0 +1,110 @@
+#include "Options.hpp"
+
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+
+// Command line arguments take priority over the environment
+static const char* findOption(int argc, char** argv, const char* name, const char* environmentName) {
+	std::string flag = std::string("--") + name;
+	for (int i = 1; i < argc; i++) {
+		// A bare flag without a value switches a boolean on
+		if (flag == argv[i])
+			return i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0 ? argv[i + 1] : "1";
+		if (strncmp(argv[i], flag.c_str(), flag.size()) == 0 && argv[i][flag.size()] == '=')
+			return argv[i] + flag.size() + 1;
+	}
+	return getenv(environmentName);
+}
+
+static uint32_t parseUnsigned(const char* value, const char* name) {
+	char* end = nullptr;
+	unsigned long result = strtoul(value, &end, 10);
+	if (end == value || *end != '\0') {
+		throw std::invalid_argument(std::string("[Options#parse]: Error: Invalid value for ") + name + ": " + value);
+	}
+	return static_cast<uint32_t>(result);
+}
+
+static bool parseBool(const char* value, const char* name) {
+	std::string text(value);
+	if (text == "1" || text == "true" || text == "on")
+		return true;
+	if (text == "0" || text == "false" || text == "off")
+		return false;
+	throw std::invalid_argument(std::string("[Options#parse]: Error: Invalid value for ") + name + ": " + value);
+}
+
+Options Options::parse(int argc, char** argv) {
+	Options options;
+
+	if (const char* value = findOption(argc, argv, "stress", "VULKAN_STRESS"))
+		options.stressInstances = parseUnsigned(value, "stress");
+	if (const char* value = findOption(argc, argv, "simulation-thread", "VULKAN_SIMULATION_THREAD"))
+		options.simulationThread = parseBool(value, "simulation-thread");
+	if (const char* value = findOption(argc, argv, "depth-prepass", "VULKAN_DEPTH_PREPASS"))
+		options.depthPrepass = parseBool(value, "depth-prepass");
+	if (const char* value = findOption(argc, argv, "pipeline-statistics", "VULKAN_PIPELINE_STATISTICS"))
+		options.pipelineStatistics = parseBool(value, "pipeline-statistics");
+	// Older spelling of --skinning=vertex
+	if (const char* value = findOption(argc, argv, "compute-skinning", "VULKAN_COMPUTE_SKINNING"))
+		options.skinning = parseBool(value, "compute-skinning") ? "auto" : "vertex";
+	if (const char* value = findOption(argc, argv, "skinning", "VULKAN_SKINNING")) {
+		std::string text(value);
+		if (text != "auto" && text != "vertex" && text != "compute" && text != "cpu")
+			throw std::invalid_argument(std::string("[Options#parse]: Error: Invalid value for skinning: ") + value);
+		options.skinning = text;
+	}
+	if (const char* value = findOption(argc, argv, "dual-quaternion-skinning", "VULKAN_DUAL_QUATERNION_SKINNING"))
+		options.dualQuaternionSkinning = parseBool(value, "dual-quaternion-skinning");
+	if (const char* value = findOption(argc, argv, "frames-in-flight", "VULKAN_FRAMES_IN_FLIGHT")) {
+		options.framesInFlight = parseUnsigned(value, "frames-in-flight");
+		if (options.framesInFlight < 1 || options.framesInFlight > g_MAX_FRAMES_IN_FLIGHT)
+			throw std::invalid_argument("[Options#parse]: Error: frames-in-flight has to be between 1 and " + std::to_string(g_MAX_FRAMES_IN_FLIGHT) + ": " + value);
+	}
+	if (const char* value = findOption(argc, argv, "present-mode", "VULKAN_PRESENT_MODE")) {
+		std::string text(value);
+		if (text != "auto" && text != "fifo" && text != "fifo-relaxed" && text != "mailbox" && text != "immediate")
+			throw std::invalid_argument(std::string("[Options#parse]: Error: Invalid value for present-mode: ") + value);
+		options.presentMode = text;
+	}
+	if (const char* value = findOption(argc, argv, "frame-cap", "VULKAN_FRAME_CAP"))
+		options.frameCap = parseUnsigned(value, "frame-cap");
+	if (const char* value = findOption(argc, argv, "render-on-demand", "VULKAN_RENDER_ON_DEMAND"))
+		options.renderOnDemand = parseBool(value, "render-on-demand");
+	if (const char* value = findOption(argc, argv, "keep-alive-rate", "VULKAN_KEEP_ALIVE_RATE"))
+		options.keepAliveRate = parseUnsigned(value, "keep-alive-rate");
+	if (const char* value = findOption(argc, argv, "low-latency", "VULKAN_LOW_LATENCY"))
+		options.lowLatency = parseBool(value, "low-latency");
+	if (const char* value = findOption(argc, argv, "reuse-command-buffers", "VULKAN_REUSE_COMMAND_BUFFERS"))
+		options.reuseCommandBuffers = parseBool(value, "reuse-command-buffers");
+	if (const char* value = findOption(argc, argv, "async-compute", "VULKAN_ASYNC_COMPUTE"))
+		options.asyncCompute = parseBool(value, "async-compute");
+	if (const char* value = findOption(argc, argv, "animation-lod", "VULKAN_ANIMATION_LOD"))
+		options.animationLod = parseBool(value, "animation-lod");
+	if (const char* value = findOption(argc, argv, "animation-budget", "VULKAN_ANIMATION_BUDGET"))
+		options.animationBudget = parseUnsigned(value, "animation-budget");
+	if (const char* value = findOption(argc, argv, "device", "VULKAN_DEVICE"))
+		options.device = value;
+	if (const char* value = findOption(argc, argv, "headless", "VULKAN_HEADLESS"))
+		options.headless = parseBool(value, "headless");
+	if (const char* value = findOption(argc, argv, "frames", "VULKAN_FRAMES"))
+		options.frames = parseUnsigned(value, "frames");
+	if (const char* value = findOption(argc, argv, "capture", "VULKAN_CAPTURE")) {
+		std::string text(value);
+		if (text != "png" && text != "raw")
+			throw std::invalid_argument(std::string("[Options#parse]: Error: Invalid value for capture: ") + value);
+		options.capture = text;
+	}
+	if (const char* value = findOption(argc, argv, "capture-directory", "VULKAN_CAPTURE_DIRECTORY"))
+		options.captureDirectory = value;
+	if (const char* value = findOption(argc, argv, "capture-interval", "VULKAN_CAPTURE_INTERVAL")) {
+		options.captureInterval = parseUnsigned(value, "capture-interval");
+		if (options.captureInterval == 0)
+			throw std::invalid_argument(std::string("[Options#parse]: Error: capture-interval has to be at least 1: ") + value);
+	}
+	if (const char* value = findOption(argc, argv, "math-benchmark", "VULKAN_MATH_BENCHMARK"))
+		options.mathBenchmark = parseBool(value, "math-benchmark");
+
+	return options;
+}
@@ -0,0 +1,63 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <cstdint>
+#include <string>
+
+// Frames the CPU may record ahead of the GPU, more trades latency for throughput
+const uint32_t g_MAX_FRAMES_IN_FLIGHT = 4;
+
+// Runtime settings, read from the command line (--name=value or --name value) or from VULKAN_<NAME> environment variables
+struct Options {
+	// Spawns this many copies of the model in a grid and reports frame times
+	uint32_t stressInstances = 0;
+	// Runs input, camera and animation on their own thread, one frame ahead of recording and submission
+	bool simulationThread = true;
+	// Lays down depth for opaque geometry first so the colour pass only shades visible fragments
+	bool depthPrepass = false;
+	// Counts fragment shader invocations with a pipeline statistics query and reports them every second
+	bool pipelineStatistics = false;
+	// Where vertices are skinned and morphed: "vertex" shader, "compute" pass once per pose, "cpu" into mapped memory,
+	// or "auto" for the CPU on software rasterizers like lavapipe and the compute pass everywhere else
+	std::string skinning = "auto";
+	// Skins the model with dual quaternions instead of blended matrices, half the palette size and no collapsing wrists
+	bool dualQuaternionSkinning = false;
+	// Frames the CPU may record while the GPU still renders earlier ones, 1 to g_MAX_FRAMES_IN_FLIGHT. More hides stalls, fewer cuts input latency
+	uint32_t framesInFlight = 2;
+	// "fifo", "fifo-relaxed", "mailbox", "immediate", or "auto" for mailbox when the surface has it and fifo otherwise
+	std::string presentMode = "auto";
+	// Frames per second the main loop is held to, 0 for no cap
+	uint32_t frameCap = 0;
+	// Only renders when the camera, input, poses, instances or the window size changed, and sleeps until an event otherwise
+	bool renderOnDemand = false;
+	// Frames per second still rendered while nothing changes, 0 for none
+	uint32_t keepAliveRate = 1;
+	// Waits for every frame to be on screen before starting the next one, with VK_KHR_present_wait
+	bool lowLatency = false;
+	// Records the draw calls once per frame slot and replays them until the scene's structure changes
+	bool reuseCommandBuffers = false;
+	// Runs that compute pass on a dedicated compute queue when the device has one
+	bool asyncCompute = true;
+	// Evaluates small and off-screen animated instances less often and freezes the ones outside the view
+	bool animationLod = true;
+	// Microseconds of CPU time pose evaluation may take per frame, 0 for no limit
+	uint32_t animationBudget = 2000;
+	// Index or part of the name of the Vulkan device to use, like "llvmpipe". Empty picks the best rated one
+	std::string device;
+	// Renders into offscreen images without opening a window or creating a surface, for machines without a display or GPU
+	bool headless = false;
+	// Exits after this many frames, 0 to run until the window is closed
+	uint32_t frames = 0;
+	// Reads rendered frames back and writes them as "png" or "raw" RGBA files, empty for no capture
+	std::string capture;
+	// Where captured frames are written
+	std::string captureDirectory = ".";
+	// Captures every Nth frame
+	uint32_t captureInterval = 1;
+	// Times the SIMD matrix kernels against glm and exits without opening a window
+	bool mathBenchmark = false;
+
+	static Options parse(int argc, char** argv);
+};
+
+#endif // OPTIONS_HPP
@@ -0,0 +1,404 @@
+#include "RenderGraph.hpp"
+#include "Vulkan.hpp"
+
+#include <algorithm>
+
+struct UsageInfo {
+	VkPipelineStageFlags2KHR stage;
+	VkAccessFlags2KHR access;
+	VkImageLayout layout;
+	// Whether the previous contents matter, and whether they get replaced
+	bool read;
+	bool write;
+};
+
+static UsageInfo usageInfo(RenderGraph::Usage usage) {
+	switch (usage) {
+		case RenderGraph::USAGE_COLOUR_ATTACHMENT:
+			return {VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR, VK_ACCESS_2_COLOR_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT_KHR, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL, false, true};
+		case RenderGraph::USAGE_DEPTH_ATTACHMENT:
+			return {VK_PIPELINE_STAGE_2_EARLY_FRAGMENT_TESTS_BIT_KHR | VK_PIPELINE_STAGE_2_LATE_FRAGMENT_TESTS_BIT_KHR, VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_READ_BIT_KHR | VK_ACCESS_2_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT_KHR, VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL, false, true};
+		case RenderGraph::USAGE_SAMPLED_FRAGMENT:
+			return {VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_SAMPLED_READ_BIT_KHR, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, true, false};
+		case RenderGraph::USAGE_STORAGE_READ_VERTEX:
+			return {VK_PIPELINE_STAGE_2_VERTEX_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR, VK_IMAGE_LAYOUT_GENERAL, true, false};
+		case RenderGraph::USAGE_STORAGE_READ_COMPUTE:
+			return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_READ_BIT_KHR, VK_IMAGE_LAYOUT_GENERAL, true, false};
+		case RenderGraph::USAGE_STORAGE_WRITE_COMPUTE:
+			return {VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT_KHR, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT_KHR, VK_IMAGE_LAYOUT_GENERAL, false, true};
+		case RenderGraph::USAGE_TRANSFER_SRC:
+			return {VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_READ_BIT_KHR, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, true, false};
+		case RenderGraph::USAGE_TRANSFER_DST:
+			return {VK_PIPELINE_STAGE_2_TRANSFER_BIT_KHR, VK_ACCESS_2_TRANSFER_WRITE_BIT_KHR, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, false, true};
+		case RenderGraph::USAGE_HOST_READ:
+			return {VK_PIPELINE_STAGE_2_HOST_BIT_KHR, VK_ACCESS_2_HOST_READ_BIT_KHR, VK_IMAGE_LAYOUT_GENERAL, true, false};
+		case RenderGraph::USAGE_PRESENT:
+		default:
+			// Presentation waits on a semaphore, the barrier only has to change the layout
+			return {VK_PIPELINE_STAGE_2_NONE_KHR, VK_ACCESS_2_NONE_KHR, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, true, false};
+	}
+}
+
+static bool hasStencil(VkFormat format) {
+	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT || format == VK_FORMAT_D16_UNORM_S8_UINT;
+}
+
+uint32_t RenderGraph::importImage(const std::string& name, VkImageAspectFlags aspect, VkPipelineStageFlags2KHR availableStage) {
+	Resource resource;
+	resource.name = name;
+	resource.type = RESOURCE_IMPORTED_IMAGE;
+	resource.aspect = aspect;
+	resource.barrierAspect = aspect;
+	resource.availableStage = availableStage;
+	m_Resources.push_back(resource);
+	return static_cast<uint32_t>(m_Resources.size() - 1);
+}
+
+uint32_t RenderGraph::importBuffer(const std::string& name) {
+	Resource resource;
+	resource.name = name;
+	resource.type = RESOURCE_BUFFER;
+	m_Resources.push_back(resource);
+	return static_cast<uint32_t>(m_Resources.size() - 1);
+}
+
+uint32_t RenderGraph::createImage(const std::string& name, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect) {
+	Resource resource;
+	resource.name = name;
+	resource.type = RESOURCE_TRANSIENT_IMAGE;
+	resource.format = format;
+	resource.usage = usage;
+	resource.aspect = aspect;
+	// Without separate depth stencil layouts both aspects always change layout together
+	resource.barrierAspect = aspect;
+	if ((aspect & VK_IMAGE_ASPECT_DEPTH_BIT) && hasStencil(format))
+		resource.barrierAspect |= VK_IMAGE_ASPECT_STENCIL_BIT;
+	m_Resources.push_back(resource);
+	return static_cast<uint32_t>(m_Resources.size() - 1);
+}
+
+void RenderGraph::markOutput(uint32_t resource, Usage usage) {
+	m_Resources.at(resource).output = true;
+	m_Resources.at(resource).outputUsage = usage;
+}
+
+void RenderGraph::addPass(const std::string& name, const std::vector<Use>& uses, const Record& record) {
+	for (size_t i = 0; i < uses.size(); i++) {
+		if (uses[i].resource >= m_Resources.size()) {
+			throw std::runtime_error("[RenderGraph#addPass]: Error: Pass " + name + " uses an unknown resource!");
+		}
+		for (size_t j = 0; j < i; j++) {
+			if (uses[j].resource == uses[i].resource) {
+				throw std::runtime_error("[RenderGraph#addPass]: Error: Pass " + name + " uses " + m_Resources[uses[i].resource].name + " twice!");
+			}
+		}
+	}
+
+	Pass pass;
+	pass.name = name;
+	pass.uses = uses;
+	pass.record = record;
+	m_Passes.push_back(pass);
+}
+
+void RenderGraph::compile(Vulkan& vulkan, VkExtent2D extent) {
+	m_CmdPipelineBarrier2 = vulkan.pvkCmdPipelineBarrier2KHR;
+	m_Extent = extent;
+
+	cull();
+	planBarriers();
+	allocateTransients(vulkan);
+
+	size_t barrierCount = m_FinalBarriers.size();
+	for (const Step& step : m_Steps) {
+		barrierCount += step.barriers.size();
+	}
+	std::cout << "[RenderGraph#compile]: Info: " << m_Steps.size() << " of " << m_Passes.size() << " passes with " << barrierCount << " barriers" << std::endl;
+}
+
+void RenderGraph::cull() {
+	// Walking back from the outputs, a pass stays when it writes something that a kept pass or the end of the frame reads
+	std::vector<bool> needed(m_Resources.size());
+	for (size_t r = 0; r < m_Resources.size(); r++) {
+		needed[r] = m_Resources[r].output;
+	}
+	for (size_t p = m_Passes.size(); p-- > 0;) {
+		Pass& pass = m_Passes[p];
+		pass.culled = true;
+		for (const Use& use : pass.uses) {
+			if (usageInfo(use.usage).write && needed[use.resource])
+				pass.culled = false;
+		}
+		if (pass.culled) {
+			std::cout << "[RenderGraph#cull]: Info: Nothing reads what pass " << pass.name << " writes, it is left out" << std::endl;
+			continue;
+		}
+		for (const Use& use : pass.uses) {
+			if (usageInfo(use.usage).read)
+				needed[use.resource] = true;
+		}
+	}
+
+	m_Steps.clear();
+	for (size_t p = 0; p < m_Passes.size(); p++) {
+		if (!m_Passes[p].culled)
+			m_Steps.push_back({static_cast<uint32_t>(p), {}});
+	}
+}
+
+void RenderGraph::planBarriers() {
+	// What the next access of a resource has to wait for and which writes it has to see
+	struct State {
+		VkPipelineStageFlags2KHR stage;
+		VkAccessFlags2KHR access;
+		VkImageLayout layout;
+	};
+
+	// Transients may share memory, so each one starts out after whatever the last of them did in the previous frame
+	State transient{VK_PIPELINE_STAGE_2_NONE_KHR, VK_ACCESS_2_NONE_KHR, VK_IMAGE_LAYOUT_UNDEFINED};
+	for (Resource& resource : m_Resources) {
+		resource.firstPass = -1;
+		resource.lastPass = -1;
+	}
+	for (size_t s = 0; s < m_Steps.size(); s++) {
+		for (const Use& use : m_Passes[m_Steps[s].pass].uses) {
+			Resource& resource = m_Resources[use.resource];
+			if (resource.firstPass == -1)
+				resource.firstPass = static_cast<int32_t>(s);
+			resource.lastPass = static_cast<int32_t>(s);
+			if (resource.type != RESOURCE_TRANSIENT_IMAGE)
+				continue;
+			UsageInfo info = usageInfo(use.usage);
+			transient.stage |= info.stage;
+			if (info.write)
+				transient.access |= info.access;
+		}
+	}
+
+	std::vector<State> states(m_Resources.size());
+	for (size_t r = 0; r < m_Resources.size(); r++) {
+		if (m_Resources[r].type == RESOURCE_TRANSIENT_IMAGE)
+			states[r] = transient;
+		else
+			states[r] = {m_Resources[r].availableStage, VK_ACCESS_2_NONE_KHR, VK_IMAGE_LAYOUT_UNDEFINED};
+	}
+
+	auto access = [&](uint32_t r, Usage usage, std::vector<Barrier>& barriers) {
+		UsageInfo info = usageInfo(usage);
+		State& state = states[r];
+		bool image = m_Resources[r].type != RESOURCE_BUFFER;
+		bool layoutChange = image && state.layout != info.layout;
+		bool hazard = state.access != VK_ACCESS_2_NONE_KHR || (info.write && state.stage != VK_PIPELINE_STAGE_2_NONE_KHR);
+		if (!layoutChange && !hazard) {
+			// Reads after reads need no ordering among each other, the next write waits for all of them
+			state.stage |= info.stage;
+			return;
+		}
+		barriers.push_back({r, state.stage, state.access, info.stage, info.access, state.layout, info.layout});
+		state.stage = info.stage;
+		state.access = info.write ? info.access : VK_ACCESS_2_NONE_KHR;
+		state.layout = info.layout;
+	};
+
+	for (Step& step : m_Steps) {
+		step.barriers.clear();
+		for (const Use& use : m_Passes[step.pass].uses) {
+			access(use.resource, use.usage, step.barriers);
+		}
+	}
+	m_FinalBarriers.clear();
+	for (uint32_t r = 0; r < m_Resources.size(); r++) {
+		if (m_Resources[r].output)
+			access(r, m_Resources[r].outputUsage, m_FinalBarriers);
+	}
+}
+
+void RenderGraph::allocateTransients(Vulkan& vulkan) {
+	std::vector<uint32_t> transients;
+	std::vector<VkDeviceSize> alignments(m_Resources.size());
+	uint32_t memoryTypeBits = ~0u;
+	for (uint32_t r = 0; r < m_Resources.size(); r++) {
+		Resource& resource = m_Resources[r];
+		// Images only the culled passes use are never created
+		if (resource.type != RESOURCE_TRANSIENT_IMAGE || resource.firstPass == -1)
+			continue;
+
+		VkImageCreateInfo imageInfo{};
+		imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+		imageInfo.imageType = VK_IMAGE_TYPE_2D;
+		imageInfo.extent.width = m_Extent.width;
+		imageInfo.extent.height = m_Extent.height;
+		imageInfo.extent.depth = 1;
+		imageInfo.mipLevels = 1;
+		imageInfo.arrayLayers = 1;
+		imageInfo.format = resource.format;
+		imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+		imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+		imageInfo.usage = resource.usage;
+		imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+		imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+		if (vkCreateImage(vulkan.m_Device, &imageInfo, nullptr, &resource.image) != VK_SUCCESS) {
+			throw std::runtime_error("[RenderGraph#allocateTransients]: Error: Failed to create image " + resource.name + "!");
+		}
+
+		VkMemoryRequirements memRequirements;
+		vkGetImageMemoryRequirements(vulkan.m_Device, resource.image, &memRequirements);
+		resource.size = memRequirements.size;
+		alignments[r] = memRequirements.alignment;
+		memoryTypeBits &= memRequirements.memoryTypeBits;
+		transients.push_back(r);
+	}
+	if (transients.empty())
+		return;
+
+	// Largest first, every image goes to the lowest offset that does not overlap an image which is alive at the same time
+	std::sort(transients.begin(), transients.end(), [&](uint32_t a, uint32_t b) {
+		return m_Resources[a].size > m_Resources[b].size;
+	});
+	VkDeviceSize memorySize = 0;
+	VkDeviceSize unaliasedSize = 0;
+	for (size_t i = 0; i < transients.size(); i++) {
+		Resource& resource = m_Resources[transients[i]];
+		VkDeviceSize alignment = alignments[transients[i]];
+		resource.offset = 0;
+		bool moved = true;
+		while (moved) {
+			moved = false;
+			for (size_t j = 0; j < i; j++) {
+				const Resource& placed = m_Resources[transients[j]];
+				bool alive = resource.firstPass <= placed.lastPass && placed.firstPass <= resource.lastPass;
+				bool overlaps = resource.offset < placed.offset + placed.size && placed.offset < resource.offset + resource.size;
+				if (alive && overlaps) {
+					resource.offset = (placed.offset + placed.size + alignment - 1) / alignment * alignment;
+					moved = true;
+				}
+			}
+		}
+		memorySize = std::max(memorySize, resource.offset + resource.size);
+		unaliasedSize += resource.size;
+	}
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memorySize;
+	allocInfo.memoryTypeIndex = vulkan.findMemoryType(memoryTypeBits, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+
+	if (vkAllocateMemory(vulkan.m_Device, &allocInfo, nullptr, &m_TransientMemory) != VK_SUCCESS) {
+		throw std::runtime_error("[RenderGraph#allocateTransients]: Error: Failed to allocate transient memory!");
+	}
+
+	for (uint32_t r : transients) {
+		Resource& resource = m_Resources[r];
+		vkBindImageMemory(vulkan.m_Device, resource.image, m_TransientMemory, resource.offset);
+		resource.imageView = vulkan.createImageView(resource.image, resource.format, resource.aspect);
+	}
+
+	std::cout << "[RenderGraph#allocateTransients]: Info: " << transients.size() << " transient images at " << m_Extent.width << "x" << m_Extent.height << " in " << memorySize / 1024 << " KiB, " << unaliasedSize / 1024 << " KiB without aliasing" << std::endl;
+}
+
+RenderGraph::Transients RenderGraph::releaseTransients() {
+	Transients transients;
+	for (Resource& resource : m_Resources) {
+		if (resource.type != RESOURCE_TRANSIENT_IMAGE || resource.image == VK_NULL_HANDLE)
+			continue;
+		transients.images.push_back(resource.image);
+		transients.imageViews.push_back(resource.imageView);
+		resource.image = VK_NULL_HANDLE;
+		resource.imageView = VK_NULL_HANDLE;
+	}
+	transients.memory = m_TransientMemory;
+	m_TransientMemory = VK_NULL_HANDLE;
+	return transients;
+}
+
+bool RenderGraph::resize(Vulkan& vulkan, VkExtent2D extent, Transients& retired) {
+	// A frame that only shrank renders into a corner of the images it had, passes have to go by the frame's extent and not the image's
+	if (extent.width <= m_Extent.width && extent.height <= m_Extent.height)
+		return false;
+
+	retired = releaseTransients();
+	m_Extent.width = std::max(m_Extent.width, extent.width);
+	m_Extent.height = std::max(m_Extent.height, extent.height);
+	allocateTransients(vulkan);
+	return true;
+}
+
+void RenderGraph::setImage(uint32_t resource, VkImage image) {
+	m_Resources[resource].image = image;
+}
+
+VkImageView RenderGraph::getImageView(uint32_t resource) const {
+	return m_Resources.at(resource).imageView;
+}
+
+void RenderGraph::execute(VkCommandBuffer commandBuffer) {
+	for (const Step& step : m_Steps) {
+		recordBarriers(commandBuffer, step.barriers);
+		m_Passes[step.pass].record(commandBuffer);
+	}
+	recordBarriers(commandBuffer, m_FinalBarriers);
+}
+
+void RenderGraph::recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers) {
+	if (barriers.empty())
+		return;
+
+	m_MemoryBarriers.clear();
+	m_ImageBarriers.clear();
+	for (const Barrier& barrier : barriers) {
+		const Resource& resource = m_Resources[barrier.resource];
+		if (resource.type == RESOURCE_BUFFER) {
+			// Buffers have no layout, a global barrier covers all of them at once
+			VkMemoryBarrier2KHR memoryBarrier{};
+			memoryBarrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2_KHR;
+			memoryBarrier.srcStageMask = barrier.srcStage;
+			memoryBarrier.srcAccessMask = barrier.srcAccess;
+			memoryBarrier.dstStageMask = barrier.dstStage;
+			memoryBarrier.dstAccessMask = barrier.dstAccess;
+			m_MemoryBarriers.push_back(memoryBarrier);
+			continue;
+		}
+
+		VkImageMemoryBarrier2KHR imageBarrier{};
+		imageBarrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2_KHR;
+		imageBarrier.srcStageMask = barrier.srcStage;
+		imageBarrier.srcAccessMask = barrier.srcAccess;
+		imageBarrier.dstStageMask = barrier.dstStage;
+		imageBarrier.dstAccessMask = barrier.dstAccess;
+		imageBarrier.oldLayout = barrier.oldLayout;
+		imageBarrier.newLayout = barrier.newLayout;
+		imageBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+		imageBarrier.image = resource.image;
+		imageBarrier.subresourceRange.aspectMask = resource.barrierAspect;
+		imageBarrier.subresourceRange.baseMipLevel = 0;
+		imageBarrier.subresourceRange.levelCount = 1;
+		imageBarrier.subresourceRange.baseArrayLayer = 0;
+		imageBarrier.subresourceRange.layerCount = 1;
+		m_ImageBarriers.push_back(imageBarrier);
+	}
+
+	VkDependencyInfoKHR dependencyInfo{};
+	dependencyInfo.sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO_KHR;
+	dependencyInfo.memoryBarrierCount = static_cast<uint32_t>(m_MemoryBarriers.size());
+	dependencyInfo.pMemoryBarriers = m_MemoryBarriers.data();
+	dependencyInfo.imageMemoryBarrierCount = static_cast<uint32_t>(m_ImageBarriers.size());
+	dependencyInfo.pImageMemoryBarriers = m_ImageBarriers.data();
+	m_CmdPipelineBarrier2(commandBuffer, &dependencyInfo);
+}
+
+void RenderGraph::cleanup(Vulkan& vulkan) {
+	destroyTransients(vulkan.m_Device, releaseTransients());
+}
+
+void RenderGraph::destroyTransients(VkDevice device, const Transients& transients) {
+	for (VkImageView imageView : transients.imageViews) {
+		vkDestroyImageView(device, imageView, nullptr);
+	}
+	for (VkImage image : transients.images) {
+		vkDestroyImage(device, image, nullptr);
+	}
+	if (transients.memory != VK_NULL_HANDLE)
+		vkFreeMemory(device, transients.memory, nullptr);
+}
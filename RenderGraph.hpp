@@ -0,0 +1,140 @@
+#ifndef RENDERGRAPH_HPP
+#define RENDERGRAPH_HPP
+
+#include <vulkan/vulkan_core.h>
+#include <functional>
+#include <string>
+#include <vector>
+
+class Vulkan;
+
+// The frame as a list of passes and the resources each of them reads and writes.
+// Compiling drops the passes nothing depends on, works out every barrier and layout transition in between with synchronization2
+// and lets transient images that are never alive at the same time share memory. Executing records the passes with those barriers
+class RenderGraph {
+public:
+	// How a pass touches a resource, each one stands for pipeline stages, accesses and, for images, a layout
+	enum Usage {
+		// Attachments are cleared by the pass that renders to them, their previous contents are never read
+		USAGE_COLOUR_ATTACHMENT,
+		USAGE_DEPTH_ATTACHMENT,
+		USAGE_SAMPLED_FRAGMENT,
+		USAGE_STORAGE_READ_VERTEX,
+		USAGE_STORAGE_READ_COMPUTE,
+		USAGE_STORAGE_WRITE_COMPUTE,
+		USAGE_TRANSFER_SRC,
+		USAGE_TRANSFER_DST,
+		// Read by the CPU once the frame is done, through mapped memory
+		USAGE_HOST_READ,
+		USAGE_PRESENT
+	};
+
+	struct Use {
+		uint32_t resource;
+		Usage usage;
+	};
+
+	typedef std::function<void(VkCommandBuffer)> Record;
+
+	// Memory of the transient images, handed out by resize so the caller can destroy it once no frame uses it anymore
+	struct Transients {
+		std::vector<VkImage> images;
+		std::vector<VkImageView> imageViews;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+	};
+
+	// An image owned by someone else, bound with setImage before every execute. Its contents are discarded on first use,
+	// availableStage is the stage it can be written from, the one a semaphore guarding it is waited on
+	uint32_t importImage(const std::string& name, VkImageAspectFlags aspect, VkPipelineStageFlags2KHR availableStage);
+	// Buffers are tracked as a whole and synchronized with memory barriers, they may stand for any number of VkBuffers
+	uint32_t importBuffer(const std::string& name);
+	// An image only used within the frame, created by compile at the size of the frame
+	uint32_t createImage(const std::string& name, VkFormat format, VkImageUsageFlags usage, VkImageAspectFlags aspect);
+	// Keeps the passes producing resource and leaves it ready for usage at the end of the frame
+	void markOutput(uint32_t resource, Usage usage);
+	// Passes run in the order they are added, so they can only depend on earlier ones
+	void addPass(const std::string& name, const std::vector<Use>& uses, const Record& record);
+
+	void compile(Vulkan& vulkan, VkExtent2D extent);
+	// Reallocates the transient images when extent no longer fits inside them, the old ones end up in retired. Returns whether it did
+	bool resize(Vulkan& vulkan, VkExtent2D extent, Transients& retired);
+	void setImage(uint32_t resource, VkImage image);
+	VkImageView getImageView(uint32_t resource) const;
+	void execute(VkCommandBuffer commandBuffer);
+	void cleanup(Vulkan& vulkan);
+	static void destroyTransients(VkDevice device, const Transients& transients);
+
+private:
+	enum ResourceType {
+		RESOURCE_IMPORTED_IMAGE,
+		RESOURCE_TRANSIENT_IMAGE,
+		RESOURCE_BUFFER
+	};
+
+	struct Resource {
+		std::string name;
+		ResourceType type;
+		VkFormat format = VK_FORMAT_UNDEFINED;
+		VkImageUsageFlags usage = 0;
+		// Aspect of the view, barriers cover the stencil of combined formats as well
+		VkImageAspectFlags aspect = 0;
+		VkImageAspectFlags barrierAspect = 0;
+		VkPipelineStageFlags2KHR availableStage = VK_PIPELINE_STAGE_2_NONE_KHR;
+		bool output = false;
+		Usage outputUsage = USAGE_PRESENT;
+
+		VkImage image = VK_NULL_HANDLE;
+		VkImageView imageView = VK_NULL_HANDLE;
+		VkDeviceSize offset = 0;
+		VkDeviceSize size = 0;
+		// Compiled passes using it, transients are alive from the first to the last
+		int32_t firstPass = -1;
+		int32_t lastPass = -1;
+	};
+
+	struct Pass {
+		std::string name;
+		std::vector<Use> uses;
+		Record record;
+		bool culled = false;
+	};
+
+	// Images are looked up when the barrier is recorded, imported ones change every frame
+	struct Barrier {
+		uint32_t resource;
+		VkPipelineStageFlags2KHR srcStage;
+		VkAccessFlags2KHR srcAccess;
+		VkPipelineStageFlags2KHR dstStage;
+		VkAccessFlags2KHR dstAccess;
+		VkImageLayout oldLayout;
+		VkImageLayout newLayout;
+	};
+
+	// A pass that survived culling and the barriers recorded in front of it
+	struct Step {
+		uint32_t pass;
+		std::vector<Barrier> barriers;
+	};
+
+	void cull();
+	void planBarriers();
+	void allocateTransients(Vulkan& vulkan);
+	// Takes the transient images and their memory out of the graph
+	Transients releaseTransients();
+	void recordBarriers(VkCommandBuffer commandBuffer, const std::vector<Barrier>& barriers);
+
+	std::vector<Resource> m_Resources;
+	std::vector<Pass> m_Passes;
+	std::vector<Step> m_Steps;
+	// Brings the outputs into their final usage after the last pass
+	std::vector<Barrier> m_FinalBarriers;
+
+	VkExtent2D m_Extent{0, 0};
+	VkDeviceMemory m_TransientMemory = VK_NULL_HANDLE;
+	PFN_vkCmdPipelineBarrier2KHR m_CmdPipelineBarrier2 = nullptr;
+	// Reused by every recordBarriers, so executing does not allocate
+	std::vector<VkMemoryBarrier2KHR> m_MemoryBarriers;
+	std::vector<VkImageMemoryBarrier2KHR> m_ImageBarriers;
+};
+
+#endif // RENDERGRAPH_HPP
@@ -3,12 +3,59 @@
 #define STB_IMAGE_IMPLEMENTATION
 #include "stb_image.h"
 
-void Scene::update(uint32_t currentImage, bool keystates[400], double dt) {
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <glm/gtc/matrix_transform.hpp>
+#include <glm/gtc/matrix_access.hpp>
+
+// Vertices are stored with y and z swapped, so the skinning matrices have to be expressed in that space too
+static const glm::mat4 g_SWAP_YZ(
+	1, 0, 0, 0,
+	0, 0, 1, 0,
+	0, 1, 0, 0,
+	0, 0, 0, 1);
+
+void Scene::simulate(bool keystates[400], double dt, FrameSnapshot& snapshot) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	glm::mat4 previousView = camera.m_View;
+	glm::mat4 previousProjection = camera.m_Projection;
 	handleKeystate(keystates, dt);
 	updateCamera(dt);
-	updateUniformBuffers(currentImage);
-	vrmImporter.recalculateMatrices();
-	updateNodeBuffers(currentImage);
+	sortDrawOrder(snapshot.drawOrder);
+	updateAnimationLod();
+	animator.update(dt, g_SWAP_YZ);
+	updateSharedSprings(dt);
+	writePalette(snapshot);
+
+	// Characters that are neither evaluated, interpolated nor waiting for their turn hold a frozen pose
+	const Animator::Stats& stats = animator.m_Stats;
+	snapshot.changed = structureChanged || camera.m_View != previousView || camera.m_Projection != previousProjection ||
+		vrmImporter.m_TransformVersion != simulatedTransformVersion || depthPrepass != simulatedDepthPrepass ||
+		stats.evaluated + stats.interpolated + stats.deferred > 0;
+	structureChanged = false;
+	simulatedTransformVersion = vrmImporter.m_TransformVersion;
+	simulatedDepthPrepass = depthPrepass;
+
+	snapshot.camera = camera;
+	snapshot.instances = instances;
+	snapshot.activeMorphs.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		meshes[i].collectActiveMorphs(snapshot.activeMorphs[i]);
+	}
+	snapshot.depthPrepass = depthPrepass;
+	snapshot.animationStats = animator.m_Stats;
+}
+
+void Scene::upload(FrameSnapshot& snapshot, uint32_t currentImage) {
+	vulkan->m_DepthPrepass = snapshot.depthPrepass;
+	surfaceAspect = float(vulkan->m_SwapChainExtent.width) / float(vulkan->m_SwapChainExtent.height);
+
+	updateUniformBuffers(snapshot, currentImage);
+	updateMorphBuffers(snapshot, currentImage);
+	updatePaletteBuffers(snapshot, currentImage);
+	updatePoseBuffers(snapshot, currentImage);
+	updateInstanceBuffers(snapshot, currentImage);
 }
 
 void Scene::cleanup() {
@@ -22,10 +69,9 @@ void Scene::cleanup() {
 		vkFreeMemory(vulkan->m_Device, textureImageMemories[i], nullptr);
 	}
 
-	for (int i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
-		vkDestroyBuffer(vulkan->m_Device, nodeBuffers[i], nullptr);
-		vkFreeMemory(vulkan->m_Device, nodeBuffersMemory[i], nullptr);
-	}
+	destroyPaletteBuffers();
+	destroyInstanceBuffers();
+	destroyPoseBuffers();
 
 	vkDestroyDescriptorPool(vulkan->m_Device, descriptorPool, nullptr);
 	vkDestroyDescriptorSetLayout(vulkan->m_Device, descriptorSetLayout, nullptr);
@@ -35,8 +81,11 @@ void Scene::load(const std::string& file, Vulkan* vulkan) {
 	this->vulkan = vulkan;
 
 	vrmImporter.loadModel(file);
+	animator.init(&vrmImporter, &threadPool);
 	size_t meshCount = vrmImporter.getMeshCount();
 	meshes.reserve(meshCount);
+	glm::vec3 modelMin(std::numeric_limits<float>::max());
+	glm::vec3 modelMax(std::numeric_limits<float>::lowest());
 
 	for (size_t i = 0; i < meshCount; i++) {
 		size_t primitiveCount = vrmImporter.getPrimitiveCount(i);
@@ -50,6 +99,9 @@ void Scene::load(const std::string& file, Vulkan* vulkan) {
 			Array<glm::u16vec4> joints = vrmImporter.getMeshAttribute<glm::u16vec4>(i, j, "JOINTS_0");
 			Array<glm::vec4> weights = vrmImporter.getMeshAttribute<glm::vec4>(i, j, "WEIGHTS_0");
 			m.m_Vertices.reserve(positions.count);
+			m.m_ModelMatrix = glm::rotate(glm::mat4(1.0f), (float)glm::radians(90.0), glm::vec3(-1, 0, 0));
+			glm::vec3 boundsMin(std::numeric_limits<float>::max());
+			glm::vec3 boundsMax(std::numeric_limits<float>::lowest());
 
 			for (size_t k = 0; k < positions.count; k++) {
 				Vertex v;
@@ -65,6 +117,13 @@ void Scene::load(const std::string& file, Vulkan* vulkan) {
 					v.weights = weights.data[k];
 
 				m.m_Vertices.push_back(v);
+				boundsMin = glm::min(boundsMin, v.pos);
+				boundsMax = glm::max(boundsMax, v.pos);
+			}
+			if (positions.count > 0) {
+				m.m_Center = (boundsMin + boundsMax) * 0.5f;
+				modelMin = glm::min(modelMin, boundsMin);
+				modelMax = glm::max(modelMax, boundsMax);
 			}
 
 			size_t animCount = vrmImporter.getMeshBlendShapeCount(i, j);
@@ -79,6 +138,7 @@ void Scene::load(const std::string& file, Vulkan* vulkan) {
 				}
 				m.m_Anims.push_back(anim);
 			}
+			m.m_MorphWeights.assign(animCount, 0.0f);
 
 			Array<uint32_t> indices = vrmImporter.getMeshProperty<uint32_t>(i, j, "indices");
 			m.m_Indices.reserve(indices.count);
@@ -86,32 +146,52 @@ void Scene::load(const std::string& file, Vulkan* vulkan) {
 				m.m_Indices.push_back(indices.data[k]);
 			}
 
+			m.m_SkinOffset = vrmImporter.getSkinPaletteOffset(vrmImporter.findNodeFromMeshIndex(i));
+
 			size_t materialIndex = vrmImporter.getMeshMaterialIndex(i, j);
 			m.m_Material = vrmImporter.getMaterial(materialIndex);
 			meshes.push_back(m);
 		}
 	}
 
+	if (modelMin.x <= modelMax.x) {
+		boundsCenter = (modelMin + modelMax) * 0.5f;
+		boundsRadius = glm::length(modelMax - modelMin) * 0.5f * 1.25f;
+	}
+
+	// Decoding takes longer than the rest of loading, and every texture decodes on its own.
+	// The header lookups are not safe to run concurrently, so the encoded bytes are located first
 	size_t textureCount = vrmImporter.getTextureCount();
-	textureData.reserve(textureCount);
+	std::vector<VRM::TextureData> encoded(textureCount);
 	for (size_t i = 0; i < textureCount; i++) {
-		VRM::TextureData data = vrmImporter.getTextureData(i);
-		std::vector<uint8_t> temp;
-		temp.reserve(data.byteLength);
-		for (size_t j = 0; j < data.byteLength; j++) {
-			char* ptr = data.begin + j;
-			temp.push_back(*ptr);
-		}
-		textureData.push_back(temp);
+		encoded[i] = vrmImporter.getTextureData(i);
 	}
+	textureData.resize(textureCount);
+	threadPool.parallelFor(textureCount, [&](size_t i) {
+		int texWidth, texHeight, texChannels;
+		stbi_uc* pixels = stbi_load_from_memory(reinterpret_cast<const stbi_uc*>(encoded[i].begin), static_cast<int>(encoded[i].byteLength), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (!pixels)
+			return;
+		textureData[i].pixels.assign(pixels, pixels + size_t(texWidth) * texHeight * 4);
+		textureData[i].width = static_cast<uint32_t>(texWidth);
+		textureData[i].height = static_cast<uint32_t>(texHeight);
+		stbi_image_free(pixels);
+	});
+	for (const auto& texture : textureData) {
+		if (texture.pixels.empty())
+			throw std::runtime_error("[Scene#load]: Error: Failed to load texture image!");
+	}
+}
 
-	vrmImporter.calculateJoints();
+void Scene::setupLayouts() {
+	createDescriptorSetLayouts(textureData.size());
+	depthPrepass = vulkan->m_DepthPrepass;
+	surfaceAspect = float(vulkan->m_SwapChainExtent.width) / float(vulkan->m_SwapChainExtent.height);
+	vulkan->m_DualQuaternionSkinning = vrmImporter.m_SkinningMethod == VRM::SKINNING_METHOD_DUAL_QUATERNION;
 }
 
-void Scene::setup() {
+void Scene::uploadAssets() {
 	size_t textureCount = textureData.size();
-	createDescriptorSetLayouts(textureCount);
-
 	createTextureImages(textureCount);
 	createTextureImageViews(textureCount);
 	createTextureSamplers(textureCount);
@@ -121,66 +201,330 @@ void Scene::setup() {
 	createUniformBuffers();
 	createMaterialBuffers();
 	createAnimBuffers();
-	createNodeBuffers();
+	createMorphBuffers();
+	createPaletteBuffers(1 + animator.m_Characters.size());
+	createInstanceBuffers(std::max<size_t>(instances.size(), 1));
+	createPoseBuffers(1);
 	createDescriptorPools();
 	createDescriptorSets();
+}
 
+void Scene::createPipelines() {
 	const std::vector<VkDescriptorSetLayout> layouts = {
 		meshes[0].m_DescriptorSetLayout,
 		descriptorSetLayout
 	};
-
 	vulkan->createGraphicsPipeline(layouts);
+	if (vulkan->m_Skinning == SKINNING_COMPUTE)
+		vulkan->createComputePipeline(layouts);
 }
 
-void Scene::draw() {
-	VkCommandBuffer commandBuffer = vulkan->m_CommandBuffers[vulkan->m_CurrentFrame];
+void Scene::createFrameGraph() {
+	if (vulkan->m_Skinning == SKINNING_CPU)
+		cpuSkinner.init(meshes, &threadPool);
+	vulkan->createFrameGraph(
+		[this](VkCommandBuffer commandBuffer) { recordDeform(commandBuffer); },
+		[this](VkCommandBuffer commandBuffer) { draw(commandBuffer, *recordedFrame); });
+}
+
+void Scene::record(const FrameSnapshot& snapshot, uint32_t imageIndex) {
+	deform(snapshot);
+	if (vulkan->m_ReuseCommandBuffers)
+		checkDrawSignature(snapshot);
+	recordedFrame = &snapshot;
+	vulkan->recordFrameGraph(imageIndex);
+	recordedFrame = nullptr;
+}
+
+void Scene::deform(const FrameSnapshot& snapshot) {
+	if (vulkan->m_Skinning == SKINNING_CPU) {
+		// The timeline wait of this frame has returned, so its deformed buffers are free to overwrite
+		cpuSkinner.deform(meshes, poses, snapshot.palette.data(), vrmImporter.m_SkinningMethod, vulkan->m_CurrentFrame);
+		return;
+	}
+	// On the graphics queue deformation is a pass of the frame graph
+	if (vulkan->m_Skinning != SKINNING_COMPUTE || !vulkan->m_AsyncCompute)
+		return;
+
+	VkCommandBuffer commandBuffer = vulkan->beginComputeCommands();
+	recordDeform(commandBuffer);
+	vulkan->endComputeCommands(commandBuffer);
+}
+
+void Scene::recordDeform(VkCommandBuffer commandBuffer) {
+	// Every pose gets skinned and morphed once here, all passes drawing the model afterwards just read the result
 	size_t frame = vulkan->m_CurrentFrame;
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkan->m_DeformPipeline);
+
 	for (const auto& mesh : meshes) {
-		VkBuffer vBuffers[] = {mesh.m_VertexBuffer};
-		VkDeviceSize offsets[] = {0};
-		vkCmdBindVertexBuffers(commandBuffer, 0, 1, vBuffers, offsets);
-		vkCmdBindIndexBuffer(commandBuffer, mesh.m_IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
-
-		VkDescriptorSet meshs = mesh.m_DescriptorSets[frame];
-		VkDescriptorSet scenes = descriptorSets[frame];
-		std::array<VkDescriptorSet, 2> sets = {
-		 	meshs,
-		 	scenes
-		};
-		//VkDescriptorSet sets[2] = {mesh.descriptorSets[frame], descriptorSets[frame]};
-
-		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkan->m_PipelineLayout, 0, sets.size(), sets.data(), 0, nullptr);
-
-		int nodeIndex = vrmImporter.findNodeFromMeshIndex(mesh.m_MeshIndex);
-		// VRM::FCNSNode& node = vrmImporter.nodes[nodeIndex];
-		// if (node.skin != -1) {
-		// 	std::cout << node.skin << std::endl;
-		// 	std::vector<glm::mat4>& joints = vrmImporter.joints[node.skin];
-		// 	for (size_t i = 0; i < joints.size(); i++) {
-		// 		vrmImporter.nodes[i].jointMatrix = joints[i];
-		// 	}
-		// 	memcpy(nodeBuffersMapped[vulkan->currentFrame], vrmImporter.nodes.data(), sizeof(vrmImporter.nodes[0]) * vrmImporter.nodes.size());
-		// }
-
-		float anim = 0.0;
-		if (!mesh.m_Anims.empty())
-		 	anim = 1.0;
-
-		PushConstants constants;
-		constants.materialIndex = 0;
-		constants.value = anim;
+		std::array<VkDescriptorSet, 2> sets = {mesh.m_DescriptorSets[frame], descriptorSets[frame]};
+		vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, vulkan->m_ComputePipelineLayout, 0, sets.size(), sets.data(), 0, nullptr);
+
+		DeformConstants constants;
 		constants.numVertices = mesh.m_Vertices.size();
-		constants.nodeIndex = nodeIndex;
+		constants.skinOffset = mesh.m_SkinOffset;
+		constants.poseCount = poses.size();
+		constants.morphCount = static_cast<int>(mesh.m_ActiveMorphs.size());
+
+		vkCmdPushConstants(commandBuffer, vulkan->m_ComputePipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(DeformConstants), &constants);
+		vkCmdDispatch(commandBuffer, (constants.numVertices + 63) / 64, static_cast<uint32_t>(poses.size()), 1);
+	}
+}
+
+void Scene::checkDrawSignature(const FrameSnapshot& snapshot) {
+	uint32_t frame = vulkan->m_CurrentFrame;
+	drawSignatures.resize(vulkan->m_FramesInFlight);
+	currentSignature.drawOrder = snapshot.drawOrder;
+	currentSignature.morphCounts.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		currentSignature.morphCounts[i] = static_cast<int>(meshes[i].m_ActiveMorphs.size());
+	}
+	currentSignature.instanceCount = snapshot.instances.size();
+	currentSignature.depthPrepass = vulkan->m_DepthPrepass;
+
+	if (currentSignature == drawSignatures[frame])
+		return;
+	std::swap(currentSignature, drawSignatures[frame]);
+	vulkan->invalidateSceneCommands(frame);
+}
+
+void Scene::draw(VkCommandBuffer commandBuffer, const FrameSnapshot& snapshot) {
+	size_t frame = vulkan->m_CurrentFrame;
+	size_t instanceCount = snapshot.instances.size();
+	if (vulkan->m_DepthPrepass) {
+		// Lay down the depth of opaque geometry first, so the colour pass shades every covered pixel only once
+		for (size_t meshIndex : snapshot.drawOrder) {
+			if (meshes[meshIndex].m_Material.alphaMode == VRM::ALPHA_MODE_OPAQUE)
+				drawMesh(commandBuffer, meshes[meshIndex], frame, instanceCount, true);
+		}
+	}
+	for (size_t meshIndex : snapshot.drawOrder) {
+		drawMesh(commandBuffer, meshes[meshIndex], frame, instanceCount, false);
+	}
+}
 
-		vkCmdPushConstants(commandBuffer, vulkan->m_PipelineLayout,  VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &constants);
-		//vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
-		vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(mesh.m_Indices.size()), 1, 0, 0, 0);
+void Scene::sortDrawOrder(std::vector<size_t>& drawOrder) {
+	// Opaque geometry goes front-to-back so early depth testing rejects as much as possible,
+	// only blended geometry needs the back-to-front order for correct compositing
+	std::vector<float> viewDepths(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		glm::vec4 viewPosition = camera.m_View * meshes[i].m_ModelMatrix * glm::vec4(meshes[i].m_Center, 1.0f);
+		viewDepths[i] = -viewPosition.z;
 	}
+
+	drawOrder.resize(meshes.size());
+	for (size_t i = 0; i < meshes.size(); i++) {
+		drawOrder[i] = i;
+	}
+
+	auto blendedBegin = std::partition(drawOrder.begin(), drawOrder.end(), [&](size_t i) {
+		return meshes[i].m_Material.alphaMode != VRM::ALPHA_MODE_BLEND;
+	});
+	std::sort(drawOrder.begin(), blendedBegin, [&](size_t a, size_t b) {
+		return viewDepths[a] < viewDepths[b];
+	});
+	std::sort(blendedBegin, drawOrder.end(), [&](size_t a, size_t b) {
+		return viewDepths[a] > viewDepths[b];
+	});
+}
+
+void Scene::updateAnimationLod() {
+	if (animator.m_Characters.empty() || meshes.empty())
+		return;
+
+	// Frustum planes pointing inwards, extracted from the view-projection matrix
+	glm::mat4 viewProjection = camera.m_Projection * camera.m_View;
+	std::array<glm::vec4, 6> planes = {
+		glm::row(viewProjection, 3) + glm::row(viewProjection, 0),
+		glm::row(viewProjection, 3) - glm::row(viewProjection, 0),
+		glm::row(viewProjection, 3) + glm::row(viewProjection, 1),
+		glm::row(viewProjection, 3) - glm::row(viewProjection, 1),
+		glm::row(viewProjection, 2),
+		glm::row(viewProjection, 3) - glm::row(viewProjection, 2)
+	};
+	for (auto& plane : planes) {
+		plane /= glm::length(glm::vec3(plane));
+	}
+
+	for (size_t slot = 0; slot < instances.size(); slot++) {
+		int32_t character = instanceCharacters[instanceIds[slot]];
+		if (character == -1)
+			continue;
+		if (!animationLod) {
+			animator.setLod(character, 1, 0.0f);
+			continue;
+		}
+
+		glm::mat4 model = instances[slot].transform * meshes[0].m_ModelMatrix;
+		glm::vec3 center = glm::vec3(model * glm::vec4(boundsCenter, 1.0f));
+		float scale = std::max({glm::length(glm::vec3(model[0])), glm::length(glm::vec3(model[1])), glm::length(glm::vec3(model[2]))});
+		float radius = boundsRadius * scale;
+
+		bool visible = true;
+		for (const auto& plane : planes) {
+			if (glm::dot(glm::vec3(plane), center) + plane.w < -radius) {
+				visible = false;
+				break;
+			}
+		}
+		// Nobody sees a frozen pose, it picks up again the frame the instance comes back into view
+		if (!visible) {
+			animator.setLod(character, 0, 0.0f);
+			continue;
+		}
+
+		// Projected radius as a fraction of half the viewport height
+		float distance = std::max(-(camera.m_View * glm::vec4(center, 1.0f)).z, 0.01f);
+		float screenSize = radius * camera.m_Projection[1][1] / distance;
+		uint32_t interval = screenSize > 0.5f ? 1 : screenSize > 0.15f ? 2 : 4;
+		animator.setLod(character, interval, screenSize);
+	}
+}
+
+void Scene::drawMesh(VkCommandBuffer commandBuffer, const Mesh& mesh, size_t frame, size_t instanceCount, bool depthOnly) {
+	if (depthOnly)
+		vulkan->bindDepthPrepassPipeline(commandBuffer, mesh.m_Material.doubleSided);
+	else
+		vulkan->bindGraphicsPipeline(commandBuffer, mesh.m_Material);
+
+	VkBuffer vBuffers[] = {depthOnly ? mesh.m_DepthVertexBuffer : mesh.m_VertexBuffer};
+	VkDeviceSize offsets[] = {0};
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, vBuffers, offsets);
+	vkCmdBindIndexBuffer(commandBuffer, mesh.m_IndexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+	VkDescriptorSet meshs = mesh.m_DescriptorSets[frame];
+	VkDescriptorSet scenes = descriptorSets[frame];
+	std::array<VkDescriptorSet, 2> sets = {
+	 	meshs,
+	 	scenes
+	};
+	//VkDescriptorSet sets[2] = {mesh.descriptorSets[frame], descriptorSets[frame]};
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, vulkan->m_PipelineLayout, 0, sets.size(), sets.data(), 0, nullptr);
+
+	// VRM::FCNSNode& node = vrmImporter.nodes[nodeIndex];
+	// if (node.skin != -1) {
+	// 	std::cout << node.skin << std::endl;
+	// 	std::vector<glm::mat4>& joints = vrmImporter.joints[node.skin];
+	// 	for (size_t i = 0; i < joints.size(); i++) {
+	// 		vrmImporter.nodes[i].jointMatrix = joints[i];
+	// 	}
+	// 	memcpy(nodeBuffersMapped[vulkan->currentFrame], vrmImporter.nodes.data(), sizeof(vrmImporter.nodes[0]) * vrmImporter.nodes.size());
+	// }
+
+	PushConstants constants;
+	constants.materialIndex = 0;
+	constants.morphCount = static_cast<int>(mesh.m_ActiveMorphs.size());
+	constants.numVertices = mesh.m_Vertices.size();
+	constants.skinOffset = mesh.m_SkinOffset;
+
+	vkCmdPushConstants(commandBuffer, vulkan->m_PipelineLayout,  VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(PushConstants), &constants);
+	//vkCmdDraw(commandBuffer, static_cast<uint32_t>(vertices.size()), 1, 0, 0);
+	vkCmdDrawIndexed(commandBuffer, static_cast<uint32_t>(mesh.m_Indices.size()), static_cast<uint32_t>(instanceCount), 0, 0, 0);
+}
+
+uint32_t Scene::spawnInstance(const glm::mat4& transform) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	structureChanged = true;
+	uint32_t id;
+	if (!freeInstanceIds.empty()) {
+		id = freeInstanceIds.back();
+		freeInstanceIds.pop_back();
+	} else {
+		id = static_cast<uint32_t>(instanceSlots.size());
+		instanceSlots.push_back(0);
+		instanceCharacters.push_back(-1);
+	}
+
+	InstanceData instance{};
+	instance.transform = transform;
+	instance.morphWeight = 1.0f;
+	instance.paletteOffset = 0;
+
+	instanceSlots[id] = static_cast<uint32_t>(instances.size());
+	instances.push_back(instance);
+	instanceIds.push_back(id);
+	return id;
+}
+
+void Scene::despawnInstance(uint32_t id) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	assert(id < instanceSlots.size() && instanceSlots[id] != UINT32_MAX);
+	structureChanged = true;
+	releaseCharacter(id);
+	uint32_t slot = instanceSlots[id];
+
+	// Move the last instance into the hole so the array stays dense
+	uint32_t lastId = instanceIds.back();
+	instances[slot] = instances.back();
+	instanceIds[slot] = lastId;
+	instanceSlots[lastId] = slot;
+
+	instances.pop_back();
+	instanceIds.pop_back();
+	instanceSlots[id] = UINT32_MAX;
+	freeInstanceIds.push_back(id);
+}
+
+void Scene::setInstanceTransform(uint32_t id, const glm::mat4& transform) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	assert(id < instanceSlots.size() && instanceSlots[id] != UINT32_MAX);
+	structureChanged = true;
+	instances[instanceSlots[id]].transform = transform;
+}
+
+void Scene::setMorphWeight(int meshIndex, size_t target, float weight) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	structureChanged = true;
+	// glTF keeps blend shape weights per mesh, every primitive of it shares them
+	for (auto& mesh : meshes) {
+		if (mesh.m_MeshIndex == meshIndex)
+			mesh.setMorphWeight(target, weight);
+	}
+}
+
+void Scene::setInstanceMorphWeight(uint32_t id, float weight) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	assert(id < instanceSlots.size() && instanceSlots[id] != UINT32_MAX);
+	structureChanged = true;
+	instances[instanceSlots[id]].morphWeight = weight;
+}
+
+void Scene::playAnimation(uint32_t id, int clip, float startTime) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	assert(id < instanceSlots.size() && instanceSlots[id] != UINT32_MAX);
+	structureChanged = true;
+	if (instanceCharacters[id] == -1) {
+		instanceCharacters[id] = static_cast<int32_t>(animator.addCharacter(clip, startTime));
+	} else {
+		animator.setClip(instanceCharacters[id], clip, startTime);
+	}
+	// Block 0 of the palette is the shared pose
+	instances[instanceSlots[id]].paletteOffset = static_cast<int>((instanceCharacters[id] + 1) * vrmImporter.m_PaletteSize);
+}
+
+void Scene::stopAnimation(uint32_t id) {
+	std::lock_guard<std::mutex> lock(editMutex);
+	assert(id < instanceSlots.size() && instanceSlots[id] != UINT32_MAX);
+	structureChanged = true;
+	releaseCharacter(id);
+}
+
+void Scene::releaseCharacter(uint32_t id) {
+	if (instanceCharacters[id] == -1)
+		return;
+	animator.removeCharacter(instanceCharacters[id]);
+	instanceCharacters[id] = -1;
+	instances[instanceSlots[id]].paletteOffset = 0;
+}
+
+size_t Scene::instanceCount() const {
+	std::lock_guard<std::mutex> lock(editMutex);
+	return instances.size();
 }
 
 void Scene::updateCamera(double dt) {
-	camera.SetAspect(float(vulkan->m_SwapChainExtent.width) / float(vulkan->m_SwapChainExtent.height));
+	camera.SetAspect(surfaceAspect);
 	glm::vec3 direction{};
 	direction.x = cos(glm::radians(camera.m_Yaw)) * cos(glm::radians(camera.m_Pitch));
 	direction.y = sin(glm::radians(camera.m_Pitch));
@@ -189,17 +533,117 @@ void Scene::updateCamera(double dt) {
 	camera.m_View = glm::lookAt(camera.m_Position, camera.m_Position + camera.m_Front, camera.m_Up);
 }
 
-void Scene::updateUniformBuffers(uint32_t currentImage) {
+void Scene::updateUniformBuffers(const FrameSnapshot& snapshot, uint32_t currentImage) {
 	for (auto& mesh : meshes) {
-		mesh.updateUniformBuffer(camera, currentImage);
+		mesh.updateUniformBuffer(snapshot.camera, currentImage);
 	}
 }
 
-void Scene::updateNodeBuffers(uint32_t currentImage) {
+void Scene::updateMorphBuffers(const FrameSnapshot& snapshot, uint32_t currentImage) {
+	for (size_t i = 0; i < meshes.size(); i++) {
+		meshes[i].updateMorphBuffer(snapshot.activeMorphs[i], currentImage);
+	}
+}
+
+void Scene::updateSharedSprings(double dt) {
+	if (animator.m_SpringBones.empty())
+		return;
+
+	sharedSprings.accumulator += float(dt);
 	vrmImporter.recalculateMatrices();
-	memcpy(nodeBuffersMapped[currentImage], vrmImporter.m_Nodes.data(), sizeof(vrmImporter.m_Nodes[0]) * vrmImporter.m_Nodes.size());
+	if (animator.m_SpringBones.simulate(sharedSprings, vrmImporter.m_Nodes, &threadPool))
+		vrmImporter.m_TransformsDirty = true;
 }
 
+void Scene::writePalette(FrameSnapshot& snapshot) {
+	size_t blockSize = vrmImporter.getPaletteStride() * std::max<size_t>(vrmImporter.m_PaletteSize, 1);
+	snapshot.palette.resize((1 + animator.m_Characters.size()) * blockSize);
+	animator.writePalettes(snapshot.palette.data() + blockSize);
+
+	vrmImporter.recalculateMatrices();
+	// Every snapshot has its own copy, each only needs the joints that moved since it was last written
+	if (snapshot.paletteVersion == vrmImporter.m_TransformVersion)
+		return;
+
+	vrmImporter.writePalette(snapshot.palette.data(), g_SWAP_YZ, snapshot.paletteVersion);
+	snapshot.paletteVersion = vrmImporter.m_TransformVersion;
+}
+
+// Doubles capacity until needed fits, so a growing scene only reallocates now and then
+static size_t grownCapacity(size_t capacity, size_t needed) {
+	capacity = std::max<size_t>(capacity, 1);
+	while (capacity < needed)
+		capacity *= 2;
+	return capacity;
+}
+
+void Scene::updatePaletteBuffers(const FrameSnapshot& snapshot, uint32_t currentImage) {
+	// Nothing on the device reads the palette when the CPU skins, it skins straight from the snapshot
+	if (vulkan->m_Skinning == SKINNING_CPU)
+		return;
+
+	size_t blockSize = vrmImporter.getPaletteStride() * std::max<size_t>(vrmImporter.m_PaletteSize, 1);
+	size_t blocks = snapshot.palette.size() / blockSize;
+	if (blocks > paletteCapacity[currentImage]) {
+		// Only this slot grows, the others do once their own frame comes around
+		vulkan->retireBuffer(paletteBuffers[currentImage], paletteBuffersMemory[currentImage]);
+		createPaletteBuffer(currentImage, grownCapacity(paletteCapacity[currentImage], blocks));
+		writePaletteDescriptor(currentImage);
+	}
+
+	// Characters are posed every frame, the shared pose only needs copying when it changed since this copy got it
+	size_t begin = paletteVersions[currentImage] == snapshot.paletteVersion ? blockSize : 0;
+	if (snapshot.palette.size() > begin)
+		memcpy(static_cast<glm::vec4*>(paletteBuffersMapped[currentImage]) + begin, snapshot.palette.data() + begin, sizeof(glm::vec4) * (snapshot.palette.size() - begin));
+	paletteVersions[currentImage] = snapshot.paletteVersion;
+}
+
+
+void Scene::updatePoseBuffers(FrameSnapshot& snapshot, uint32_t currentImage) {
+	if (vulkan->m_Skinning == SKINNING_VERTEX_SHADER)
+		return;
+
+	// Instances that would deform identically share one block of deformed vertices
+	poses.clear();
+	std::map<std::pair<int, float>, int> poseIndices;
+	for (auto& instance : snapshot.instances) {
+		auto key = std::make_pair(instance.paletteOffset, instance.morphWeight);
+		auto it = poseIndices.find(key);
+		if (it == poseIndices.end()) {
+			it = poseIndices.emplace(key, static_cast<int>(poses.size())).first;
+			poses.push_back({instance.paletteOffset, instance.morphWeight});
+		}
+		instance.poseIndex = it->second;
+	}
+
+	if (poses.size() > poseCapacity[currentImage]) {
+		// Only this slot grows, the others do once their own frame comes around
+		vulkan->retireBuffer(poseBuffers[currentImage], poseBuffersMemory[currentImage]);
+		size_t capacity = grownCapacity(poseCapacity[currentImage], poses.size());
+		createPoseBuffer(currentImage, capacity);
+		writePoseDescriptor(currentImage);
+		for (auto& mesh : meshes) {
+			mesh.retireDeformedBuffer(*vulkan, currentImage);
+			mesh.createDeformedBuffer(*vulkan, currentImage, capacity);
+			mesh.writeDeformedDescriptor(*vulkan, currentImage);
+		}
+	}
+
+	if (!poses.empty())
+		memcpy(poseBuffersMapped[currentImage], poses.data(), sizeof(PoseData) * poses.size());
+}
+
+void Scene::updateInstanceBuffers(const FrameSnapshot& snapshot, uint32_t currentImage) {
+	if (snapshot.instances.size() > instanceCapacity[currentImage]) {
+		// Only this slot grows, the others do once their own frame comes around
+		vulkan->retireBuffer(instanceBuffers[currentImage], instanceBuffersMemory[currentImage]);
+		createInstanceBuffer(currentImage, grownCapacity(instanceCapacity[currentImage], snapshot.instances.size()));
+		writeInstanceDescriptor(currentImage);
+	}
+
+	if (!snapshot.instances.empty())
+		memcpy(instanceBuffersMapped[currentImage], snapshot.instances.data(), sizeof(InstanceData) * snapshot.instances.size());
+}
 
 void Scene::handleKeystate(bool keystates[400], double dt) {
 	float speedMult;
@@ -225,7 +669,7 @@ void Scene::handleKeystate(bool keystates[400], double dt) {
 
 	if (keystates[int('R')]) {
 		VRM::FCNSNode& node = vrmImporter.m_Nodes[1];
-		node.localTransform = glm::rotate(node.localTransform, float(glm::radians(1.0)), glm::vec3(0, 1, 0));
+		vrmImporter.setLocalTransform(1, glm::rotate(node.localTransform, float(glm::radians(1.0)), glm::vec3(0, 1, 0)));
 	}
 
 	if (keystates[int('I')]) // Look up
@@ -242,6 +686,13 @@ void Scene::handleKeystate(bool keystates[400], double dt) {
 		if (camera.m_Yaw >= 360)
 			camera.m_Yaw = 0;
 	}
+
+	// Only toggle on the press itself, not for every frame the key is held
+	if (keystates[int('P')] && !depthPrepassKeyHeld) {
+		depthPrepass = !depthPrepass;
+		std::cout << "[Scene#handleKeystate]: Info: Depth pre-pass " << (depthPrepass ? "enabled" : "disabled") << std::endl;
+	}
+	depthPrepassKeyHeld = keystates[int('P')];
 }
 
 void Scene::createDescriptorSetLayouts(size_t numTextures) {
@@ -256,14 +707,28 @@ void Scene::createDescriptorSetLayouts(size_t numTextures) {
 	samplerLayoutBinding.pImmutableSamplers = nullptr;
 	samplerLayoutBinding.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
 
-	VkDescriptorSetLayoutBinding nodeLayoutBinding{};
-	nodeLayoutBinding.binding = 1;
-	nodeLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	nodeLayoutBinding.descriptorCount = 1;
-	nodeLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
-	nodeLayoutBinding.pImmutableSamplers = nullptr; // Optional
-
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = {samplerLayoutBinding, nodeLayoutBinding};
+	VkDescriptorSetLayoutBinding paletteLayoutBinding{};
+	paletteLayoutBinding.binding = 1;
+	paletteLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	paletteLayoutBinding.descriptorCount = 1;
+	paletteLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_COMPUTE_BIT;
+	paletteLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	VkDescriptorSetLayoutBinding instanceLayoutBinding{};
+	instanceLayoutBinding.binding = 2;
+	instanceLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	instanceLayoutBinding.descriptorCount = 1;
+	instanceLayoutBinding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+	instanceLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	VkDescriptorSetLayoutBinding poseLayoutBinding{};
+	poseLayoutBinding.binding = 3;
+	poseLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poseLayoutBinding.descriptorCount = 1;
+	poseLayoutBinding.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	poseLayoutBinding.pImmutableSamplers = nullptr; // Optional
+
+	std::array<VkDescriptorSetLayoutBinding, 4> bindings = {samplerLayoutBinding, paletteLayoutBinding, instanceLayoutBinding, poseLayoutBinding};
 
 	VkDescriptorSetLayoutCreateInfo layoutInfo{};
 	layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
@@ -279,13 +744,9 @@ void Scene::createTextureImages(size_t numTextures) {
 	textureImages.resize(numTextures);
 	textureImageMemories.resize(numTextures);
 	for (int i = 0; i < numTextures; i++) {
-		int texWidth, texHeight, texChannels;
-		stbi_uc* pixels = stbi_load_from_memory(textureData[i].data(), textureData[i].size(), &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
-		VkDeviceSize imageSize = texWidth * texHeight * 4;
-
-		if (!pixels) {
-			throw std::runtime_error("[Scene#createTextureImage]: Error: Failed to load texture image!");
-		}
+		uint32_t texWidth = textureData[i].width;
+		uint32_t texHeight = textureData[i].height;
+		VkDeviceSize imageSize = textureData[i].pixels.size();
 
 		VkBuffer stagingBuffer;
 		VkDeviceMemory stagingBufferMemory;
@@ -293,18 +754,19 @@ void Scene::createTextureImages(size_t numTextures) {
 
 		void* data;
 		vkMapMemory(vulkan->m_Device, stagingBufferMemory, 0, imageSize, 0, &data);
-		memcpy(data, pixels, static_cast<size_t>(imageSize));
+		memcpy(data, textureData[i].pixels.data(), static_cast<size_t>(imageSize));
 		vkUnmapMemory(vulkan->m_Device, stagingBufferMemory);
-		stbi_image_free(pixels);
 
 		vulkan->createImage(texWidth, texHeight, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, textureImages[i], textureImageMemories[i]);
 
 		vulkan->transitionImageLayout(textureImages[i], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL);
-		vulkan->copyBufferToImage(stagingBuffer, textureImages[i], static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));
+		vulkan->copyBufferToImage(stagingBuffer, textureImages[i], texWidth, texHeight);
 		vulkan->transitionImageLayout(textureImages[i], VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL);
 
 		vkDestroyBuffer(vulkan->m_Device, stagingBuffer, nullptr);
 		vkFreeMemory(vulkan->m_Device, stagingBufferMemory, nullptr);
+		// Only the entry itself is still needed, to count the textures
+		std::vector<uint8_t>().swap(textureData[i].pixels);
 	}
 }
 
@@ -358,20 +820,20 @@ void Scene::createDescriptorSets() {
 		mesh.createDescriptorSets(*vulkan);
 	}
 
-	std::vector<VkDescriptorSetLayout> layouts(g_MAX_FRAMES_IN_FLIGHT, descriptorSetLayout);
+	std::vector<VkDescriptorSetLayout> layouts(vulkan->m_FramesInFlight, descriptorSetLayout);
 	VkDescriptorSetAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
 	allocInfo.descriptorPool = descriptorPool;
-	allocInfo.descriptorSetCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	allocInfo.descriptorSetCount = static_cast<uint32_t>(vulkan->m_FramesInFlight);
 	allocInfo.pSetLayouts = layouts.data();
 
-	descriptorSets.resize(g_MAX_FRAMES_IN_FLIGHT);
+	descriptorSets.resize(vulkan->m_FramesInFlight);
 	if (vkAllocateDescriptorSets(vulkan->m_Device, &allocInfo, descriptorSets.data()) != VK_SUCCESS) {
 		throw std::runtime_error("[HelloTriangleApplication#createDescriptorSet]: Error: Failed to allocate descriptor sets!");
 	}
 
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
-		std::vector<VkWriteDescriptorSet> descriptorWrites(2);
+	for (size_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		std::vector<VkWriteDescriptorSet> descriptorWrites(1);
 		std::vector<VkDescriptorImageInfo> imageInfos(textureImages.size());
 
 		for (int j = 0; j < textureImages.size(); j++) {
@@ -391,23 +853,64 @@ void Scene::createDescriptorSets() {
 		descriptorWrites[0].descriptorCount = imageInfos.size();
 		descriptorWrites[0].pImageInfo = imageInfos.data();
 
-		VkDescriptorBufferInfo nodeBufferInfo{};
-		nodeBufferInfo.buffer = nodeBuffers[i];
-		nodeBufferInfo.offset = 0;
-		nodeBufferInfo.range = sizeof(VRM::FCNSNode) * vrmImporter.m_Nodes.size();
+		vkUpdateDescriptorSets(vulkan->m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+
+	writePaletteDescriptors();
+	writeInstanceDescriptors();
+	writePoseDescriptors();
+}
 
-		descriptorWrites[1].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
-		descriptorWrites[1].dstSet = descriptorSets[i];
-		descriptorWrites[1].dstBinding = 1;
-		descriptorWrites[1].dstArrayElement = 0;
-		descriptorWrites[1].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-		descriptorWrites[1].descriptorCount = 1;
-		descriptorWrites[1].pBufferInfo = &nodeBufferInfo;
+void Scene::writePaletteDescriptors() {
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		writePaletteDescriptor(i);
+	}
+}
 
-		vkUpdateDescriptorSets(vulkan->m_Device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+void Scene::writePaletteDescriptor(uint32_t frame) {
+	VkDescriptorBufferInfo paletteBufferInfo{};
+	paletteBufferInfo.buffer = paletteBuffers[frame];
+	paletteBufferInfo.offset = 0;
+	paletteBufferInfo.range = sizeof(glm::vec4) * vrmImporter.getPaletteStride() * std::max<size_t>(vrmImporter.m_PaletteSize, 1) * paletteCapacity[frame];
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSets[frame];
+	descriptorWrite.dstBinding = 1;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &paletteBufferInfo;
+
+	vkUpdateDescriptorSets(vulkan->m_Device, 1, &descriptorWrite, 0, nullptr);
+	vulkan->invalidateSceneCommands(frame);
+}
+
+void Scene::writeInstanceDescriptors() {
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		writeInstanceDescriptor(i);
 	}
 }
 
+void Scene::writeInstanceDescriptor(uint32_t frame) {
+	VkDescriptorBufferInfo instanceBufferInfo{};
+	instanceBufferInfo.buffer = instanceBuffers[frame];
+	instanceBufferInfo.offset = 0;
+	instanceBufferInfo.range = sizeof(InstanceData) * instanceCapacity[frame];
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSets[frame];
+	descriptorWrite.dstBinding = 2;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &instanceBufferInfo;
+
+	vkUpdateDescriptorSets(vulkan->m_Device, 1, &descriptorWrite, 0, nullptr);
+	vulkan->invalidateSceneCommands(frame);
+}
+
 void Scene::createDescriptorPools() {
 	for (auto& mesh : meshes) {
 		mesh.createDescriptorPool(*vulkan);
@@ -415,9 +918,9 @@ void Scene::createDescriptorPools() {
 
 	std::array<VkDescriptorPoolSize, 2> poolSizes{};
 	poolSizes[0].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-	poolSizes[0].descriptorCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT * textureData.size());
+	poolSizes[0].descriptorCount = static_cast<uint32_t>(vulkan->m_FramesInFlight * textureData.size());
 	poolSizes[1].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
-	poolSizes[1].descriptorCount = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolSizes[1].descriptorCount = static_cast<uint32_t>(vulkan->m_FramesInFlight * 3);
 	// poolSizes[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
 	// poolSizes[2].descriptorCount = static_cast<uint32_t>(MAX_FRAMES_IN_FLIGHT);
 
@@ -425,31 +928,139 @@ void Scene::createDescriptorPools() {
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
 	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
 	poolInfo.pPoolSizes = poolSizes.data();
-	poolInfo.maxSets = static_cast<uint32_t>(g_MAX_FRAMES_IN_FLIGHT);
+	poolInfo.maxSets = static_cast<uint32_t>(vulkan->m_FramesInFlight);
 
 	if (vkCreateDescriptorPool(vulkan->m_Device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS) {
 		throw std::runtime_error("[HelloTriangleApplication#createDescriptorPool]: Error: Failed to create descriptor pool!");
 	}
 }
 
-void Scene::createNodeBuffers() {
-	VkDeviceSize bufferSize = sizeof(VRM::FCNSNode) * vrmImporter.m_Nodes.size();
+void Scene::createPaletteBuffers(size_t capacity) {
+	paletteBuffers.resize(vulkan->m_FramesInFlight);
+	paletteBuffersMemory.resize(vulkan->m_FramesInFlight);
+	paletteBuffersMapped.resize(vulkan->m_FramesInFlight);
+	paletteCapacity.resize(vulkan->m_FramesInFlight);
+	paletteVersions.resize(vulkan->m_FramesInFlight);
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		createPaletteBuffer(i, capacity);
+	}
+}
 
-	nodeBuffers.resize(g_MAX_FRAMES_IN_FLIGHT);
-	nodeBuffersMemory.resize(g_MAX_FRAMES_IN_FLIGHT);
-	nodeBuffersMapped.resize(g_MAX_FRAMES_IN_FLIGHT);
+void Scene::createPaletteBuffer(uint32_t frame, size_t capacity) {
+	// Models without skins still need a valid buffer to bind
+	VkDeviceSize bufferSize = sizeof(glm::vec4) * vrmImporter.getPaletteStride() * std::max<size_t>(vrmImporter.m_PaletteSize, 1) * capacity;
+	vulkan->createSharedBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, paletteBuffers[frame], paletteBuffersMemory[frame]);
+	vkMapMemory(vulkan->m_Device, paletteBuffersMemory[frame], 0, bufferSize, 0, &paletteBuffersMapped[frame]);
+	paletteCapacity[frame] = capacity;
+	// Nothing written yet, the first upload copies the whole palette
+	paletteVersions[frame] = UINT64_MAX;
+}
 
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
-		vulkan->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, nodeBuffers[i], nodeBuffersMemory[i]);
+void Scene::destroyPaletteBuffers() {
+	for (size_t i = 0; i < paletteBuffers.size(); i++) {
+		vkDestroyBuffer(vulkan->m_Device, paletteBuffers[i], nullptr);
+		vkFreeMemory(vulkan->m_Device, paletteBuffersMemory[i], nullptr);
+	}
+	paletteBuffers.clear();
+	paletteBuffersMemory.clear();
+	paletteBuffersMapped.clear();
+	paletteCapacity.clear();
+}
 
-		vkMapMemory(vulkan->m_Device, nodeBuffersMemory[i], 0, bufferSize, 0, &nodeBuffersMapped[i]);
+void Scene::createInstanceBuffers(size_t capacity) {
+	instanceBuffers.resize(vulkan->m_FramesInFlight);
+	instanceBuffersMemory.resize(vulkan->m_FramesInFlight);
+	instanceBuffersMapped.resize(vulkan->m_FramesInFlight);
+	instanceCapacity.resize(vulkan->m_FramesInFlight);
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		createInstanceBuffer(i, capacity);
 	}
 }
 
+void Scene::createInstanceBuffer(uint32_t frame, size_t capacity) {
+	VkDeviceSize bufferSize = sizeof(InstanceData) * capacity;
+	vulkan->createBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, instanceBuffers[frame], instanceBuffersMemory[frame]);
+	vkMapMemory(vulkan->m_Device, instanceBuffersMemory[frame], 0, bufferSize, 0, &instanceBuffersMapped[frame]);
+	instanceCapacity[frame] = capacity;
+}
+
+void Scene::createPoseBuffers(size_t capacity) {
+	poseBuffers.resize(vulkan->m_FramesInFlight);
+	poseBuffersMemory.resize(vulkan->m_FramesInFlight);
+	poseBuffersMapped.resize(vulkan->m_FramesInFlight);
+	poseCapacity.resize(vulkan->m_FramesInFlight);
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		createPoseBuffer(i, capacity);
+	}
+
+	for (auto& mesh : meshes) {
+		mesh.createDeformedBuffers(*vulkan, capacity);
+	}
+}
+
+void Scene::createPoseBuffer(uint32_t frame, size_t capacity) {
+	VkDeviceSize bufferSize = sizeof(PoseData) * capacity;
+	vulkan->createSharedBuffer(bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, poseBuffers[frame], poseBuffersMemory[frame]);
+	vkMapMemory(vulkan->m_Device, poseBuffersMemory[frame], 0, bufferSize, 0, &poseBuffersMapped[frame]);
+	poseCapacity[frame] = capacity;
+}
+
+void Scene::destroyPoseBuffers() {
+	for (size_t i = 0; i < poseBuffers.size(); i++) {
+		vkDestroyBuffer(vulkan->m_Device, poseBuffers[i], nullptr);
+		vkFreeMemory(vulkan->m_Device, poseBuffersMemory[i], nullptr);
+	}
+	poseBuffers.clear();
+	poseBuffersMemory.clear();
+	poseBuffersMapped.clear();
+	poseCapacity.clear();
+
+	for (auto& mesh : meshes) {
+		mesh.destroyDeformedBuffers(*vulkan);
+	}
+}
+
+void Scene::writePoseDescriptors() {
+	for (uint32_t i = 0; i < vulkan->m_FramesInFlight; i++) {
+		writePoseDescriptor(i);
+	}
+}
+
+void Scene::writePoseDescriptor(uint32_t frame) {
+	VkDescriptorBufferInfo poseBufferInfo{};
+	poseBufferInfo.buffer = poseBuffers[frame];
+	poseBufferInfo.offset = 0;
+	poseBufferInfo.range = sizeof(PoseData) * poseCapacity[frame];
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet = descriptorSets[frame];
+	descriptorWrite.dstBinding = 3;
+	descriptorWrite.dstArrayElement = 0;
+	descriptorWrite.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount = 1;
+	descriptorWrite.pBufferInfo = &poseBufferInfo;
+
+	vkUpdateDescriptorSets(vulkan->m_Device, 1, &descriptorWrite, 0, nullptr);
+	// Goes together with the rewrite of the deformed vertex descriptors of every mesh
+	vulkan->invalidateSceneCommands(frame);
+}
+
+void Scene::destroyInstanceBuffers() {
+	for (size_t i = 0; i < instanceBuffers.size(); i++) {
+		vkDestroyBuffer(vulkan->m_Device, instanceBuffers[i], nullptr);
+		vkFreeMemory(vulkan->m_Device, instanceBuffersMemory[i], nullptr);
+	}
+	instanceBuffers.clear();
+	instanceBuffersMemory.clear();
+	instanceBuffersMapped.clear();
+	instanceCapacity.clear();
+}
 
 void Scene::createVertexBuffers() {
 	for (auto& mesh : meshes) {
 		mesh.createVertexBuffer(*vulkan);
+		mesh.createDepthVertexBuffer(*vulkan);
 	}
 }
 
@@ -471,6 +1082,12 @@ void Scene::createMaterialBuffers() {
 	}
 }
 
+void Scene::createMorphBuffers() {
+	for (auto& mesh : meshes) {
+		mesh.createMorphBuffers(*vulkan);
+	}
+}
+
 void Scene::createAnimBuffers() {
 	for (auto& mesh : meshes) {
 		mesh.createAnimBuffers(*vulkan);
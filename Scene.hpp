@@ -1,12 +1,35 @@
 #ifndef SCENE_HPP
 #define SCENE_HPP
 
+#include <atomic>
+#include <mutex>
 #include <vector>
+#include "Animator.hpp"
+#include "CpuSkinner.hpp"
 #include "Mesh.hpp"
 #include "Camera.hpp"
 #include "Vulkan.hpp"
 
-extern const int g_MAX_FRAMES_IN_FLIGHT;
+// Everything the renderer needs from one simulation step. Scene::simulate fills it in, after that only the render side touches it
+struct FrameSnapshot {
+	Camera camera {60.0f, 0};
+	// Copy of Scene::instances, the pose indices get assigned while uploading
+	std::vector<InstanceData> instances;
+	// Indices into Scene::meshes, opaque and masked ones front-to-back followed by blended ones back-to-front
+	std::vector<size_t> drawOrder;
+	// Blend shapes with a non-zero weight of every mesh, indexed like Scene::meshes
+	std::vector<std::vector<ActiveMorph>> activeMorphs;
+	// Shared pose followed by one block per animated character, laid out like Scene::paletteBuffers
+	std::vector<glm::vec4> palette;
+	// VRMImporter::m_TransformVersion the shared pose in palette was last written at
+	uint64_t paletteVersion = 0;
+	bool depthPrepass = false;
+	Animator::Stats animationStats;
+	// Application time when the input this frame reacts to was read
+	double inputTime = 0.0;
+	// Whether anything visible differs from the snapshot simulated before this one
+	bool changed = true;
+};
 
 class Scene {
 public:
@@ -14,31 +37,148 @@ public:
 	Camera camera {60.0f, 0};
 	Vulkan* vulkan;
 	VRMImporter vrmImporter;
-	std::vector<std::vector<uint8_t>> textureData;
+	// Shared by everything that splits per-frame work over the cores
+	ThreadPool threadPool;
+	Animator animator;
+	CpuSkinner cpuSkinner;
+	// Textures decoded to RGBA while loading, uploaded by uploadAssets
+	struct TextureImage {
+		std::vector<uint8_t> pixels;
+		uint32_t width = 0;
+		uint32_t height = 0;
+	};
+	std::vector<TextureImage> textureData;
 
 	std::vector<VkImage> textureImages;
 	std::vector<VkDeviceMemory> textureImageMemories;
 	std::vector<VkImageView> textureImageViews;
 	std::vector<VkSampler> textureSamplers;
 
-	std::vector<VkBuffer> nodeBuffers;
-	std::vector<VkDeviceMemory> nodeBuffersMemory;
-	std::vector<void*> nodeBuffersMapped;
+	// Dense array of live instances, instanceSlots maps an instance id to its position in it
+	std::vector<InstanceData> instances;
+	std::vector<uint32_t> instanceIds;
+	std::vector<uint32_t> instanceSlots;
+	std::vector<uint32_t> freeInstanceIds;
+	// Animator character of every instance id, -1 while it uses the shared pose
+	std::vector<int32_t> instanceCharacters;
+
+	std::vector<VkBuffer> instanceBuffers;
+	std::vector<VkDeviceMemory> instanceBuffersMemory;
+	std::vector<void*> instanceBuffersMapped;
+	// Instances each frame slot's buffer has room for, slots grow separately once their last frame is done
+	std::vector<size_t> instanceCapacity;
+
+	// Distinct poses among the instances this frame, each gets its own block of deformed vertices
+	std::vector<PoseData> poses;
+	std::vector<VkBuffer> poseBuffers;
+	std::vector<VkDeviceMemory> poseBuffersMemory;
+	std::vector<void*> poseBuffersMapped;
+	// Per frame slot like instanceCapacity, the deformed vertex buffers of the meshes follow it
+	std::vector<size_t> poseCapacity;
+
+	// Simulated copy of Vulkan::m_DepthPrepass, toggled with P and applied when a snapshot gets uploaded
+	bool depthPrepass = false;
+	bool depthPrepassKeyHeld = false;
+	// Held by the editing functions below and for all of simulate, so edits from other threads land between two steps
+	mutable std::mutex editMutex;
+	// Set by everything that edits instances or morph weights, cleared by the next simulate. Guarded by editMutex
+	bool structureChanged = true;
+	// State the last simulate left behind, for telling whether the next one changed anything
+	uint64_t simulatedTransformVersion = UINT64_MAX;
+	bool simulatedDepthPrepass = false;
+	// Width over height of the swap chain, set by the render side and read by the simulation for the camera
+	std::atomic<float> surfaceAspect{1.0f};
+
+	// Bounding sphere of the whole model in vertex space, padded since animation moves limbs outside the bind pose
+	glm::vec3 boundsCenter{0.0f};
+	float boundsRadius = 0.0f;
+	// Lowers the animation update rate of small instances and freezes the ones outside the view
+	bool animationLod = true;
+	// Spring bones of the pose shared by instances without their own character
+	SpringBones::State sharedSprings;
+
+	// Final skinning transforms of every skin, see VRMImporter::writePalette.
+	// The shared pose comes first, followed by one block per animated character
+	std::vector<VkBuffer> paletteBuffers;
+	std::vector<VkDeviceMemory> paletteBuffersMemory;
+	std::vector<void*> paletteBuffersMapped;
+	// Blocks per frame slot like instanceCapacity
+	std::vector<size_t> paletteCapacity;
+	// FrameSnapshot::paletteVersion of the shared pose in each palette copy
+	std::vector<uint64_t> paletteVersions;
 
 	VkDescriptorSetLayout descriptorSetLayout;
 	VkDescriptorPool descriptorPool;
 	std::vector<VkDescriptorSet> descriptorSets;
+	// Snapshot the frame graph passes draw, only set while record runs
+	const FrameSnapshot* recordedFrame = nullptr;
+
+	// What the draw calls of a frame depend on besides buffer contents. While it stays the same for a frame slot,
+	// Vulkan can replay the scene commands it recorded for that slot, see Vulkan::m_ReuseCommandBuffers
+	struct DrawSignature {
+		std::vector<size_t> drawOrder;
+		std::vector<int> morphCounts;
+		size_t instanceCount = 0;
+		bool depthPrepass = false;
+
+		bool operator==(const DrawSignature& other) const {
+			return drawOrder == other.drawOrder && morphCounts == other.morphCounts && instanceCount == other.instanceCount && depthPrepass == other.depthPrepass;
+		}
+	};
+	// Signature the scene commands of each frame slot were last recorded with
+	std::vector<DrawSignature> drawSignatures;
+	// Filled every frame and swapped in when it differs, so comparing does not allocate
+	DrawSignature currentSignature;
 
+	// Reads, parses and decodes the model without touching the device, so it can run while the device is brought up
 	void load(const std::string& file, Vulkan* vulkan);
-	void setup();
-	void update(uint32_t currentImage, bool _keystates[400], double dt);
+	// Setup once the device exists, in this order. uploadAssets and createPipelines only share what setupLayouts
+	// created and may run on different threads at the same time
+	void setupLayouts();
+	void uploadAssets();
+	void createPipelines();
+	void createFrameGraph();
+	// Advances input, camera and animation by dt and captures the result in snapshot. Never touches the device,
+	// so it can run on its own thread while the previous snapshot is rendered
+	void simulate(bool keystates[400], double dt, FrameSnapshot& snapshot);
+	// Writes snapshot into the per frame buffers of currentImage, which the GPU has to be done with
+	void upload(FrameSnapshot& snapshot, uint32_t currentImage);
 	void cleanup();
-	void draw();
+	// Records snapshot into the frame's command buffer through the frame graph, after beginDrawFrame returned imageIndex
+	void record(const FrameSnapshot& snapshot, uint32_t imageIndex);
+
+	uint32_t spawnInstance(const glm::mat4& transform);
+	void despawnInstance(uint32_t id);
+	void setInstanceTransform(uint32_t id, const glm::mat4& transform);
+	void setInstanceMorphWeight(uint32_t id, float weight);
+	// Gives the instance its own skeleton playing clip, startTime lets crowds run out of step
+	void playAnimation(uint32_t id, int clip, float startTime);
+	void stopAnimation(uint32_t id);
+	// Weight of one blend shape of a glTF mesh, applies to all of its primitives
+	void setMorphWeight(int meshIndex, size_t target, float weight);
+	size_t instanceCount() const;
 private:
 	void updateCamera(double dt);
-	void updateUniformBuffers(uint32_t currentImage);
-	void updateNodeBuffers(uint32_t currentImage);
+	void updateSharedSprings(double dt);
+	void writePalette(FrameSnapshot& snapshot);
 	void handleKeystate(bool _keystates[400], double dt);
+	void sortDrawOrder(std::vector<size_t>& drawOrder);
+	void updateAnimationLod();
+	// stopAnimation without taking editMutex, for callers already holding it
+	void releaseCharacter(uint32_t id);
+
+	void updateUniformBuffers(const FrameSnapshot& snapshot, uint32_t currentImage);
+	void updateMorphBuffers(const FrameSnapshot& snapshot, uint32_t currentImage);
+	void updatePaletteBuffers(const FrameSnapshot& snapshot, uint32_t currentImage);
+	void updatePoseBuffers(FrameSnapshot& snapshot, uint32_t currentImage);
+	void updateInstanceBuffers(const FrameSnapshot& snapshot, uint32_t currentImage);
+	// Deformation outside the frame graph, on the CPU or the async compute queue
+	void deform(const FrameSnapshot& snapshot);
+	void recordDeform(VkCommandBuffer commandBuffer);
+	// Drops the recorded scene commands of the frame slot when the draw calls of snapshot would differ from them
+	void checkDrawSignature(const FrameSnapshot& snapshot);
+	void draw(VkCommandBuffer commandBuffer, const FrameSnapshot& snapshot);
+	void drawMesh(VkCommandBuffer commandBuffer, const Mesh& mesh, size_t frame, size_t instanceCount, bool depthOnly);
 
 	void createTextureImages(size_t numTextures);
 	void createTextureImageViews(size_t numTextures);
@@ -48,9 +188,25 @@ private:
 	void createDescriptorPools();
 	void createDescriptorSetLayouts(size_t numTextures);
 
-	void createNodeBuffers();
+	// The plural ones cover every frame slot, growing replaces a single slot's buffer with the singular ones
+	void createPaletteBuffers(size_t capacity);
+	void createPaletteBuffer(uint32_t frame, size_t capacity);
+	void destroyPaletteBuffers();
+	void writePaletteDescriptors();
+	void writePaletteDescriptor(uint32_t frame);
+	void createInstanceBuffers(size_t capacity);
+	void createInstanceBuffer(uint32_t frame, size_t capacity);
+	void destroyInstanceBuffers();
+	void writeInstanceDescriptors();
+	void writeInstanceDescriptor(uint32_t frame);
+	void createPoseBuffers(size_t capacity);
+	void createPoseBuffer(uint32_t frame, size_t capacity);
+	void destroyPoseBuffers();
+	void writePoseDescriptors();
+	void writePoseDescriptor(uint32_t frame);
 
 	void createAnimBuffers();
+	void createMorphBuffers();
 	void createMaterialBuffers();
 
 	void createVertexBuffers();
@@ -0,0 +1,644 @@
+#include "SimdMath.hpp"
+
+#include <glm/gtc/matrix_transform.hpp>
+
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMDMATH_X86
+#include <immintrin.h>
+// Compiled for the wider instruction sets regardless of the global flags, only called after checking the CPU
+#define TARGET_SSE4 __attribute__((target("sse4.1")))
+#define TARGET_AVX2 __attribute__((target("avx2,fma")))
+#endif
+
+namespace SimdMath {
+
+// All kernels work on plain floats: matrices column-major like glm, quaternions as x, y, z, w
+struct Kernels {
+	void (*multiply)(const float* a, const float* b, float* out);
+	void (*multiplyAffineRows)(const float* a, const float* b, float* rows);
+	void (*inverseAffine)(const float* m, float* out);
+	void (*composeTRS)(const float* t, const float* q, const float* s, float* out);
+	void (*multiplyQuat)(const float* a, const float* b, float* out);
+	void (*normalizeQuat)(const float* q, float* out);
+	void (*skinVertices)(const SkinningStreams& streams, size_t count, const float* palette, float* out);
+	bool (*overlapsAny)(const SphereStreams& spheres, size_t count, const float* point, float radius);
+};
+
+// ------------ Scalar ------------
+
+static glm::quat loadQuat(const float* q) {
+	return glm::quat(q[3], q[0], q[1], q[2]);
+}
+
+static void storeQuat(const glm::quat& q, float* out) {
+	out[0] = q.x;
+	out[1] = q.y;
+	out[2] = q.z;
+	out[3] = q.w;
+}
+
+static void multiplyScalar(const float* a, const float* b, float* out) {
+	glm::mat4 result = *reinterpret_cast<const glm::mat4*>(a) * *reinterpret_cast<const glm::mat4*>(b);
+	*reinterpret_cast<glm::mat4*>(out) = result;
+}
+
+static void multiplyAffineRowsScalar(const float* a, const float* b, float* rows) {
+	glm::mat4 result = glm::transpose(*reinterpret_cast<const glm::mat4*>(a) * *reinterpret_cast<const glm::mat4*>(b));
+	for (int i = 0; i < 3; i++) {
+		reinterpret_cast<glm::vec4*>(rows)[i] = result[i];
+	}
+}
+
+static void inverseAffineScalar(const float* m, float* out) {
+	const glm::mat4& matrix = *reinterpret_cast<const glm::mat4*>(m);
+	glm::mat3 inverse = glm::inverse(glm::mat3(matrix));
+	glm::mat4 result(inverse);
+	result[3] = glm::vec4(-(inverse * glm::vec3(matrix[3])), 1.0f);
+	*reinterpret_cast<glm::mat4*>(out) = result;
+}
+
+static void composeTRSScalar(const float* t, const float* q, const float* s, float* out) {
+	glm::mat3 rotation = glm::mat3_cast(loadQuat(q));
+	glm::mat4 result;
+	result[0] = glm::vec4(rotation[0] * s[0], 0.0f);
+	result[1] = glm::vec4(rotation[1] * s[1], 0.0f);
+	result[2] = glm::vec4(rotation[2] * s[2], 0.0f);
+	result[3] = glm::vec4(t[0], t[1], t[2], 1.0f);
+	*reinterpret_cast<glm::mat4*>(out) = result;
+}
+
+static void multiplyQuatScalar(const float* a, const float* b, float* out) {
+	storeQuat(loadQuat(a) * loadQuat(b), out);
+}
+
+static void normalizeQuatScalar(const float* q, float* out) {
+	storeQuat(glm::normalize(loadQuat(q)), out);
+}
+
+static void skinVerticesScalar(const SkinningStreams& streams, size_t count, const float* palette, float* out) {
+	for (size_t i = 0; i < count; i++) {
+		float x = streams.x[i];
+		float y = streams.y[i];
+		float z = streams.z[i];
+		float* vertex = out + i * 4;
+		vertex[3] = 1.0f;
+
+		// Blending the rows first means only one matrix-vector product per vertex
+		float rows[12] = {};
+		bool weighted = false;
+		for (int k = 0; k < 4; k++) {
+			float weight = streams.weights[k][i];
+			const float* joint = palette + streams.joints[k][i] * 12;
+			weighted = weighted || weight != 0.0f;
+			for (int j = 0; j < 12; j++) {
+				rows[j] += weight * joint[j];
+			}
+		}
+		if (!weighted) {
+			vertex[0] = x;
+			vertex[1] = y;
+			vertex[2] = z;
+			continue;
+		}
+		for (int r = 0; r < 3; r++) {
+			vertex[r] = rows[r * 4] * x + rows[r * 4 + 1] * y + rows[r * 4 + 2] * z + rows[r * 4 + 3];
+		}
+	}
+}
+
+static bool overlapsAnyScalar(const SphereStreams& spheres, size_t count, const float* point, float radius) {
+	bool hit = false;
+	for (size_t i = 0; i < count; i++) {
+		float dx = point[0] - spheres.x[i];
+		float dy = point[1] - spheres.y[i];
+		float dz = point[2] - spheres.z[i];
+		float reach = radius + spheres.radius[i];
+		hit |= dx * dx + dy * dy + dz * dz < reach * reach;
+	}
+	return hit;
+}
+
+#ifdef SIMDMATH_X86
+// ------------ SSE4 ------------
+
+// Column j of a * b is a's columns weighted by the elements of b's column j
+TARGET_SSE4 static inline __m128 linearCombine(__m128 column, __m128 a0, __m128 a1, __m128 a2, __m128 a3) {
+	__m128 result = _mm_mul_ps(a0, _mm_shuffle_ps(column, column, _MM_SHUFFLE(0, 0, 0, 0)));
+	result = _mm_add_ps(result, _mm_mul_ps(a1, _mm_shuffle_ps(column, column, _MM_SHUFFLE(1, 1, 1, 1))));
+	result = _mm_add_ps(result, _mm_mul_ps(a2, _mm_shuffle_ps(column, column, _MM_SHUFFLE(2, 2, 2, 2))));
+	result = _mm_add_ps(result, _mm_mul_ps(a3, _mm_shuffle_ps(column, column, _MM_SHUFFLE(3, 3, 3, 3))));
+	return result;
+}
+
+TARGET_SSE4 static void multiplySSE4(const float* a, const float* b, float* out) {
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 a2 = _mm_loadu_ps(a + 8);
+	__m128 a3 = _mm_loadu_ps(a + 12);
+	__m128 b0 = _mm_loadu_ps(b);
+	__m128 b1 = _mm_loadu_ps(b + 4);
+	__m128 b2 = _mm_loadu_ps(b + 8);
+	__m128 b3 = _mm_loadu_ps(b + 12);
+
+	_mm_storeu_ps(out, linearCombine(b0, a0, a1, a2, a3));
+	_mm_storeu_ps(out + 4, linearCombine(b1, a0, a1, a2, a3));
+	_mm_storeu_ps(out + 8, linearCombine(b2, a0, a1, a2, a3));
+	_mm_storeu_ps(out + 12, linearCombine(b3, a0, a1, a2, a3));
+}
+
+TARGET_SSE4 static void multiplyAffineRowsSSE4(const float* a, const float* b, float* rows) {
+	__m128 a0 = _mm_loadu_ps(a);
+	__m128 a1 = _mm_loadu_ps(a + 4);
+	__m128 a2 = _mm_loadu_ps(a + 8);
+	__m128 a3 = _mm_loadu_ps(a + 12);
+
+	__m128 c0 = linearCombine(_mm_loadu_ps(b), a0, a1, a2, a3);
+	__m128 c1 = linearCombine(_mm_loadu_ps(b + 4), a0, a1, a2, a3);
+	__m128 c2 = linearCombine(_mm_loadu_ps(b + 8), a0, a1, a2, a3);
+	__m128 c3 = linearCombine(_mm_loadu_ps(b + 12), a0, a1, a2, a3);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	_mm_storeu_ps(rows, c0);
+	_mm_storeu_ps(rows + 4, c1);
+	_mm_storeu_ps(rows + 8, c2);
+}
+
+TARGET_SSE4 static inline __m128 cross(__m128 a, __m128 b) {
+	__m128 aYZX = _mm_shuffle_ps(a, a, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 bYZX = _mm_shuffle_ps(b, b, _MM_SHUFFLE(3, 0, 2, 1));
+	__m128 result = _mm_sub_ps(_mm_mul_ps(a, bYZX), _mm_mul_ps(aYZX, b));
+	return _mm_shuffle_ps(result, result, _MM_SHUFFLE(3, 0, 2, 1));
+}
+
+TARGET_SSE4 static void inverseAffineSSE4(const float* m, float* out) {
+	// The rows of the inverse of the upper 3x3 are the cross products of its columns divided by the determinant
+	__m128 mask = _mm_castsi128_ps(_mm_set_epi32(0, -1, -1, -1));
+	__m128 c0 = _mm_and_ps(_mm_loadu_ps(m), mask);
+	__m128 c1 = _mm_and_ps(_mm_loadu_ps(m + 4), mask);
+	__m128 c2 = _mm_and_ps(_mm_loadu_ps(m + 8), mask);
+	__m128 t = _mm_loadu_ps(m + 12);
+
+	__m128 r0 = cross(c1, c2);
+	__m128 r1 = cross(c2, c0);
+	__m128 r2 = cross(c0, c1);
+	__m128 invDet = _mm_div_ps(_mm_set1_ps(1.0f), _mm_dp_ps(c0, r0, 0x7F));
+	r0 = _mm_mul_ps(r0, invDet);
+	r1 = _mm_mul_ps(r1, invDet);
+	r2 = _mm_mul_ps(r2, invDet);
+
+	__m128 translation = _mm_or_ps(_mm_or_ps(_mm_dp_ps(r0, t, 0x71), _mm_dp_ps(r1, t, 0x72)), _mm_dp_ps(r2, t, 0x74));
+	translation = _mm_sub_ps(_mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f), translation);
+
+	__m128 r3 = _mm_setzero_ps();
+	_MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+	_mm_storeu_ps(out, r0);
+	_mm_storeu_ps(out + 4, r1);
+	_mm_storeu_ps(out + 8, r2);
+	_mm_storeu_ps(out + 12, translation);
+}
+
+TARGET_SSE4 static void composeTRSSSE4(const float* t, const float* q, const float* s, float* out) {
+	// Each rotation column is 1 or 0 plus two vectors of quaternion products with the signs flipped where needed
+	__m128 quat = _mm_loadu_ps(q);
+	__m128 quat2 = _mm_add_ps(quat, quat);
+
+	__m128 a = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 0, 0, 1)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 2, 1, 1)));
+	__m128 b = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 3, 3, 2)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 1, 2, 2)));
+	__m128 column0 = _mm_add_ps(_mm_set_ps(0, 0, 0, 1), _mm_add_ps(_mm_mul_ps(a, _mm_set_ps(0, 1, 1, -1)), _mm_mul_ps(b, _mm_set_ps(0, -1, 1, -1))));
+
+	a = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 1, 0, 0)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 2, 0, 1)));
+	b = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 3, 2, 3)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 0, 2, 2)));
+	__m128 column1 = _mm_add_ps(_mm_set_ps(0, 0, 1, 0), _mm_add_ps(_mm_mul_ps(a, _mm_set_ps(0, 1, -1, 1)), _mm_mul_ps(b, _mm_set_ps(0, 1, -1, -1))));
+
+	a = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 0, 1, 0)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 0, 2, 2)));
+	b = _mm_mul_ps(_mm_shuffle_ps(quat, quat, _MM_SHUFFLE(0, 1, 3, 3)), _mm_shuffle_ps(quat2, quat2, _MM_SHUFFLE(0, 1, 0, 1)));
+	__m128 column2 = _mm_add_ps(_mm_set_ps(0, 1, 0, 0), _mm_add_ps(_mm_mul_ps(a, _mm_set_ps(0, -1, 1, 1)), _mm_mul_ps(b, _mm_set_ps(0, -1, -1, 1))));
+
+	_mm_storeu_ps(out, _mm_mul_ps(column0, _mm_set1_ps(s[0])));
+	_mm_storeu_ps(out + 4, _mm_mul_ps(column1, _mm_set1_ps(s[1])));
+	_mm_storeu_ps(out + 8, _mm_mul_ps(column2, _mm_set1_ps(s[2])));
+	_mm_storeu_ps(out + 12, _mm_set_ps(1.0f, t[2], t[1], t[0]));
+}
+
+TARGET_SSE4 static void multiplyQuatSSE4(const float* a, const float* b, float* out) {
+	__m128 qa = _mm_loadu_ps(a);
+	__m128 qb = _mm_loadu_ps(b);
+
+	__m128 result = _mm_mul_ps(_mm_shuffle_ps(qa, qa, _MM_SHUFFLE(3, 3, 3, 3)), qb);
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(qa, qa, _MM_SHUFFLE(0, 0, 0, 0)), _mm_shuffle_ps(qb, qb, _MM_SHUFFLE(0, 1, 2, 3))), _mm_set_ps(-1, 1, -1, 1)));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(qa, qa, _MM_SHUFFLE(1, 1, 1, 1)), _mm_shuffle_ps(qb, qb, _MM_SHUFFLE(1, 0, 3, 2))), _mm_set_ps(-1, -1, 1, 1)));
+	result = _mm_add_ps(result, _mm_mul_ps(_mm_mul_ps(_mm_shuffle_ps(qa, qa, _MM_SHUFFLE(2, 2, 2, 2)), _mm_shuffle_ps(qb, qb, _MM_SHUFFLE(2, 3, 0, 1))), _mm_set_ps(-1, 1, 1, -1)));
+	_mm_storeu_ps(out, result);
+}
+
+TARGET_SSE4 static void normalizeQuatSSE4(const float* q, float* out) {
+	__m128 quat = _mm_loadu_ps(q);
+	__m128 lengthSquared = _mm_dp_ps(quat, quat, 0xFF);
+	// Same as glm, a zero quaternion becomes the identity
+	if (_mm_cvtss_f32(lengthSquared) <= 0.0f) {
+		_mm_storeu_ps(out, _mm_set_ps(1.0f, 0.0f, 0.0f, 0.0f));
+		return;
+	}
+	_mm_storeu_ps(out, _mm_div_ps(quat, _mm_sqrt_ps(lengthSquared)));
+}
+
+// 4 spheres per iteration, one lane each, only the combined mask is looked at
+TARGET_SSE4 static bool overlapsAnySSE4(const SphereStreams& spheres, size_t count, const float* point, float radius) {
+	const __m128 px = _mm_set1_ps(point[0]);
+	const __m128 py = _mm_set1_ps(point[1]);
+	const __m128 pz = _mm_set1_ps(point[2]);
+	const __m128 extra = _mm_set1_ps(radius);
+	__m128 hit = _mm_setzero_ps();
+	size_t i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 dx = _mm_sub_ps(px, _mm_loadu_ps(spheres.x + i));
+		__m128 dy = _mm_sub_ps(py, _mm_loadu_ps(spheres.y + i));
+		__m128 dz = _mm_sub_ps(pz, _mm_loadu_ps(spheres.z + i));
+		__m128 distanceSquared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)), _mm_mul_ps(dz, dz));
+		__m128 reach = _mm_add_ps(extra, _mm_loadu_ps(spheres.radius + i));
+		hit = _mm_or_ps(hit, _mm_cmplt_ps(distanceSquared, _mm_mul_ps(reach, reach)));
+	}
+	if (_mm_movemask_ps(hit) != 0)
+		return true;
+
+	SphereStreams tail = {spheres.x + i, spheres.y + i, spheres.z + i, spheres.radius + i};
+	return overlapsAnyScalar(tail, count - i, point, radius);
+}
+
+// ------------ AVX2 ------------
+
+// Two result columns per iteration, the columns of a are duplicated into both halves
+TARGET_AVX2 static inline __m256 linearCombine2(__m256 columns, __m256 a0, __m256 a1, __m256 a2, __m256 a3) {
+	__m256 result = _mm256_mul_ps(a0, _mm256_shuffle_ps(columns, columns, _MM_SHUFFLE(0, 0, 0, 0)));
+	result = _mm256_fmadd_ps(a1, _mm256_shuffle_ps(columns, columns, _MM_SHUFFLE(1, 1, 1, 1)), result);
+	result = _mm256_fmadd_ps(a2, _mm256_shuffle_ps(columns, columns, _MM_SHUFFLE(2, 2, 2, 2)), result);
+	result = _mm256_fmadd_ps(a3, _mm256_shuffle_ps(columns, columns, _MM_SHUFFLE(3, 3, 3, 3)), result);
+	return result;
+}
+
+TARGET_AVX2 static void multiplyAVX2(const float* a, const float* b, float* out) {
+	__m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+	__m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+	__m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+	__m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 12));
+	__m256 b01 = _mm256_loadu_ps(b);
+	__m256 b23 = _mm256_loadu_ps(b + 8);
+
+	_mm256_storeu_ps(out, linearCombine2(b01, a0, a1, a2, a3));
+	_mm256_storeu_ps(out + 8, linearCombine2(b23, a0, a1, a2, a3));
+}
+
+TARGET_AVX2 static void multiplyAffineRowsAVX2(const float* a, const float* b, float* rows) {
+	__m256 a0 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a));
+	__m256 a1 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 4));
+	__m256 a2 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 8));
+	__m256 a3 = _mm256_broadcast_ps(reinterpret_cast<const __m128*>(a + 12));
+	__m256 c01 = linearCombine2(_mm256_loadu_ps(b), a0, a1, a2, a3);
+	__m256 c23 = linearCombine2(_mm256_loadu_ps(b + 8), a0, a1, a2, a3);
+
+	__m128 c0 = _mm256_castps256_ps128(c01);
+	__m128 c1 = _mm256_extractf128_ps(c01, 1);
+	__m128 c2 = _mm256_castps256_ps128(c23);
+	__m128 c3 = _mm256_extractf128_ps(c23, 1);
+	_MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+
+	_mm_storeu_ps(rows, c0);
+	_mm_storeu_ps(rows + 4, c1);
+	_mm_storeu_ps(rows + 8, c2);
+}
+
+// 8 vertices per iteration, one lane each, the palette rows are gathered per lane
+TARGET_AVX2 static void skinVerticesAVX2(const SkinningStreams& streams, size_t count, const float* palette, float* out) {
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256i stride = _mm256_set1_epi32(12);
+	size_t i = 0;
+	for (; i + 8 <= count; i += 8) {
+		__m256 rows[12];
+		for (int j = 0; j < 12; j++) {
+			rows[j] = zero;
+		}
+		__m256 weighted = zero;
+		for (int k = 0; k < 4; k++) {
+			__m256i joints = _mm256_mullo_epi32(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(streams.joints[k] + i)), stride);
+			__m256 weight = _mm256_loadu_ps(streams.weights[k] + i);
+			weighted = _mm256_or_ps(weighted, _mm256_cmp_ps(weight, zero, _CMP_NEQ_OQ));
+			for (int j = 0; j < 12; j++) {
+				rows[j] = _mm256_fmadd_ps(weight, _mm256_i32gather_ps(palette + j, joints, 4), rows[j]);
+			}
+		}
+
+		__m256 x = _mm256_loadu_ps(streams.x + i);
+		__m256 y = _mm256_loadu_ps(streams.y + i);
+		__m256 z = _mm256_loadu_ps(streams.z + i);
+		__m256 position[3] = {x, y, z};
+		__m256 skinned[3];
+		for (int r = 0; r < 3; r++) {
+			__m256 result = _mm256_fmadd_ps(rows[r * 4 + 2], z, rows[r * 4 + 3]);
+			result = _mm256_fmadd_ps(rows[r * 4 + 1], y, result);
+			result = _mm256_fmadd_ps(rows[r * 4], x, result);
+			skinned[r] = _mm256_blendv_ps(position[r], result, weighted);
+		}
+
+		// Back to x, y, z, 1 per vertex: pair up the components within each 128 bit lane, then swap the lane halves
+		__m256 xyLow = _mm256_unpacklo_ps(skinned[0], skinned[1]);
+		__m256 xyHigh = _mm256_unpackhi_ps(skinned[0], skinned[1]);
+		__m256 zwLow = _mm256_unpacklo_ps(skinned[2], one);
+		__m256 zwHigh = _mm256_unpackhi_ps(skinned[2], one);
+		__m256 v04 = _mm256_shuffle_ps(xyLow, zwLow, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 v15 = _mm256_shuffle_ps(xyLow, zwLow, _MM_SHUFFLE(3, 2, 3, 2));
+		__m256 v26 = _mm256_shuffle_ps(xyHigh, zwHigh, _MM_SHUFFLE(1, 0, 1, 0));
+		__m256 v37 = _mm256_shuffle_ps(xyHigh, zwHigh, _MM_SHUFFLE(3, 2, 3, 2));
+		float* vertex = out + i * 4;
+		_mm256_storeu_ps(vertex, _mm256_permute2f128_ps(v04, v15, 0x20));
+		_mm256_storeu_ps(vertex + 8, _mm256_permute2f128_ps(v26, v37, 0x20));
+		_mm256_storeu_ps(vertex + 16, _mm256_permute2f128_ps(v04, v15, 0x31));
+		_mm256_storeu_ps(vertex + 24, _mm256_permute2f128_ps(v26, v37, 0x31));
+	}
+
+	if (i < count) {
+		SkinningStreams tail = streams;
+		tail.x += i;
+		tail.y += i;
+		tail.z += i;
+		for (int k = 0; k < 4; k++) {
+			tail.joints[k] += i;
+			tail.weights[k] += i;
+		}
+		skinVerticesScalar(tail, count - i, palette, out + i * 4);
+	}
+}
+#endif
+
+// ------------ Dispatch ------------
+
+static Kernels selectKernels(Level level) {
+	Kernels kernels = {multiplyScalar, multiplyAffineRowsScalar, inverseAffineScalar, composeTRSScalar, multiplyQuatScalar, normalizeQuatScalar, skinVerticesScalar, overlapsAnyScalar};
+#ifdef SIMDMATH_X86
+	// Without gathers a 4 wide skinning kernel spends all its time on scalar loads, so SSE4 keeps the scalar one
+	if (level >= LEVEL_SSE4)
+		kernels = {multiplySSE4, multiplyAffineRowsSSE4, inverseAffineSSE4, composeTRSSSE4, multiplyQuatSSE4, normalizeQuatSSE4, skinVerticesScalar, overlapsAnySSE4};
+	// The single matrix inverse, TRS and quaternion kernels are too narrow to gain anything from 256 bit registers,
+	// and so are the collider tests, groups rarely have more than a handful of spheres
+	if (level >= LEVEL_AVX2) {
+		kernels.multiply = multiplyAVX2;
+		kernels.multiplyAffineRows = multiplyAffineRowsAVX2;
+		kernels.skinVertices = skinVerticesAVX2;
+	}
+#endif
+	return kernels;
+}
+
+struct State {
+	Level level;
+	Kernels kernels;
+};
+
+static State& state() {
+	static State s = {detectLevel(), selectKernels(detectLevel())};
+	return s;
+}
+
+Level detectLevel() {
+#ifdef SIMDMATH_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return LEVEL_AVX2;
+	if (__builtin_cpu_supports("sse4.1"))
+		return LEVEL_SSE4;
+#endif
+	return LEVEL_SCALAR;
+}
+
+Level getLevel() {
+	return state().level;
+}
+
+void setLevel(Level level) {
+	if (level > detectLevel())
+		level = detectLevel();
+	state().level = level;
+	state().kernels = selectKernels(level);
+}
+
+const char* getLevelName(Level level) {
+	switch (level) {
+		case LEVEL_AVX2: return "AVX2";
+		case LEVEL_SSE4: return "SSE4";
+		default: return "scalar";
+	}
+}
+
+void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out) {
+	state().kernels.multiply(&a[0][0], &b[0][0], &out[0][0]);
+}
+
+void multiplyAffineRows(const glm::mat4& a, const glm::mat4& b, glm::vec4 rows[3]) {
+	state().kernels.multiplyAffineRows(&a[0][0], &b[0][0], &rows[0][0]);
+}
+
+void inverseAffine(const glm::mat4& m, glm::mat4& out) {
+	state().kernels.inverseAffine(&m[0][0], &out[0][0]);
+}
+
+void composeTRS(const glm::vec3& t, const glm::quat& r, const glm::vec3& s, glm::mat4& out) {
+	float q[4] = {r.x, r.y, r.z, r.w};
+	float translation[3] = {t.x, t.y, t.z};
+	float scale[3] = {s.x, s.y, s.z};
+	state().kernels.composeTRS(translation, q, scale, &out[0][0]);
+}
+
+glm::quat multiply(const glm::quat& a, const glm::quat& b) {
+	float qa[4] = {a.x, a.y, a.z, a.w};
+	float qb[4] = {b.x, b.y, b.z, b.w};
+	float result[4];
+	state().kernels.multiplyQuat(qa, qb, result);
+	return loadQuat(result);
+}
+
+glm::quat normalize(const glm::quat& q) {
+	float quat[4] = {q.x, q.y, q.z, q.w};
+	float result[4];
+	state().kernels.normalizeQuat(quat, result);
+	return loadQuat(result);
+}
+
+void skinVertices(const SkinningStreams& streams, size_t count, const glm::vec4* palette, glm::vec4* out) {
+	state().kernels.skinVertices(streams, count, &palette[0][0], &out[0][0]);
+}
+
+bool overlapsAny(const SphereStreams& spheres, size_t count, const glm::vec3& point, float radius) {
+	float p[3] = {point.x, point.y, point.z};
+	return state().kernels.overlapsAny(spheres, count, p, radius);
+}
+
+// ------------ Benchmarks ------------
+
+template<class F>
+static double timeKernel(size_t iterations, F&& body) {
+	auto startTime = std::chrono::high_resolution_clock::now();
+	for (size_t i = 0; i < iterations; i++) {
+		body(i);
+	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	return std::chrono::duration<double, std::nano>(endTime - startTime).count() / iterations;
+}
+
+void runBenchmarks() {
+	// Enough distinct inputs that the compiler can't fold anything, few enough to stay in cache
+	const size_t count = 1024;
+	const size_t iterations = 4 * 1024 * 1024;
+
+	std::vector<glm::vec3> translations(count);
+	std::vector<glm::quat> rotations(count);
+	std::vector<glm::vec3> scales(count);
+	std::vector<glm::mat4> matrices(count);
+	std::vector<glm::mat4> results(count);
+	std::vector<glm::quat> quatResults(count);
+	uint32_t seed = 12345;
+	auto random = [&seed]() {
+		seed = seed * 1664525u + 1013904223u;
+		return float(seed >> 8) / float(1 << 24) * 2.0f - 1.0f;
+	};
+	for (size_t i = 0; i < count; i++) {
+		translations[i] = glm::vec3(random(), random(), random());
+		rotations[i] = glm::normalize(glm::quat(random(), random(), random(), random()));
+		scales[i] = glm::vec3(1.5f + random(), 1.5f + random(), 1.5f + random());
+		matrices[i] = glm::translate(glm::mat4(1.0f), translations[i]) * glm::mat4_cast(rotations[i]) * glm::scale(glm::mat4(1.0f), scales[i]);
+	}
+
+	Level detected = detectLevel();
+	Level previous = getLevel();
+	std::cout << "[SimdMath#runBenchmarks]: Info: Detected " << getLevelName(detected) << ", " << iterations << " iterations per kernel, ns per call" << std::endl;
+	std::cout << std::left << std::setw(20) << "kernel" << std::setw(10) << "glm";
+	for (int level = LEVEL_SCALAR; level <= detected; level++) {
+		std::cout << std::setw(10) << getLevelName(Level(level));
+	}
+	std::cout << std::endl;
+
+	float checksum = 0.0f;
+	auto report = [&](const char* name, auto&& baseline, auto&& kernel) {
+		std::cout << std::left << std::setw(20) << name << std::setw(10) << std::setprecision(3) << timeKernel(iterations, baseline);
+		for (int level = LEVEL_SCALAR; level <= detected; level++) {
+			setLevel(Level(level));
+			std::cout << std::setw(10) << std::setprecision(3) << timeKernel(iterations, kernel);
+		}
+		std::cout << std::endl;
+		for (size_t i = 0; i < count; i++) {
+			checksum += results[i][3][0] + quatResults[i].w;
+		}
+	};
+
+	report("multiply", [&](size_t i) {
+		results[i % count] = matrices[i % count] * matrices[(i + 1) % count];
+	}, [&](size_t i) {
+		multiply(matrices[i % count], matrices[(i + 1) % count], results[i % count]);
+	});
+
+	report("multiplyAffineRows", [&](size_t i) {
+		glm::mat4 rows = glm::transpose(matrices[i % count] * matrices[(i + 1) % count]);
+		results[i % count][0] = rows[0];
+		results[i % count][1] = rows[1];
+		results[i % count][2] = rows[2];
+	}, [&](size_t i) {
+		multiplyAffineRows(matrices[i % count], matrices[(i + 1) % count], &results[i % count][0]);
+	});
+
+	report("inverseAffine", [&](size_t i) {
+		results[i % count] = glm::inverse(matrices[i % count]);
+	}, [&](size_t i) {
+		inverseAffine(matrices[i % count], results[i % count]);
+	});
+
+	report("composeTRS", [&](size_t i) {
+		size_t j = i % count;
+		results[j] = glm::translate(glm::mat4(1.0f), translations[j]) * glm::mat4_cast(rotations[j]) * glm::scale(glm::mat4(1.0f), scales[j]);
+	}, [&](size_t i) {
+		size_t j = i % count;
+		composeTRS(translations[j], rotations[j], scales[j], results[j]);
+	});
+
+	report("multiplyQuat", [&](size_t i) {
+		quatResults[i % count] = rotations[i % count] * rotations[(i + 1) % count];
+	}, [&](size_t i) {
+		quatResults[i % count] = multiply(rotations[i % count], rotations[(i + 1) % count]);
+	});
+
+	report("normalizeQuat", [&](size_t i) {
+		quatResults[i % count] = glm::normalize(rotations[i % count] * 1.5f);
+	}, [&](size_t i) {
+		quatResults[i % count] = normalize(rotations[i % count] * 1.5f);
+	});
+
+	setLevel(previous);
+	// 8 vertices per call, so the AVX2 kernel fills its lanes, with the matrices standing in for a palette of 64 joints
+	std::vector<float> positions[3];
+	std::vector<uint32_t> joints[4];
+	std::vector<float> weights[4];
+	for (size_t i = 0; i < count; i++) {
+		for (int c = 0; c < 3; c++) {
+			positions[c].push_back(translations[i][c]);
+		}
+		for (int k = 0; k < 4; k++) {
+			joints[k].push_back(uint32_t(random() * 32.0f + 32.0f) % 64);
+			weights[k].push_back(random() * 0.5f + 0.5f);
+		}
+	}
+	const glm::vec4* palette = &matrices[0][0];
+	glm::vec4* skinned = &results[0][0];
+	report("skinVertices x8", [&](size_t i) {
+		size_t first = (i * 8) % count;
+		for (size_t v = first; v < first + 8; v++) {
+			glm::vec4 rows[3] = {glm::vec4(0.0f), glm::vec4(0.0f), glm::vec4(0.0f)};
+			for (int k = 0; k < 4; k++) {
+				for (int r = 0; r < 3; r++) {
+					rows[r] += weights[k][v] * palette[joints[k][v] * 3 + r];
+				}
+			}
+			glm::vec4 p(positions[0][v], positions[1][v], positions[2][v], 1.0f);
+			skinned[v] = glm::vec4(glm::dot(rows[0], p), glm::dot(rows[1], p), glm::dot(rows[2], p), 1.0f);
+		}
+	}, [&](size_t i) {
+		size_t first = (i * 8) % count;
+		SkinningStreams streams;
+		streams.x = positions[0].data() + first;
+		streams.y = positions[1].data() + first;
+		streams.z = positions[2].data() + first;
+		for (int k = 0; k < 4; k++) {
+			streams.joints[k] = joints[k].data() + first;
+			streams.weights[k] = weights[k].data() + first;
+		}
+		skinVertices(streams, 8, palette, skinned + first);
+	});
+
+	// 8 spheres per call like a collider group, small enough that nearly every test misses as it does in the spring bones
+	std::vector<float> radii(count);
+	for (size_t i = 0; i < count; i++) {
+		radii[i] = 0.05f + random() * 0.02f;
+	}
+	report("overlapsAny x8", [&](size_t i) {
+		size_t first = (i * 8) % count;
+		glm::vec3 point = translations[(i + 3) % count];
+		bool hit = false;
+		for (size_t s = first; s < first + 8; s++) {
+			float reach = 0.02f + radii[s];
+			glm::vec3 offset = point - translations[s];
+			hit |= glm::dot(offset, offset) < reach * reach;
+		}
+		results[i % count][3][0] = hit ? 1.0f : 0.0f;
+	}, [&](size_t i) {
+		size_t first = (i * 8) % count;
+		SphereStreams spheres = {positions[0].data() + first, positions[1].data() + first, positions[2].data() + first, radii.data() + first};
+		results[i % count][3][0] = overlapsAny(spheres, 8, translations[(i + 3) % count], 0.02f) ? 1.0f : 0.0f;
+	});
+
+	std::cout << "[SimdMath#runBenchmarks]: Debug: Checksum " << checksum << std::endl;
+}
+
+}
@@ -0,0 +1,68 @@
+#ifndef SIMDMATH_HPP
+#define SIMDMATH_HPP
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
+#include <glm/glm.hpp>
+#include <glm/gtc/quaternion.hpp>
+
+#include <cstddef>
+#include <cstdint>
+
+// Matrix and quaternion kernels for the transform and skinning passes.
+// The widest instruction set the CPU supports is picked at runtime, glm is the scalar fallback.
+namespace SimdMath {
+	// Vertices split into one array per component so 8 of them load at once, all pointers start at the first vertex
+	struct SkinningStreams {
+		const float* x;
+		const float* y;
+		const float* z;
+		const uint32_t* joints[4];
+		const float* weights[4];
+	};
+
+	// Spheres split into one array per component, all pointers start at the first sphere
+	struct SphereStreams {
+		const float* x;
+		const float* y;
+		const float* z;
+		const float* radius;
+	};
+
+	enum Level {
+		LEVEL_SCALAR = 0,
+		LEVEL_SSE4 = 1,
+		LEVEL_AVX2 = 2
+	};
+
+	Level detectLevel();
+	Level getLevel();
+	// Only lowers the level to something the CPU supports, used by the benchmarks to compare paths
+	void setLevel(Level level);
+	const char* getLevelName(Level level);
+
+	// out = a * b, out may alias a or b
+	void multiply(const glm::mat4& a, const glm::mat4& b, glm::mat4& out);
+	// Top three rows of a * b, for affine matrices where the bottom row is always (0, 0, 0, 1)
+	void multiplyAffineRows(const glm::mat4& a, const glm::mat4& b, glm::vec4 rows[3]);
+	// Inverse of an affine matrix, much cheaper than a general 4x4 inverse
+	void inverseAffine(const glm::mat4& m, glm::mat4& out);
+	// translate(t) * mat4(r) * scale(s), r has to be normalized
+	void composeTRS(const glm::vec3& t, const glm::quat& r, const glm::vec3& s, glm::mat4& out);
+
+	glm::quat multiply(const glm::quat& a, const glm::quat& b);
+	glm::quat normalize(const glm::quat& q);
+
+	// Skins count vertices with the joints at palette (three rows each) and writes them as x, y, z, 1.
+	// Same maths as deformPosition in skinning.glsl, vertices without weights keep their position
+	void skinVertices(const SkinningStreams& streams, size_t count, const glm::vec4* palette, glm::vec4* out);
+
+	// Whether point is closer to any of count spheres than their radius plus radius, 4 spheres per test
+	bool overlapsAny(const SphereStreams& spheres, size_t count, const glm::vec3& point, float radius);
+
+	// Times every kernel on every level the CPU supports against plain glm and prints the results
+	void runBenchmarks();
+}
+
+#endif // SIMDMATH_HPP
@@ -0,0 +1,255 @@
+#include "SpringBones.hpp"
+#include "SimdMath.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+// Simulation rate, independent of the frame rate so the motion looks the same everywhere
+static const float g_SPRING_STEP = 1.0f / 60.0f;
+// Steps a single simulate may catch up on, after a hitch or for a long-frozen character the rest is dropped
+static const int g_MAX_SPRING_STEPS = 4;
+// Length of the virtual tail past the last joint of a chain, same as UniVRM
+static const float g_LEAF_TAIL_LENGTH = 0.07f;
+// Tails moving less than this per step (10 micrometres, squared) count as at rest
+static const float g_REST_MOTION = 1e-10f;
+
+// Shortest rotation taking unit vector from onto unit vector to
+static glm::quat rotationBetween(const glm::vec3& from, const glm::vec3& to) {
+	float cosine = glm::dot(from, to);
+	if (cosine < -0.9999f) {
+		// Half a turn around any axis perpendicular to from
+		glm::vec3 axis = glm::cross(glm::vec3(1.0f, 0.0f, 0.0f), from);
+		if (glm::dot(axis, axis) < 1e-6f)
+			axis = glm::cross(glm::vec3(0.0f, 1.0f, 0.0f), from);
+		return glm::quat(0.0f, glm::normalize(axis));
+	}
+	return SimdMath::normalize(glm::quat(1.0f + cosine, glm::cross(from, to)));
+}
+
+void SpringBones::init(const VRMImporter& importer) {
+	const std::vector<VRM::FCNSNode>& nodes = importer.m_Nodes;
+
+	// Every group gets its own contiguous run of colliders, so the collision test walks plain arrays.
+	// Colliders used by several groups are copied into each run
+	m_GroupColliderBegin.push_back(0);
+	for (const auto& group : importer.m_SpringBoneGroups) {
+		for (int colliderGroup : group.colliderGroups) {
+			const VRM::SpringColliderGroup& colliders = importer.m_SpringColliderGroups.at(colliderGroup);
+			for (const auto& collider : colliders.colliders) {
+				m_ColliderNode.push_back(colliders.node);
+				m_ColliderOffset.push_back(collider.offset);
+				m_ColliderRadius.push_back(collider.radius);
+			}
+		}
+		m_GroupColliderBegin.push_back(static_cast<uint32_t>(m_ColliderNode.size()));
+	}
+
+	for (uint32_t g = 0; g < importer.m_SpringBoneGroups.size(); g++) {
+		const VRM::SpringBoneGroup& group = importer.m_SpringBoneGroups[g];
+		for (int bone : group.bones) {
+			if (bone < 0 || bone >= static_cast<int>(nodes.size()))
+				continue;
+			Chain chain;
+			chain.begin = static_cast<uint32_t>(m_Node.size());
+			addJoint(importer, group, g, bone, -1);
+			chain.end = static_cast<uint32_t>(m_Node.size());
+			if (chain.end > chain.begin)
+				m_Chains.push_back(chain);
+		}
+	}
+
+	if (!m_Chains.empty())
+		std::cout << "[SpringBones#init]: Info: " << m_Chains.size() << " chains with " << m_Node.size() << " joints and " << m_ColliderNode.size() << " collider slots" << std::endl;
+}
+
+void SpringBones::addJoint(const VRMImporter& importer, const VRM::SpringBoneGroup& group, uint32_t groupIndex, int node, int parentJoint) {
+	// Chains of different groups may overlap, a joint simulated twice would be written from two threads
+	if (std::find(m_Node.begin(), m_Node.end(), node) != m_Node.end())
+		return;
+	const VRM::FCNSNode& n = importer.m_Nodes[node];
+	int joint = static_cast<int>(m_Node.size());
+
+	glm::vec3 tail;
+	if (n.firstChild != -1) {
+		tail = importer.m_Nodes[n.firstChild].translation;
+	} else {
+		// Keep going in the direction the bone came from, expressed in the joint's own space
+		glm::vec3 direction = glm::inverse(n.rotation) * n.translation;
+		tail = glm::dot(direction, direction) > 0.0f ? glm::normalize(direction) * g_LEAF_TAIL_LENGTH : glm::vec3(0.0f, g_LEAF_TAIL_LENGTH, 0.0f);
+	}
+
+	m_Node.push_back(node);
+	m_ParentJoint.push_back(parentJoint);
+	m_RestRotation.push_back(n.rotation);
+	m_TailLocalX.push_back(tail.x);
+	m_TailLocalY.push_back(tail.y);
+	m_TailLocalZ.push_back(tail.z);
+	m_Stiffness.push_back(group.stiffness);
+	m_Drag.push_back(group.dragForce);
+	m_GravityX.push_back(group.gravityDir.x * group.gravityPower);
+	m_GravityY.push_back(group.gravityDir.y * group.gravityPower);
+	m_GravityZ.push_back(group.gravityDir.z * group.gravityPower);
+	m_HitRadius.push_back(group.hitRadius);
+	m_Group.push_back(groupIndex);
+
+	for (int child = n.firstChild; child != -1; child = importer.m_Nodes[child].nextSibling) {
+		addJoint(importer, group, groupIndex, child, joint);
+	}
+}
+
+bool SpringBones::empty() const {
+	return m_Chains.empty();
+}
+
+void SpringBones::reset(State& state, const std::vector<VRM::FCNSNode>& nodes) const {
+	size_t count = m_Node.size();
+	state.tailX.resize(count);
+	state.tailY.resize(count);
+	state.tailZ.resize(count);
+	for (size_t j = 0; j < count; j++) {
+		glm::vec4 tail = nodes[m_Node[j]].globalTransform * glm::vec4(m_TailLocalX[j], m_TailLocalY[j], m_TailLocalZ[j], 1.0f);
+		state.tailX[j] = tail.x;
+		state.tailY[j] = tail.y;
+		state.tailZ[j] = tail.z;
+	}
+	// Starting at rest, without any velocity
+	state.previousTailX = state.tailX;
+	state.previousTailY = state.tailY;
+	state.previousTailZ = state.tailZ;
+	state.colliderX.resize(m_ColliderNode.size());
+	state.colliderY.resize(m_ColliderNode.size());
+	state.colliderZ.resize(m_ColliderNode.size());
+	state.rotation.resize(count);
+	state.chainMotion.assign(m_Chains.size(), 0.0f);
+	state.initialized = true;
+}
+
+bool SpringBones::simulate(State& state, std::vector<VRM::FCNSNode>& nodes, ThreadPool* threadPool) const {
+	if (m_Chains.empty())
+		return false;
+	if (!state.initialized)
+		reset(state, nodes);
+
+	int steps = static_cast<int>(state.accumulator / g_SPRING_STEP);
+	if (steps == 0)
+		return false;
+	if (steps > g_MAX_SPRING_STEPS) {
+		steps = g_MAX_SPRING_STEPS;
+		state.accumulator = 0.0f;
+	} else {
+		state.accumulator -= steps * g_SPRING_STEP;
+	}
+
+	// Colliders hang from body bones, which the springs never move, so one update covers every step
+	for (size_t slot = 0; slot < m_ColliderNode.size(); slot++) {
+		glm::vec4 center = nodes[m_ColliderNode[slot]].globalTransform * glm::vec4(m_ColliderOffset[slot], 1.0f);
+		state.colliderX[slot] = center.x;
+		state.colliderY[slot] = center.y;
+		state.colliderZ[slot] = center.z;
+	}
+
+	auto run = [&](size_t c) {
+		float motion = 0.0f;
+		for (int step = 0; step < steps; step++) {
+			motion = std::max(motion, simulateChain(state, nodes, m_Chains[c], g_SPRING_STEP));
+		}
+		state.chainMotion[c] = motion;
+	};
+	if (threadPool) {
+		threadPool->parallelFor(m_Chains.size(), run);
+	} else {
+		for (size_t c = 0; c < m_Chains.size(); c++) {
+			run(c);
+		}
+	}
+
+	// Nothing moved far enough to be worth new transforms, the nodes keep the rotations they were last given
+	if (*std::max_element(state.chainMotion.begin(), state.chainMotion.end()) < g_REST_MOTION)
+		return false;
+
+	// Marking walks up through ancestors that chains share, so it can not happen on the workers
+	for (size_t j = 0; j < m_Node.size(); j++) {
+		VRM::FCNSNode& node = nodes[m_Node[j]];
+		node.rotation = state.rotation[j];
+		SimdMath::composeTRS(node.translation, node.rotation, node.scale, node.localTransform);
+		VRMImporter::markDirty(nodes, m_Node[j]);
+	}
+	return true;
+}
+
+float SpringBones::simulateChain(State& state, const std::vector<VRM::FCNSNode>& nodes, const Chain& chain, float step) const {
+	// Model space transforms of the chain's joints as this step moves them, children hang from their parent's new transform
+	thread_local std::vector<glm::mat4> worlds;
+	worlds.resize(chain.end - chain.begin);
+	float motion = 0.0f;
+
+	for (uint32_t j = chain.begin; j < chain.end; j++) {
+		const VRM::FCNSNode& node = nodes[m_Node[j]];
+		glm::mat4 parentWorld(1.0f);
+		if (m_ParentJoint[j] != -1)
+			parentWorld = worlds[m_ParentJoint[j] - chain.begin];
+		else if (node.parent != -1)
+			parentWorld = nodes[node.parent].globalTransform;
+
+		glm::mat4 local;
+		glm::mat4 world;
+		SimdMath::composeTRS(node.translation, m_RestRotation[j], node.scale, local);
+		SimdMath::multiply(parentWorld, local, world);
+
+		glm::vec3 tailLocal(m_TailLocalX[j], m_TailLocalY[j], m_TailLocalZ[j]);
+		glm::vec3 position(world[3]);
+		glm::vec3 restDirection = glm::vec3(world * glm::vec4(tailLocal, 1.0f)) - position;
+		float length = glm::length(restDirection);
+		if (length <= 0.0f) {
+			// Nothing to point anywhere, writing it back leaves the joint as it is
+			state.rotation[j] = node.rotation;
+			worlds[j - chain.begin] = world;
+			continue;
+		}
+		restDirection /= length;
+
+		// Verlet step: inertia with drag, a pull back towards the rest pose, and gravity
+		glm::vec3 tail(state.tailX[j], state.tailY[j], state.tailZ[j]);
+		glm::vec3 previousTail(state.previousTailX[j], state.previousTailY[j], state.previousTailZ[j]);
+		glm::vec3 gravity(m_GravityX[j], m_GravityY[j], m_GravityZ[j]);
+		glm::vec3 next = tail + (tail - previousTail) * (1.0f - m_Drag[j]) + (restDirection * m_Stiffness[j] + gravity) * step;
+		next = position + glm::normalize(next - position) * length;
+
+		// Test against every collider of the group at once first, nearly always nothing is hit
+		uint32_t begin = m_GroupColliderBegin[m_Group[j]];
+		uint32_t end = m_GroupColliderBegin[m_Group[j] + 1];
+		SimdMath::SphereStreams colliders = {state.colliderX.data() + begin, state.colliderY.data() + begin, state.colliderZ.data() + begin, m_ColliderRadius.data() + begin};
+		if (SimdMath::overlapsAny(colliders, end - begin, next, m_HitRadius[j])) {
+			for (uint32_t slot = begin; slot < end; slot++) {
+				glm::vec3 center(state.colliderX[slot], state.colliderY[slot], state.colliderZ[slot]);
+				float radius = m_HitRadius[j] + m_ColliderRadius[slot];
+				glm::vec3 offset = next - center;
+				float distanceSquared = glm::dot(offset, offset);
+				if (distanceSquared >= radius * radius || distanceSquared <= 0.0f)
+					continue;
+				// Out to the surface of the sphere, then back onto the bone's length
+				next = center + offset * (radius / std::sqrt(distanceSquared));
+				next = position + glm::normalize(next - position) * length;
+			}
+		}
+
+		glm::vec3 moved = next - tail;
+		motion = std::max(motion, glm::dot(moved, moved));
+		state.previousTailX[j] = tail.x;
+		state.previousTailY[j] = tail.y;
+		state.previousTailZ[j] = tail.z;
+		state.tailX[j] = next.x;
+		state.tailY[j] = next.y;
+		state.tailZ[j] = next.z;
+
+		// Turn the rest pose so the tail points at its new position, worked out in the joint's own space
+		glm::mat3 basis(glm::normalize(glm::vec3(world[0])), glm::normalize(glm::vec3(world[1])), glm::normalize(glm::vec3(world[2])));
+		glm::vec3 target = glm::normalize(glm::transpose(basis) * (next - position));
+		glm::quat rotation = SimdMath::multiply(m_RestRotation[j], rotationBetween(glm::normalize(tailLocal), target));
+
+		SimdMath::composeTRS(node.translation, rotation, node.scale, local);
+		SimdMath::multiply(parentWorld, local, worlds[j - chain.begin]);
+		state.rotation[j] = rotation;
+	}
+	return motion;
+}
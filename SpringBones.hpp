@@ -0,0 +1,79 @@
+#ifndef SPRINGBONES_HPP
+#define SPRINGBONES_HPP
+
+#include <vector>
+#include "ThreadPool.hpp"
+#include "importer/VRMImporter.hpp"
+
+// Secondary motion of VRM spring bones (hair, skirts, accessories), simulated at a fixed rate.
+// The chain layout is built once per model and shared, every posed copy of the nodes keeps its own State.
+class SpringBones {
+public:
+	// Tails of every joint of one set of nodes, one array per component
+	struct State {
+		std::vector<float> tailX;
+		std::vector<float> tailY;
+		std::vector<float> tailZ;
+		std::vector<float> previousTailX;
+		std::vector<float> previousTailY;
+		std::vector<float> previousTailZ;
+		// Collider spheres in model space, refreshed once per simulate
+		std::vector<float> colliderX;
+		std::vector<float> colliderY;
+		std::vector<float> colliderZ;
+		// Rotation the last step gave every joint, only written to the nodes when something moved
+		std::vector<glm::quat> rotation;
+		// Furthest any tail of each chain moved in the last simulate, squared
+		std::vector<float> chainMotion;
+		// Time not yet simulated, fed by the caller
+		float accumulator = 0.0f;
+		bool initialized = false;
+	};
+
+	void init(const VRMImporter& importer);
+	bool empty() const;
+
+	// Runs the fixed steps accumulated in state and writes the joint rotations into nodes, marking them dirty.
+	// The global transforms of nodes have to be current. Chains are spread over threadPool when one is given.
+	// Returns false when no step ran or every chain has come to rest, the nodes are then left untouched
+	bool simulate(State& state, std::vector<VRM::FCNSNode>& nodes, ThreadPool* threadPool) const;
+
+private:
+	struct Chain {
+		uint32_t begin;
+		uint32_t end;
+	};
+
+	void addJoint(const VRMImporter& importer, const VRM::SpringBoneGroup& group, uint32_t groupIndex, int node, int parentJoint);
+	void reset(State& state, const std::vector<VRM::FCNSNode>& nodes) const;
+	// Returns the furthest a tail of the chain moved, squared
+	float simulateChain(State& state, const std::vector<VRM::FCNSNode>& nodes, const Chain& chain, float step) const;
+
+	// Joints of all chains, every chain is contiguous and lists parents before their children
+	std::vector<int> m_Node;
+	// Joint index of the parent within the chain, -1 for the root which hangs from its node's parent
+	std::vector<int> m_ParentJoint;
+	std::vector<glm::quat> m_RestRotation;
+	// Where the tail sits in the joint's own space, at the first child or a short way past a leaf
+	std::vector<float> m_TailLocalX;
+	std::vector<float> m_TailLocalY;
+	std::vector<float> m_TailLocalZ;
+	std::vector<float> m_Stiffness;
+	std::vector<float> m_Drag;
+	// Gravity direction times power
+	std::vector<float> m_GravityX;
+	std::vector<float> m_GravityY;
+	std::vector<float> m_GravityZ;
+	std::vector<float> m_HitRadius;
+	std::vector<uint32_t> m_Group;
+	std::vector<Chain> m_Chains;
+
+	// Collider slots, indexed like the collider arrays of State
+	std::vector<int> m_ColliderNode;
+	std::vector<glm::vec3> m_ColliderOffset;
+	std::vector<float> m_ColliderRadius;
+	// Colliders of bone group g are the slots from m_GroupColliderBegin[g] up to m_GroupColliderBegin[g + 1]
+	std::vector<uint32_t> m_GroupColliderBegin;
+};
+
+#endif // SPRINGBONES_HPP
@@ -0,0 +1,103 @@
+#include "TaskGraph.hpp"
+
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+uint32_t TaskGraph::add(const std::string& name, const std::vector<uint32_t>& dependencies, const Task& task, bool callingThread) {
+	uint32_t index = static_cast<uint32_t>(m_Nodes.size());
+	Node node;
+	node.name = name;
+	node.task = task;
+	node.callingThread = callingThread;
+	for (uint32_t dependency : dependencies) {
+		if (dependency >= index)
+			throw std::invalid_argument("[TaskGraph#add]: Error: " + name + " depends on a task that was not added before it!");
+		m_Nodes[dependency].dependents.push_back(index);
+		node.waitingFor++;
+	}
+	m_Nodes.push_back(node);
+	return index;
+}
+
+void TaskGraph::run() {
+	std::mutex mutex;
+	std::condition_variable finished;
+	std::deque<uint32_t> ready;
+	// Pinned tasks that are ready, picked up by the calling thread between waits
+	std::deque<uint32_t> readyHere;
+	std::vector<std::thread> threads;
+	size_t done = 0;
+	std::exception_ptr error;
+	auto begin = std::chrono::steady_clock::now();
+
+	for (uint32_t i = 0; i < m_Nodes.size(); i++) {
+		if (m_Nodes[i].waitingFor == 0)
+			(m_Nodes[i].callingThread ? readyHere : ready).push_back(i);
+	}
+
+	// Runs task i and releases its dependents, called without the lock held
+	auto execute = [&](uint32_t i) {
+		Node& node = m_Nodes[i];
+		std::exception_ptr thrown;
+		node.start = std::chrono::steady_clock::now() - begin;
+		if (!node.skipped) {
+			try {
+				node.task();
+			} catch (...) {
+				thrown = std::current_exception();
+			}
+		}
+		node.end = std::chrono::steady_clock::now() - begin;
+
+		std::lock_guard<std::mutex> lock(mutex);
+		if (thrown && !error)
+			error = thrown;
+		for (uint32_t dependent : node.dependents) {
+			Node& next = m_Nodes[dependent];
+			next.skipped |= node.skipped || thrown != nullptr;
+			if (--next.waitingFor == 0)
+				(next.callingThread ? readyHere : ready).push_back(dependent);
+		}
+		done++;
+		finished.notify_all();
+	};
+
+	std::unique_lock<std::mutex> lock(mutex);
+	while (done < m_Nodes.size()) {
+		while (!ready.empty()) {
+			uint32_t i = ready.front();
+			ready.pop_front();
+			threads.emplace_back(execute, i);
+		}
+		if (!readyHere.empty()) {
+			uint32_t i = readyHere.front();
+			readyHere.pop_front();
+			lock.unlock();
+			execute(i);
+			lock.lock();
+			continue;
+		}
+		finished.wait(lock, [&]() { return done == m_Nodes.size() || !ready.empty() || !readyHere.empty(); });
+	}
+	lock.unlock();
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	if (error)
+		std::rethrow_exception(error);
+}
+
+void TaskGraph::report() const {
+	for (const Node& node : m_Nodes) {
+		double start = std::chrono::duration<double, std::milli>(node.start).count();
+		double duration = std::chrono::duration<double, std::milli>(node.end - node.start).count();
+		std::cout << "[TaskGraph#report]: Info: " << node.name << " started at " << start << "ms and took " << duration << "ms"
+			<< (node.callingThread ? "" : " on its own thread") << std::endl;
+	}
+}
@@ -0,0 +1,39 @@
+#ifndef TASKGRAPH_HPP
+#define TASKGRAPH_HPP
+
+#include <chrono>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+// Runs a fixed set of tasks once, each as soon as the tasks it depends on are done. Tasks get a thread of their own,
+// except the ones pinned to the thread calling run. Meant for startup, where a handful of long steps wait on each other
+class TaskGraph {
+public:
+	typedef std::function<void()> Task;
+
+	// Dependencies have to be added first, so the graph can not have cycles
+	uint32_t add(const std::string& name, const std::vector<uint32_t>& dependencies, const Task& task, bool callingThread = false);
+	// Returns once every task is done. When one throws, the tasks depending on it are skipped and the exception is
+	// rethrown after everything already running has finished
+	void run();
+	// Prints when every task started and how long it ran, relative to the start of run
+	void report() const;
+
+private:
+	struct Node {
+		std::string name;
+		std::vector<uint32_t> dependents;
+		Task task;
+		bool callingThread;
+		uint32_t waitingFor = 0;
+		bool skipped = false;
+		std::chrono::steady_clock::duration start{};
+		std::chrono::steady_clock::duration end{};
+	};
+
+	std::vector<Node> m_Nodes;
+};
+
+#endif // TASKGRAPH_HPP
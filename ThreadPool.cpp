@@ -0,0 +1,82 @@
+#include "ThreadPool.hpp"
+
+ThreadPool::ThreadPool(size_t threadCount) {
+	if (threadCount == 0) {
+		unsigned int hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	m_Threads.reserve(threadCount);
+	for (size_t i = 0; i < threadCount; i++) {
+		m_Threads.emplace_back(&ThreadPool::workerLoop, this);
+	}
+}
+
+ThreadPool::~ThreadPool() {
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Stopping = true;
+	}
+	m_WorkAvailable.notify_all();
+	for (auto& thread : m_Threads) {
+		thread.join();
+	}
+}
+
+void ThreadPool::parallelFor(size_t count, const std::function<void(size_t)>& body) {
+	if (count == 0)
+		return;
+	// Waking the workers costs more than a single item
+	if (m_Threads.empty() || count == 1) {
+		for (size_t i = 0; i < count; i++) {
+			body(i);
+		}
+		return;
+	}
+
+	std::lock_guard<std::mutex> caller(m_CallerMutex);
+	{
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		m_Body = &body;
+		m_Count = count;
+		m_Next = 0;
+		m_Busy = m_Threads.size();
+		m_Generation++;
+	}
+	m_WorkAvailable.notify_all();
+
+	runItems();
+
+	std::unique_lock<std::mutex> lock(m_Mutex);
+	m_WorkDone.wait(lock, [this]() { return m_Busy == 0; });
+	m_Body = nullptr;
+}
+
+size_t ThreadPool::threadCount() const {
+	return m_Threads.size() + 1;
+}
+
+void ThreadPool::workerLoop() {
+	uint64_t generation = 0;
+	while (true) {
+		{
+			std::unique_lock<std::mutex> lock(m_Mutex);
+			m_WorkAvailable.wait(lock, [&]() { return m_Stopping || m_Generation != generation; });
+			if (m_Stopping)
+				return;
+			generation = m_Generation;
+		}
+
+		runItems();
+
+		std::lock_guard<std::mutex> lock(m_Mutex);
+		if (--m_Busy == 0)
+			m_WorkDone.notify_one();
+	}
+}
+
+void ThreadPool::runItems() {
+	for (size_t i = m_Next++; i < m_Count; i = m_Next++) {
+		(*m_Body)(i);
+	}
+}
@@ -0,0 +1,47 @@
+#ifndef THREADPOOL_HPP
+#define THREADPOOL_HPP
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed set of worker threads for splitting per-frame work, the calling thread helps out and blocks until everything is done
+class ThreadPool {
+public:
+	// 0 picks one thread less than the hardware has, since the caller works too
+	explicit ThreadPool(size_t threadCount = 0);
+	~ThreadPool();
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Calls body once for every index in [0, count), in no particular order.
+	// Calls from different threads take turns, a call from inside body would never return
+	void parallelFor(size_t count, const std::function<void(size_t)>& body);
+	size_t threadCount() const;
+
+private:
+	void workerLoop();
+	void runItems();
+
+	std::vector<std::thread> m_Threads;
+	// Held for a whole parallelFor, the simulation and render threads share one pool
+	std::mutex m_CallerMutex;
+	std::mutex m_Mutex;
+	std::condition_variable m_WorkAvailable;
+	std::condition_variable m_WorkDone;
+
+	const std::function<void(size_t)>* m_Body = nullptr;
+	size_t m_Count = 0;
+	std::atomic<size_t> m_Next{0};
+	// Workers that have not finished the current batch yet
+	size_t m_Busy = 0;
+	uint64_t m_Generation = 0;
+	bool m_Stopping = false;
+};
+
+#endif // THREADPOOL_HPP
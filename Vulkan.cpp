@@ -1,6 +1,10 @@
 #include "Vulkan.hpp"
+#include <algorithm>
+#include <cctype>
 #include <set>
 #include <fstream>
+#include <chrono>
+#include <cstdio>
 
 static std::vector<char> readFile(const std::string& filename) {
 	std::ifstream file(filename, std::ios::ate | std::ios::binary);
@@ -17,6 +21,40 @@ static std::vector<char> readFile(const std::string& filename) {
 	return buffer;
 }
 
+static bool hasDeviceExtension(VkPhysicalDevice device, const char* name) {
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& extension : availableExtensions) {
+		if (strcmp(extension.extensionName, name) == 0)
+			return true;
+	}
+	return false;
+}
+
+static const char* presentModeName(VkPresentModeKHR mode) {
+	switch (mode) {
+		case VK_PRESENT_MODE_IMMEDIATE_KHR: return "immediate";
+		case VK_PRESENT_MODE_MAILBOX_KHR: return "mailbox";
+		case VK_PRESENT_MODE_FIFO_KHR: return "fifo";
+		case VK_PRESENT_MODE_FIFO_RELAXED_KHR: return "fifo-relaxed";
+		default: return "other";
+	}
+}
+
+static const char* deviceTypeName(VkPhysicalDeviceType type) {
+	switch (type) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: return "discrete GPU";
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: return "integrated GPU";
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: return "virtual GPU";
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: return "CPU";
+		default: return "other";
+	}
+}
+
 #include <string>
 #include <string.h>
 
@@ -31,8 +69,14 @@ void Vulkan::init(std::vector<const char*>& extensions, size_t width, size_t hei
 
 void Vulkan::init2() {
 	pickPhysicalDevice();
+	queryDeviceCapabilities();
 	createLogicalDevice();
-	createSwapChain();
+	loadDeviceFunctions();
+	createPipelineCache();
+	if (m_Headless)
+		createOffscreenImages();
+	else
+		createSwapChain();
 
 	createImageViews();
 	createRenderPass();
@@ -41,10 +85,14 @@ void Vulkan::init2() {
 }
 
 void Vulkan::setup() {
-	createDepthResources();
+	m_FrameGraph.compile(*this, m_SwapChainExtent);
 	createFramebuffers();
 
 	createSyncObjects();
+	createQueryPool();
+	// Buffers are created by the first frame each slot reads back
+	if (m_ReadbackConsumer)
+		m_ReadbackSlots.resize(m_FramesInFlight);
 }
 
 void Vulkan::invalidate(size_t width, size_t height) {
@@ -117,27 +165,257 @@ bool Vulkan::checkValidationLayerSupport() {
 	return true;
 }
 
-void Vulkan::beginDrawFrame(uint32_t* imageIndex) {
-	vkWaitForFences(m_Device, 1, &m_InFlightFences[m_CurrentFrame], VK_TRUE, UINT64_MAX);
+void Vulkan::waitForFrame() {
+	// Blocks until the GPU is done with the frame that last used this slot, m_FramesInFlight frames ago
+	VkSemaphoreWaitInfoKHR waitInfo{};
+	waitInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO_KHR;
+	waitInfo.semaphoreCount = 1;
+	waitInfo.pSemaphores = &m_FrameTimeline;
+	waitInfo.pValues = &m_FrameTimelineValues[m_CurrentFrame];
+	if (pvkWaitSemaphoresKHR(m_Device, &waitInfo, UINT64_MAX) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#waitForFrame]: Error: Failed to wait for frame timeline semaphore!");
+	}
+	releaseRetiredSwapChains(m_FrameTimelineValues[m_CurrentFrame]);
+	releaseRetiredBuffers(m_FrameTimelineValues[m_CurrentFrame]);
+	readPipelineStatistics();
+	if (!m_ReadbackSlots.empty())
+		deliverReadback(m_ReadbackSlots[m_CurrentFrame]);
+}
+
+bool Vulkan::beginDrawFrame(uint32_t* imageIndex) {
+	if (m_Headless) {
+		// Every frame slot has its own image, so the caller's waitForFrame already made it free
+		*imageIndex = m_CurrentFrame;
+		vkResetCommandBuffer(m_CommandBuffers[m_CurrentFrame], 0);
+		beginRecordCommandBuffer(m_CommandBuffers[m_CurrentFrame]);
+		return true;
+	}
 
 	VkResult result = vkAcquireNextImageKHR(m_Device, m_SwapChain, UINT64_MAX, m_ImageAvailableSemaphores[m_CurrentFrame], VK_NULL_HANDLE, imageIndex);
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR) {
 		recreateSwapChain();
-		return;
+		return false;
 	} else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
 		throw std::runtime_error("[Vulkan#drawFrame]: Error: Failed to acquire swap chain image!");
 	}
-	vkResetFences(m_Device, 1, &m_InFlightFences[m_CurrentFrame]);
 
 	vkResetCommandBuffer(m_CommandBuffers[m_CurrentFrame], 0);
 
-	beginRecordCommandBuffer(m_CommandBuffers[m_CurrentFrame], *imageIndex);
+	beginRecordCommandBuffer(m_CommandBuffers[m_CurrentFrame]);
+	return true;
 }
 
-void Vulkan::endRecordCommandBuffer(VkCommandBuffer commandBuffer) {
+VkCommandBuffer Vulkan::beginComputeCommands() {
+	// The graphics submit of this slot's last frame waited on its compute work, so the timeline wait covers both
+	VkCommandBuffer commandBuffer = m_ComputeCommandBuffers[m_CurrentFrame];
+	vkResetCommandBuffer(commandBuffer, 0);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#beginComputeCommands]: Error: Failed to begin recording compute command buffer!");
+	}
+	return commandBuffer;
+}
+
+void Vulkan::endComputeCommands(VkCommandBuffer commandBuffer) {
+	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#endComputeCommands]: Error: Failed to record compute command buffer!");
+	}
+
+	// Submitted right away so the GPU can start deforming while the graphics commands are still being recorded
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount = 1;
+	submitInfo.pCommandBuffers = &commandBuffer;
+	submitInfo.signalSemaphoreCount = 1;
+	submitInfo.pSignalSemaphores = &m_ComputeTimeline;
+
+	uint64_t signalValue = m_FrameNumber + 1;
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.signalSemaphoreValueCount = 1;
+	timelineInfo.pSignalSemaphoreValues = &signalValue;
+	submitInfo.pNext = &timelineInfo;
+
+	if (vkQueueSubmit(m_ComputeQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#endComputeCommands]: Error: Failed to submit compute command buffer!");
+	}
+	m_ComputePending = true;
+}
+
+void Vulkan::createFrameGraph(const RenderGraph::Record& deform, const RenderGraph::Record& draw) {
+	m_SwapChainResource = m_FrameGraph.importImage("swap chain", VK_IMAGE_ASPECT_COLOR_BIT, VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT_KHR);
+	m_FrameGraph.markOutput(m_SwapChainResource, m_Headless ? RenderGraph::USAGE_TRANSFER_SRC : RenderGraph::USAGE_PRESENT);
+	m_DepthResource = m_FrameGraph.createImage("depth", findDepthFormat(), VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_IMAGE_ASPECT_DEPTH_BIT);
+	// Stands for the deformed buffers of every mesh
+	uint32_t deformed = m_FrameGraph.importBuffer("deformed vertices");
+
+	// Async compute deforms on its own queue and hands over with the compute timeline instead
+	if (m_Skinning == SKINNING_COMPUTE && !m_AsyncCompute)
+		m_FrameGraph.addPass("deform", {{deformed, RenderGraph::USAGE_STORAGE_WRITE_COMPUTE}}, deform);
+
+	m_FrameGraph.addPass("scene", {
+		{deformed, RenderGraph::USAGE_STORAGE_READ_VERTEX},
+		{m_SwapChainResource, RenderGraph::USAGE_COLOUR_ATTACHMENT},
+		{m_DepthResource, RenderGraph::USAGE_DEPTH_ATTACHMENT}
+	}, [this, draw](VkCommandBuffer commandBuffer) {
+		if (!m_ReuseCommandBuffers) {
+			beginRenderPass(m_ImageIndex, VK_SUBPASS_CONTENTS_INLINE);
+			setViewport(commandBuffer);
+			draw(commandBuffer);
+			endRenderPass(commandBuffer);
+			return;
+		}
+		beginRenderPass(m_ImageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+		VkCommandBuffer sceneCommands = m_SceneCommandBuffers[m_CurrentFrame];
+		if (!m_SceneCommandsValid[m_CurrentFrame]) {
+			beginSceneCommands(sceneCommands);
+			draw(sceneCommands);
+			endRecordCommandBuffer(sceneCommands);
+			m_SceneCommandsValid[m_CurrentFrame] = true;
+			m_SceneCommandsRecorded++;
+		}
+		vkCmdExecuteCommands(commandBuffer, 1, &sceneCommands);
+		endRenderPass(commandBuffer);
+	});
+
+	if (m_ReadbackConsumer) {
+		// Stands for the readback buffers of every frame slot, the final barrier makes the copy visible to the host
+		uint32_t readback = m_FrameGraph.importBuffer("readback");
+		m_FrameGraph.markOutput(readback, RenderGraph::USAGE_HOST_READ);
+		m_FrameGraph.addPass("readback", {
+			{m_SwapChainResource, RenderGraph::USAGE_TRANSFER_SRC},
+			{readback, RenderGraph::USAGE_TRANSFER_DST}
+		}, [this](VkCommandBuffer commandBuffer) {
+			recordReadback(commandBuffer);
+		});
+	}
+}
+
+void Vulkan::recordFrameGraph(uint32_t imageIndex) {
+	m_ImageIndex = imageIndex;
+	if (m_ReadbackRequested)
+		prepareReadbackSlot(m_ReadbackSlots[m_CurrentFrame]);
+	m_FrameGraph.setImage(m_SwapChainResource, m_SwapChainImages[imageIndex]);
+	m_FrameGraph.execute(m_CommandBuffers[m_CurrentFrame]);
+	m_ReadbackRequested = false;
+}
+
+void Vulkan::requestReadback() {
+	m_ReadbackRequested = !m_ReadbackSlots.empty();
+}
+
+void Vulkan::prepareReadbackSlot(ReadbackSlot& slot) {
+	VkDeviceSize size = VkDeviceSize(m_SwapChainExtent.width) * m_SwapChainExtent.height * 4;
+	if (slot.size >= size)
+		return;
+	// The slot's last copy was handed out by waitForFrame, so its buffer is no longer in use
+	destroyReadbackSlot(slot);
+
+	// Cached memory makes the CPU's reads of it many times faster, but may need invalidating
+	VkMemoryPropertyFlags properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+	try {
+		createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, slot.buffer, slot.memory);
+	} catch (const std::runtime_error&) {
+		if (slot.buffer != VK_NULL_HANDLE)
+			vkDestroyBuffer(m_Device, slot.buffer, nullptr);
+		slot.buffer = VK_NULL_HANDLE;
+		properties = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+		createBuffer(size, VK_BUFFER_USAGE_TRANSFER_DST_BIT, properties, slot.buffer, slot.memory);
+	}
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_Device, slot.buffer, &memRequirements);
+	// Same lookup createBuffer did
+	uint32_t memoryType = findMemoryType(memRequirements.memoryTypeBits, properties);
+	slot.coherent = (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0;
+	vkMapMemory(m_Device, slot.memory, 0, size, 0, &slot.mapped);
+	slot.size = size;
+}
+
+void Vulkan::recordReadback(VkCommandBuffer commandBuffer) {
+	if (!m_ReadbackRequested)
+		return;
+	ReadbackSlot& slot = m_ReadbackSlots[m_CurrentFrame];
+
+	VkBufferImageCopy region{};
+	region.bufferOffset = 0;
+	// Tightly packed
+	region.bufferRowLength = 0;
+	region.bufferImageHeight = 0;
+	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel = 0;
+	region.imageSubresource.baseArrayLayer = 0;
+	region.imageSubresource.layerCount = 1;
+	region.imageOffset = {0, 0, 0};
+	region.imageExtent = {m_SwapChainExtent.width, m_SwapChainExtent.height, 1};
+	vkCmdCopyImageToBuffer(commandBuffer, m_SwapChainImages[m_ImageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, slot.buffer, 1, &region);
+
+	slot.extent = m_SwapChainExtent;
+	slot.bgra = m_SwapChainImageFormat == VK_FORMAT_B8G8R8A8_SRGB || m_SwapChainImageFormat == VK_FORMAT_B8G8R8A8_UNORM;
+	// endDrawFrame submits the frame with the next number
+	slot.frameNumber = m_FrameNumber + 1;
+}
+
+void Vulkan::deliverReadback(ReadbackSlot& slot) {
+	if (slot.frameNumber == 0)
+		return;
+	if (!slot.coherent) {
+		VkMappedMemoryRange range{};
+		range.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE;
+		range.memory = slot.memory;
+		range.offset = 0;
+		range.size = VK_WHOLE_SIZE;
+		vkInvalidateMappedMemoryRanges(m_Device, 1, &range);
+	}
+
+	ReadbackFrame frame;
+	frame.pixels = static_cast<const uint8_t*>(slot.mapped);
+	frame.width = slot.extent.width;
+	frame.height = slot.extent.height;
+	frame.bgra = slot.bgra;
+	frame.frameNumber = slot.frameNumber;
+	slot.frameNumber = 0;
+	m_ReadbackConsumer(frame);
+}
+
+void Vulkan::flushReadbacks() {
+	std::vector<ReadbackSlot*> pending;
+	for (ReadbackSlot& slot : m_ReadbackSlots) {
+		if (slot.frameNumber != 0)
+			pending.push_back(&slot);
+	}
+	std::sort(pending.begin(), pending.end(), [](const ReadbackSlot* a, const ReadbackSlot* b) {
+		return a->frameNumber < b->frameNumber;
+	});
+	for (ReadbackSlot* slot : pending) {
+		deliverReadback(*slot);
+	}
+}
+
+void Vulkan::destroyReadbackSlot(ReadbackSlot& slot) {
+	if (slot.buffer == VK_NULL_HANDLE)
+		return;
+	vkUnmapMemory(m_Device, slot.memory);
+	vkDestroyBuffer(m_Device, slot.buffer, nullptr);
+	vkFreeMemory(m_Device, slot.memory, nullptr);
+	slot = ReadbackSlot();
+}
+
+void Vulkan::endRenderPass(VkCommandBuffer commandBuffer) {
+	if (m_StatisticsQueryPool != VK_NULL_HANDLE) {
+		vkCmdEndQuery(commandBuffer, m_StatisticsQueryPool, m_CurrentFrame);
+		m_StatisticsWritten[m_CurrentFrame] = true;
+	}
 	vkCmdEndRenderPass(commandBuffer);
+}
 
+void Vulkan::endRecordCommandBuffer(VkCommandBuffer commandBuffer) {
 	if (vkEndCommandBuffer(commandBuffer) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#recordCommandBuffer]: Error: Failed to record command buffer!");
 	}
@@ -149,21 +427,44 @@ void Vulkan::endDrawFrame(uint32_t* imageIndex) {
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
 
-	VkSemaphore waitSemaphores[] = {m_ImageAvailableSemaphores[m_CurrentFrame]};
-	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT};
-	submitInfo.waitSemaphoreCount = 1;
-	submitInfo.pWaitSemaphores = waitSemaphores;
-	submitInfo.pWaitDstStageMask = waitStages;
+	m_FrameNumber++;
+
+	VkSemaphore waitSemaphores[] = {m_ImageAvailableSemaphores[m_CurrentFrame], m_ComputeTimeline};
+	VkPipelineStageFlags waitStages[] = {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_VERTEX_SHADER_BIT};
+	// The value of the binary acquire semaphore is ignored
+	uint64_t waitValues[] = {0, m_FrameNumber};
+	// Headless frames have no image to acquire or present, only the timelines are left
+	uint32_t firstSemaphore = m_Headless ? 1 : 0;
+	submitInfo.waitSemaphoreCount = (m_ComputePending ? 2 : 1) - firstSemaphore;
+	submitInfo.pWaitSemaphores = waitSemaphores + firstSemaphore;
+	submitInfo.pWaitDstStageMask = waitStages + firstSemaphore;
+	m_ComputePending = false;
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &m_CommandBuffers[m_CurrentFrame];
 
-	VkSemaphore signalSemaphores[] = {m_RenderFinishedSemaphores[m_CurrentFrame]};
-	submitInfo.signalSemaphoreCount = 1;
-	submitInfo.pSignalSemaphores = signalSemaphores;
-
-	if (vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, m_InFlightFences[m_CurrentFrame]) != VK_SUCCESS) {
+	// Presentation only takes binary semaphores, so the render finished one is signalled next to the timeline
+	VkSemaphore signalSemaphores[] = {m_RenderFinishedSemaphores[m_CurrentFrame], m_FrameTimeline};
+	uint64_t signalValues[] = {0, m_FrameNumber};
+	submitInfo.signalSemaphoreCount = 2 - firstSemaphore;
+	submitInfo.pSignalSemaphores = signalSemaphores + firstSemaphore;
+
+	VkTimelineSemaphoreSubmitInfoKHR timelineInfo{};
+	timelineInfo.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO_KHR;
+	timelineInfo.waitSemaphoreValueCount = submitInfo.waitSemaphoreCount;
+	timelineInfo.pWaitSemaphoreValues = waitValues + firstSemaphore;
+	timelineInfo.signalSemaphoreValueCount = submitInfo.signalSemaphoreCount;
+	timelineInfo.pSignalSemaphoreValues = signalValues + firstSemaphore;
+	submitInfo.pNext = &timelineInfo;
+
+	if (vkQueueSubmit(m_GraphicsQueue, 1, &submitInfo, VK_NULL_HANDLE) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#drawFrame]: Error: Failed to submit draw command buffer!");
 	}
+	m_FrameTimelineValues[m_CurrentFrame] = m_FrameNumber;
+
+	if (m_Headless) {
+		m_CurrentFrame = (m_CurrentFrame + 1) % m_FramesInFlight;
+		return;
+	}
 
 	VkPresentInfoKHR presentInfo{};
 	presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
@@ -177,7 +478,16 @@ void Vulkan::endDrawFrame(uint32_t* imageIndex) {
 	presentInfo.pImageIndices = imageIndex;
 	presentInfo.pResults = nullptr; // Optional
 
+	// Frame numbers only ever go up, so they double as present ids
+	VkPresentIdKHR presentId{};
+	presentId.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+	presentId.swapchainCount = 1;
+	presentId.pPresentIds = &m_FrameNumber;
+	if (m_PresentPolicy.presentWait)
+		presentInfo.pNext = &presentId;
+
 	VkResult result = vkQueuePresentKHR(m_PresentQueue, &presentInfo);
+	m_LastPresentId = m_PresentPolicy.presentWait ? m_FrameNumber : 0;
 
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || m_Invalidated) {
 		m_Invalidated = false;
@@ -186,7 +496,21 @@ void Vulkan::endDrawFrame(uint32_t* imageIndex) {
 		throw std::runtime_error("[Vulkan#drawFrame]: Error: Failed to present swap chain image!");
 	}
 
-	m_CurrentFrame = (m_CurrentFrame + 1) % g_MAX_FRAMES_IN_FLIGHT;
+	m_CurrentFrame = (m_CurrentFrame + 1) % m_FramesInFlight;
+}
+
+void Vulkan::setPresentPolicy(const PresentPolicy& policy) {
+	bool recreate = policy.mode != m_PresentPolicy.mode;
+	m_PresentPolicy = policy;
+	m_PresentPolicy.presentWait = policy.presentWait && m_Capabilities.presentWait;
+	if (recreate)
+		m_Invalidated = true;
+}
+
+bool Vulkan::waitForPresent(uint64_t presentId, uint64_t timeout) {
+	if (!m_PresentPolicy.presentWait || presentId == 0)
+		return false;
+	return pvkWaitForPresentKHR(m_Device, m_SwapChain, presentId, timeout) == VK_SUCCESS;
 }
 
 void Vulkan::createInstance() {
@@ -196,7 +520,7 @@ void Vulkan::createInstance() {
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = VK_API_VERSION_1_1;
 
 	if (g_EnableValidationLayers && !checkValidationLayerSupport()) {
 		throw std::runtime_error("[Vulkan#createInstance]: Error: Validation layers requested, but not available!");
@@ -250,16 +574,25 @@ QueueFamilyIndices Vulkan::findQueueFamilies(VkPhysicalDevice device) {
 
 	int i = 0;
 	for (const auto& queueFamily : queueFamilies) {
+		// Without a surface nothing gets presented, the graphics queue stands in for the present queue
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
+		if (m_Headless)
+			presentSupport = (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) != 0;
+		else
+			vkGetPhysicalDeviceSurfaceSupportKHR(device, i, m_Surface, &presentSupport);
 
-		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
-			indices.graphicsFamily = i;
+		if (!indices.isComplete()) {
+			if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+				indices.graphicsFamily = i;
 
-		if (presentSupport)
-			indices.presentFamily = i;
+			if (presentSupport)
+				indices.presentFamily = i;
+		}
 
-		if (indices.isComplete())
+		if ((queueFamily.queueFlags & VK_QUEUE_COMPUTE_BIT) && !(queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) && !indices.computeFamily.has_value())
+			indices.computeFamily = i;
+
+		if (indices.isComplete() && indices.computeFamily.has_value())
 			break;
 
 		i++;
@@ -278,6 +611,14 @@ VkSurfaceFormatKHR Vulkan::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFo
 }
 
 VkPresentModeKHR Vulkan::chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes) {
+	if (m_PresentPolicy.mode != VK_PRESENT_MODE_MAX_ENUM_KHR) {
+		if (std::find(availablePresentModes.begin(), availablePresentModes.end(), m_PresentPolicy.mode) != availablePresentModes.end())
+			return m_PresentPolicy.mode;
+		// Fifo is the one mode every surface has to support
+		std::cout << "[Vulkan#chooseSwapPresentMode]: Info: Present mode " << presentModeName(m_PresentPolicy.mode) << " is not supported by this surface, using fifo" << std::endl;
+		return VK_PRESENT_MODE_FIFO_KHR;
+	}
+
 	for (const auto& availablePresentMode : availablePresentModes) {
 		if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
 			return availablePresentMode;
@@ -336,17 +677,17 @@ bool Vulkan::isDeviceSuitable(VkPhysicalDevice device) {
 	QueueFamilyIndices indices = findQueueFamilies(device);
 
 	bool extensionsSupported = checkDeviceExtensionSupport(device);
-	bool swapChainAdequate = false;
-	if (extensionsSupported) {
+	// Headless runs have no surface to query, only the swap chain part is skipped for them
+	bool swapChainAdequate = m_Headless;
+	if (extensionsSupported && !m_Headless) {
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();
 	}
 
 	return
-		deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU &&
-		deviceFeatures.geometryShader &&
 		deviceFeatures.samplerAnisotropy &&
 		indices.isComplete() &&
+		extensionsSupported &&
 		swapChainAdequate;
 }
 
@@ -358,6 +699,8 @@ bool Vulkan::checkDeviceExtensionSupport(VkPhysicalDevice device) {
 	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
 
 	std::set<std::string> requiredExtensions(deviceExtensions.begin(), deviceExtensions.end());
+	if (m_Headless)
+		requiredExtensions.erase(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
 
 	for (const auto& extension : availableExtensions) {
 		requiredExtensions.erase(extension.extensionName);
@@ -375,16 +718,198 @@ void Vulkan::pickPhysicalDevice() {
 	std::vector<VkPhysicalDevice> devices(deviceCount);
 	vkEnumeratePhysicalDevices(m_Instance, &deviceCount, devices.data());
 
-	for (const auto& device : devices) {
-		if (isDeviceSuitable(device)) {
-			m_PhysicalDevice = device;
-			break;
+	// An override is either the device's index in the list below or part of its name, like "llvmpipe"
+	bool overrideIsIndex = !m_DeviceOverride.empty() && m_DeviceOverride.find_first_not_of("0123456789") == std::string::npos;
+	std::string overrideName = m_DeviceOverride;
+	std::transform(overrideName.begin(), overrideName.end(), overrideName.begin(), ::tolower);
+
+	int64_t bestScore = -1;
+	bool overrideMatched = false;
+	for (uint32_t i = 0; i < deviceCount; i++) {
+		VkPhysicalDeviceProperties deviceProperties;
+		vkGetPhysicalDeviceProperties(devices[i], &deviceProperties);
+		bool suitable = isDeviceSuitable(devices[i]);
+		int64_t score = suitable ? rateDevice(devices[i], queryCapabilities(devices[i])) : -1;
+		std::cout << "[Vulkan#pickPhysicalDevice]: Info: Device " << i << ": " << deviceProperties.deviceName << " (" << deviceTypeName(deviceProperties.deviceType) << "), ";
+		if (suitable)
+			std::cout << "score " << score << std::endl;
+		else
+			std::cout << "lacks required features" << std::endl;
+
+		if (!m_DeviceOverride.empty()) {
+			std::string name = deviceProperties.deviceName;
+			std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+			bool matches = overrideIsIndex ? std::stoul(m_DeviceOverride) == i : name.find(overrideName) != std::string::npos;
+			if (!matches || overrideMatched)
+				continue;
+			if (!suitable) {
+				throw std::runtime_error("[Vulkan#pickPhysicalDevice]: Error: Device " + std::string(deviceProperties.deviceName) + " was asked for but lacks required features!");
+			}
+			overrideMatched = true;
+			m_PhysicalDevice = devices[i];
+			continue;
+		}
+		if (score > bestScore) {
+			bestScore = score;
+			m_PhysicalDevice = devices[i];
 		}
 	}
 
+	if (!m_DeviceOverride.empty() && !overrideMatched) {
+		throw std::runtime_error("[Vulkan#pickPhysicalDevice]: Error: No device matches " + m_DeviceOverride + "!");
+	}
 	if (m_PhysicalDevice == VK_NULL_HANDLE) {
 		throw std::runtime_error("[Vulkan#pickPhysicalDevice]: Failed to find a suitable GPU!");
 	}
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(m_PhysicalDevice, &deviceProperties);
+	std::cout << "[Vulkan#pickPhysicalDevice]: Info: Using " << deviceProperties.deviceName << std::endl;
+}
+
+int64_t Vulkan::rateDevice(VkPhysicalDevice device, const DeviceCapabilities& capabilities) {
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+
+	// The kind of device dominates, a discrete GPU beats an integrated one whatever either supports.
+	// Kinds are further apart than memory and features can add up to, at most 8192 + 5350
+	int64_t score = 0;
+	switch (deviceProperties.deviceType) {
+		case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU: score = 4000000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU: score = 3000000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU: score = 2000000; break;
+		case VK_PHYSICAL_DEVICE_TYPE_CPU: score = 1000000; break;
+		default: break;
+	}
+
+	// Memory breaks ties between devices of the same kind, capped at 32 GiB
+	score += static_cast<int64_t>(std::min<uint64_t>(capabilities.deviceLocalMemory >> 20, 32768) / 4);
+
+	// Then the optional paths, by how much the renderer gains from them
+	if (capabilities.extendedDynamicState)
+		score += 2000;
+	if (capabilities.asyncCompute)
+		score += 1500;
+	if (capabilities.descriptorIndexing)
+		score += 500;
+	if (capabilities.hostImageCopy)
+		score += 500;
+	if (capabilities.presentWait)
+		score += 500;
+	if (capabilities.dedicatedTransfer)
+		score += 250;
+	if (capabilities.pipelineStatisticsQuery)
+		score += 100;
+	return score;
+}
+
+DeviceCapabilities Vulkan::queryCapabilities(VkPhysicalDevice device) {
+	DeviceCapabilities capabilities;
+
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures{};
+	extendedDynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+
+	VkPhysicalDeviceFeatures2 features{};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &extendedDynamicStateFeatures;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures{};
+	timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timelineSemaphoreFeatures.pNext = extendedDynamicStateFeatures.pNext;
+	extendedDynamicStateFeatures.pNext = &timelineSemaphoreFeatures;
+
+	// The feature structs of extensions the device does not have can not be chained
+	bool descriptorIndexingExtension = hasDeviceExtension(device, VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME);
+	VkPhysicalDeviceDescriptorIndexingFeaturesEXT descriptorIndexingFeatures{};
+	descriptorIndexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+	if (descriptorIndexingExtension) {
+		descriptorIndexingFeatures.pNext = timelineSemaphoreFeatures.pNext;
+		timelineSemaphoreFeatures.pNext = &descriptorIndexingFeatures;
+	}
+
+	bool presentWaitExtensions = !m_Headless && hasDeviceExtension(device, VK_KHR_PRESENT_ID_EXTENSION_NAME) && hasDeviceExtension(device, VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+	presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+	presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+	if (presentWaitExtensions) {
+		presentWaitFeatures.pNext = timelineSemaphoreFeatures.pNext;
+		presentIdFeatures.pNext = &presentWaitFeatures;
+		timelineSemaphoreFeatures.pNext = &presentIdFeatures;
+	}
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	capabilities.extendedDynamicState = extendedDynamicStateFeatures.extendedDynamicState;
+	capabilities.pipelineStatisticsQuery = features.features.pipelineStatisticsQuery;
+	capabilities.inheritedQueries = features.features.inheritedQueries;
+	capabilities.asyncCompute = findQueueFamilies(device).computeFamily.has_value();
+	capabilities.presentWait = presentWaitExtensions && presentIdFeatures.presentId && presentWaitFeatures.presentWait;
+	capabilities.timelineSemaphore = timelineSemaphoreFeatures.timelineSemaphore;
+	capabilities.descriptorIndexing = descriptorIndexingExtension &&
+		descriptorIndexingFeatures.runtimeDescriptorArray &&
+		descriptorIndexingFeatures.descriptorBindingPartiallyBound &&
+		descriptorIndexingFeatures.shaderSampledImageArrayNonUniformIndexing;
+	// Only whether it is advertised, its feature struct is newer than the headers this builds against
+	capabilities.hostImageCopy = hasDeviceExtension(device, "VK_EXT_host_image_copy");
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+	capabilities.cpuDevice = deviceProperties.deviceType == VK_PHYSICAL_DEVICE_TYPE_CPU;
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+	for (const auto& queueFamily : queueFamilies) {
+		if ((queueFamily.queueFlags & VK_QUEUE_TRANSFER_BIT) && !(queueFamily.queueFlags & (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT)))
+			capabilities.dedicatedTransfer = true;
+	}
+
+	VkPhysicalDeviceMemoryProperties memProperties;
+	vkGetPhysicalDeviceMemoryProperties(device, &memProperties);
+	for (uint32_t i = 0; i < memProperties.memoryHeapCount; i++) {
+		if (memProperties.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT)
+			capabilities.deviceLocalMemory += memProperties.memoryHeaps[i].size;
+	}
+	return capabilities;
+}
+
+void Vulkan::queryDeviceCapabilities() {
+	m_Capabilities = queryCapabilities(m_PhysicalDevice);
+
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Extended dynamic state: " << m_Capabilities.extendedDynamicState << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Pipeline statistics query: " << m_Capabilities.pipelineStatisticsQuery << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Async compute: " << m_Capabilities.asyncCompute << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: CPU device: " << m_Capabilities.cpuDevice << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Present wait: " << m_Capabilities.presentWait << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Timeline semaphores: " << m_Capabilities.timelineSemaphore << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Descriptor indexing: " << m_Capabilities.descriptorIndexing << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Host image copy: " << m_Capabilities.hostImageCopy << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Dedicated transfer queue: " << m_Capabilities.dedicatedTransfer << std::endl;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Debug: Device local memory: " << (m_Capabilities.deviceLocalMemory >> 20) << " MiB" << std::endl;
+
+	// A software rasterizer runs shaders far slower than native code, so skinning moves to the application there
+	if (m_Skinning == SKINNING_AUTO)
+		m_Skinning = m_Capabilities.cpuDevice ? SKINNING_CPU : SKINNING_COMPUTE;
+	std::cout << "[Vulkan#queryDeviceCapabilities]: Info: Skinning in the " << (m_Skinning == SKINNING_CPU ? "application" : m_Skinning == SKINNING_COMPUTE ? "compute shader" : "vertex shader") << std::endl;
+
+	// Without a dedicated queue the deformation pass is recorded in front of the render pass instead
+	m_AsyncCompute = m_AsyncCompute && m_Skinning == SKINNING_COMPUTE && m_Capabilities.asyncCompute;
+
+	if (m_PresentPolicy.presentWait && !m_Capabilities.presentWait) {
+		std::cout << "[Vulkan#queryDeviceCapabilities]: Info: Present wait was requested but is not supported by this device" << std::endl;
+		m_PresentPolicy.presentWait = false;
+	}
+
+	if (m_CollectPipelineStatistics && !m_Capabilities.pipelineStatisticsQuery) {
+		std::cout << "[Vulkan#queryDeviceCapabilities]: Info: Pipeline statistics were requested but are not supported by this device" << std::endl;
+		m_CollectPipelineStatistics = false;
+	}
+
+	if (m_ReuseCommandBuffers && m_CollectPipelineStatistics && !m_Capabilities.inheritedQueries) {
+		std::cout << "[Vulkan#queryDeviceCapabilities]: Info: Pipeline statistics can not be collected across secondary command buffers on this device, recording every frame" << std::endl;
+		m_ReuseCommandBuffers = false;
+	}
 }
 
 void Vulkan::createLogicalDevice() {
@@ -392,6 +917,8 @@ void Vulkan::createLogicalDevice() {
 
 	std::vector<VkDeviceQueueCreateInfo> queueCreateInfos{};
 	std::set<uint32_t> uniqueQueueFamilies = {indices.graphicsFamily.value(), indices.presentFamily.value()};
+	if (m_AsyncCompute)
+		uniqueQueueFamilies.insert(indices.computeFamily.value());
 
 	float queuePriority = 1.0f;
 	for (uint32_t queueFamily : uniqueQueueFamilies) {
@@ -405,6 +932,8 @@ void Vulkan::createLogicalDevice() {
 
 	VkPhysicalDeviceFeatures deviceFeatures{};
 	deviceFeatures.samplerAnisotropy = VK_TRUE;
+	deviceFeatures.pipelineStatisticsQuery = m_CollectPipelineStatistics ? VK_TRUE : VK_FALSE;
+	deviceFeatures.inheritedQueries = m_CollectPipelineStatistics && m_ReuseCommandBuffers ? VK_TRUE : VK_FALSE;
 
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
@@ -413,8 +942,40 @@ void Vulkan::createLogicalDevice() {
 
 	createInfo.pEnabledFeatures = &deviceFeatures;
 
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+	VkPhysicalDeviceExtendedDynamicStateFeaturesEXT extendedDynamicStateFeatures{};
+	extendedDynamicStateFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTENDED_DYNAMIC_STATE_FEATURES_EXT;
+	extendedDynamicStateFeatures.extendedDynamicState = m_Capabilities.extendedDynamicState;
+	createInfo.pNext = &extendedDynamicStateFeatures;
+
+	VkPhysicalDeviceTimelineSemaphoreFeaturesKHR timelineSemaphoreFeatures{};
+	timelineSemaphoreFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_TIMELINE_SEMAPHORE_FEATURES_KHR;
+	timelineSemaphoreFeatures.timelineSemaphore = VK_TRUE;
+	extendedDynamicStateFeatures.pNext = &timelineSemaphoreFeatures;
+
+	VkPhysicalDeviceSynchronization2FeaturesKHR synchronization2Features{};
+	synchronization2Features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SYNCHRONIZATION_2_FEATURES_KHR;
+	synchronization2Features.synchronization2 = VK_TRUE;
+	timelineSemaphoreFeatures.pNext = &synchronization2Features;
+
+	// Enabled whenever the device has them, so setPresentPolicy can turn present wait on later
+	std::vector<const char*> extensions = deviceExtensions;
+	if (m_Headless)
+		extensions.erase(std::find(extensions.begin(), extensions.end(), std::string(VK_KHR_SWAPCHAIN_EXTENSION_NAME)));
+	VkPhysicalDevicePresentIdFeaturesKHR presentIdFeatures{};
+	presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+	presentIdFeatures.presentId = VK_TRUE;
+	VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+	presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+	presentWaitFeatures.presentWait = VK_TRUE;
+	if (m_Capabilities.presentWait) {
+		extensions.push_back(VK_KHR_PRESENT_ID_EXTENSION_NAME);
+		extensions.push_back(VK_KHR_PRESENT_WAIT_EXTENSION_NAME);
+		synchronization2Features.pNext = &presentIdFeatures;
+		presentIdFeatures.pNext = &presentWaitFeatures;
+	}
+
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+	createInfo.ppEnabledExtensionNames = extensions.data();
 
 	if (g_EnableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(validationLayers.size());
@@ -429,6 +990,32 @@ void Vulkan::createLogicalDevice() {
 
 	vkGetDeviceQueue(m_Device, indices.graphicsFamily.value(), 0, &m_GraphicsQueue);
 	vkGetDeviceQueue(m_Device, indices.presentFamily.value(), 0, &m_PresentQueue);
+	if (m_AsyncCompute)
+		vkGetDeviceQueue(m_Device, indices.computeFamily.value(), 0, &m_ComputeQueue);
+}
+
+void Vulkan::loadDeviceFunctions() {
+	if (m_Capabilities.extendedDynamicState) {
+		pvkCmdSetCullModeEXT = (PFN_vkCmdSetCullModeEXT) vkGetDeviceProcAddr(m_Device, "vkCmdSetCullModeEXT");
+		pvkCmdSetDepthWriteEnableEXT = (PFN_vkCmdSetDepthWriteEnableEXT) vkGetDeviceProcAddr(m_Device, "vkCmdSetDepthWriteEnableEXT");
+		pvkCmdSetDepthCompareOpEXT = (PFN_vkCmdSetDepthCompareOpEXT) vkGetDeviceProcAddr(m_Device, "vkCmdSetDepthCompareOpEXT");
+		m_Capabilities.extendedDynamicState = pvkCmdSetCullModeEXT != nullptr && pvkCmdSetDepthWriteEnableEXT != nullptr && pvkCmdSetDepthCompareOpEXT != nullptr;
+	}
+
+	if (m_Capabilities.presentWait) {
+		pvkWaitForPresentKHR = (PFN_vkWaitForPresentKHR) vkGetDeviceProcAddr(m_Device, "vkWaitForPresentKHR");
+		m_Capabilities.presentWait = pvkWaitForPresentKHR != nullptr;
+		m_PresentPolicy.presentWait = m_PresentPolicy.presentWait && m_Capabilities.presentWait;
+	}
+
+	pvkWaitSemaphoresKHR = (PFN_vkWaitSemaphoresKHR) vkGetDeviceProcAddr(m_Device, "vkWaitSemaphoresKHR");
+	if (pvkWaitSemaphoresKHR == nullptr) {
+		throw std::runtime_error("[Vulkan#loadDeviceFunctions]: Error: Failed to load vkWaitSemaphoresKHR!");
+	}
+	pvkCmdPipelineBarrier2KHR = (PFN_vkCmdPipelineBarrier2KHR) vkGetDeviceProcAddr(m_Device, "vkCmdPipelineBarrier2KHR");
+	if (pvkCmdPipelineBarrier2KHR == nullptr) {
+		throw std::runtime_error("[Vulkan#loadDeviceFunctions]: Error: Failed to load vkCmdPipelineBarrier2KHR!");
+	}
 }
 
 void Vulkan::createSwapChain() {
@@ -437,6 +1024,9 @@ void Vulkan::createSwapChain() {
 	VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(swapChainSupport.formats);
 	VkPresentModeKHR presentMode = chooseSwapPresentMode(swapChainSupport.presentModes);
 	VkExtent2D extent = chooseSwapExtent(swapChainSupport.capabilities);
+	if (presentMode != m_PresentMode)
+		std::cout << "[Vulkan#createSwapChain]: Info: Presenting with " << presentModeName(presentMode) << std::endl;
+	m_PresentMode = presentMode;
 
 	m_SwapChainImageFormat = surfaceFormat.format;
 	m_SwapChainExtent = extent;
@@ -457,6 +1047,17 @@ void Vulkan::createSwapChain() {
 	createInfo.imageExtent = extent;
 	createInfo.imageArrayLayers = 1;
 	createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
+	if (m_ReadbackConsumer && m_SwapChain == VK_NULL_HANDLE) {
+		// Copies are taken byte for byte, so only plain 8 bit colour can be handed out
+		bool plainFormat = surfaceFormat.format == VK_FORMAT_B8G8R8A8_SRGB || surfaceFormat.format == VK_FORMAT_B8G8R8A8_UNORM ||
+			surfaceFormat.format == VK_FORMAT_R8G8B8A8_SRGB || surfaceFormat.format == VK_FORMAT_R8G8B8A8_UNORM;
+		if (!plainFormat || !(swapChainSupport.capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_SRC_BIT)) {
+			std::cout << "[Vulkan#createSwapChain]: Info: The swap chain of this surface can not be read back, frames will not be captured" << std::endl;
+			m_ReadbackConsumer = nullptr;
+		}
+	}
+	if (m_ReadbackConsumer)
+		createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
 
 	QueueFamilyIndices indices = findQueueFamilies(m_PhysicalDevice);
 	uint32_t queueFamilyIndices[] = {indices.graphicsFamily.value(), indices.presentFamily.value()};
@@ -482,9 +1083,8 @@ void Vulkan::createSwapChain() {
 	// Ignore pixels that aren't visible (f.x. when behind other windows)
 	createInfo.clipped = VK_TRUE;
 
-	// If swap chain becomes invalid/unoptimised, it needs to be recreated from scratch and given as a reference in the field below.
-	// However, we're not going to care about that for now
-	createInfo.oldSwapchain = VK_NULL_HANDLE;
+	// Lets the presentation engine hand resources over from the swap chain being replaced, which stays valid until it is retired
+	createInfo.oldSwapchain = m_SwapChain;
 
 	if (vkCreateSwapchainKHR(m_Device, &createInfo, nullptr, &m_SwapChain) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#createSwapChain]: Error: Failed to create swap chain!");
@@ -496,10 +1096,6 @@ void Vulkan::createSwapChain() {
 }
 
 void Vulkan::cleanupSwapChain() {
-	vkDestroyImageView(m_Device, m_DepthImageView, nullptr);
-	vkDestroyImage(m_Device, m_DepthImage, nullptr);
-	vkFreeMemory(m_Device, m_DepthImageMemory, nullptr);
-
 	for (size_t i = 0; i < m_SwapChainFramebuffers.size(); i++) {
 		vkDestroyFramebuffer(m_Device, m_SwapChainFramebuffers[i], nullptr);
 	}
@@ -508,18 +1104,106 @@ void Vulkan::cleanupSwapChain() {
 		vkDestroyImageView(m_Device, m_SwapChainImageViews[i], nullptr);
 	}
 
+	if (m_Headless) {
+		for (size_t i = 0; i < m_SwapChainImages.size(); i++) {
+			vkDestroyImage(m_Device, m_SwapChainImages[i], nullptr);
+			vkFreeMemory(m_Device, m_OffscreenImagesMemory[i], nullptr);
+		}
+		return;
+	}
 	vkDestroySwapchainKHR(m_Device, m_SwapChain, nullptr);
 }
 
-void Vulkan::recreateSwapChain() {
-	vkDeviceWaitIdle(m_Device);
+void Vulkan::createOffscreenImages() {
+	// Stand-ins for the swap chain images, one per frame slot so the frame timeline also guards them
+	m_SwapChainImageFormat = VK_FORMAT_B8G8R8A8_SRGB;
+	m_SwapChainExtent.width = static_cast<uint32_t>(m_SurfaceWidth);
+	m_SwapChainExtent.height = static_cast<uint32_t>(m_SurfaceHeight);
+	m_SwapChainImages.resize(m_FramesInFlight);
+	m_OffscreenImagesMemory.resize(m_FramesInFlight);
+	for (uint32_t i = 0; i < m_FramesInFlight; i++) {
+		createImage(m_SwapChainExtent.width, m_SwapChainExtent.height, m_SwapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_SwapChainImages[i], m_OffscreenImagesMemory[i]);
+	}
+	std::cout << "[Vulkan#createOffscreenImages]: Info: Rendering headless at " << m_SwapChainExtent.width << "x" << m_SwapChainExtent.height << std::endl;
+}
 
-	cleanupSwapChain();
+void Vulkan::recreateSwapChain() {
+	// Frames still in flight keep rendering to the old resources, so they are only set aside here instead of waiting for the device.
+	// The frame timeline only says when rendering is done. With present wait the last present to the old swap chain tells
+	// when the presentation engine is done with it too. Without it nothing does, so the old chain is kept until every
+	// frame in flight and every one of its images could have been presented after it
+	RetiredSwapChain retired;
+	retired.presentId = m_LastPresentId;
+	if (retired.presentId != 0)
+		retired.frameNumber = m_FrameNumber;
+	else
+		retired.frameNumber = m_FrameNumber + m_FramesInFlight + m_SwapChainImages.size();
+	retired.swapChain = m_SwapChain;
+	retired.imageViews = std::move(m_SwapChainImageViews);
+	retired.framebuffers = std::move(m_SwapChainFramebuffers);
+	m_SwapChainImageViews.clear();
+	m_SwapChainFramebuffers.clear();
+	// Present ids count per swap chain, the new one has not presented anything yet
+	m_LastPresentId = 0;
 
 	createSwapChain();
 	createImageViews();
-	createDepthResources();
+	// The viewport is baked into the scene commands, the render pass and pipelines stay the same
+	invalidateSceneCommands();
+
+	// A swap chain that only shrank keeps the depth buffer it had
+	m_FrameGraph.resize(*this, m_SwapChainExtent, retired.transients);
 	createFramebuffers();
+
+	m_RetiredSwapChains.push_back(std::move(retired));
+}
+
+void Vulkan::destroyRetiredSwapChain(const RetiredSwapChain& retired) {
+	for (VkFramebuffer framebuffer : retired.framebuffers) {
+		vkDestroyFramebuffer(m_Device, framebuffer, nullptr);
+	}
+	for (VkImageView imageView : retired.imageViews) {
+		vkDestroyImageView(m_Device, imageView, nullptr);
+	}
+	RenderGraph::destroyTransients(m_Device, retired.transients);
+	vkDestroySwapchainKHR(m_Device, retired.swapChain, nullptr);
+}
+
+void Vulkan::releaseRetiredSwapChains(uint64_t completedFrame) {
+	// Retired in order, so everything that is done sits at the front
+	size_t released = 0;
+	while (released < m_RetiredSwapChains.size() && m_RetiredSwapChains[released].frameNumber <= completedFrame) {
+		RetiredSwapChain& retired = m_RetiredSwapChains[released];
+		if (retired.presentId != 0) {
+			// Only polled, the frame loop never waits for an old swap chain
+			VkResult result = pvkWaitForPresentKHR(m_Device, retired.swapChain, retired.presentId, 0);
+			if (result == VK_TIMEOUT)
+				break;
+			if (result != VK_SUCCESS) {
+				// Lost or out of date, its presents can no longer be tracked and it gets the conservative delay instead
+				retired.presentId = 0;
+				retired.frameNumber = m_FrameNumber + m_FramesInFlight + retired.imageViews.size();
+				break;
+			}
+		}
+		destroyRetiredSwapChain(retired);
+		released++;
+	}
+	m_RetiredSwapChains.erase(m_RetiredSwapChains.begin(), m_RetiredSwapChains.begin() + released);
+}
+
+void Vulkan::retireBuffer(VkBuffer buffer, VkDeviceMemory memory) {
+	m_RetiredBuffers.push_back({m_FrameNumber, buffer, memory});
+}
+
+void Vulkan::releaseRetiredBuffers(uint64_t completedFrame) {
+	size_t released = 0;
+	while (released < m_RetiredBuffers.size() && m_RetiredBuffers[released].frameNumber <= completedFrame) {
+		vkDestroyBuffer(m_Device, m_RetiredBuffers[released].buffer, nullptr);
+		vkFreeMemory(m_Device, m_RetiredBuffers[released].memory, nullptr);
+		released++;
+	}
+	m_RetiredBuffers.erase(m_RetiredBuffers.begin(), m_RetiredBuffers.begin() + released);
 }
 
 VkImageView Vulkan::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags) {
@@ -557,8 +1241,9 @@ void Vulkan::createRenderPass() {
 	colourAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
 	colourAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colourAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	// The frame graph does the layout transitions around the render pass
+	colourAttachment.initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+	colourAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentDescription depthAttachment{};
 	depthAttachment.format = findDepthFormat();
@@ -567,7 +1252,7 @@ void Vulkan::createRenderPass() {
 	depthAttachment.storeOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	depthAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	depthAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+	depthAttachment.initialLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 	depthAttachment.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
 
 	VkAttachmentReference colourAttachmentRef{};
@@ -584,14 +1269,7 @@ void Vulkan::createRenderPass() {
 	subpass.pColorAttachments = &colourAttachmentRef;
 	subpass.pDepthStencilAttachment = &depthAttachmentRef;
 
-	VkSubpassDependency dependency{};
-	dependency.srcSubpass = VK_SUBPASS_EXTERNAL;
-	dependency.dstSubpass = 0;
-	dependency.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.srcAccessMask = 0;
-	dependency.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-	dependency.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-
+	// No subpass dependencies, the frame graph puts the barriers in front of the render pass
 	std::array<VkAttachmentDescription, 2> attachments = {colourAttachment, depthAttachment};
 	VkRenderPassCreateInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
@@ -599,14 +1277,83 @@ void Vulkan::createRenderPass() {
 	renderPassInfo.pAttachments = attachments.data();
 	renderPassInfo.subpassCount = 1;
 	renderPassInfo.pSubpasses = &subpass;
-	renderPassInfo.dependencyCount = 1;
-	renderPassInfo.pDependencies = &dependency;
+	renderPassInfo.dependencyCount = 0;
 
 	if (vkCreateRenderPass(m_Device, &renderPassInfo, nullptr, &m_RenderPass) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#createRenderPass]: Error: Failed to create render pass!");
 	}
 }
 
+void Vulkan::createPipelineCache() {
+	std::vector<char> cacheData;
+	std::ifstream file(g_PIPELINE_CACHE_FILE, std::ios::ate | std::ios::binary);
+	if (file.is_open()) {
+		cacheData.resize((size_t) file.tellg());
+		file.seekg(0);
+		file.read(cacheData.data(), cacheData.size());
+		file.close();
+	}
+
+	// Drivers should reject foreign cache data on their own, but not all of them do it gracefully
+	if (!cacheData.empty()) {
+		VkPhysicalDeviceProperties properties;
+		vkGetPhysicalDeviceProperties(m_PhysicalDevice, &properties);
+
+		VkPipelineCacheHeaderVersionOne header{};
+		bool valid = cacheData.size() >= sizeof(header);
+		if (valid) {
+			memcpy(&header, cacheData.data(), sizeof(header));
+			valid = header.headerSize >= sizeof(header) &&
+				header.headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+				header.vendorID == properties.vendorID &&
+				header.deviceID == properties.deviceID &&
+				memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0;
+		}
+
+		if (!valid) {
+			std::cout << "[Vulkan#createPipelineCache]: Info: Discarding pipeline cache made by a different device or driver" << std::endl;
+			cacheData.clear();
+		}
+	}
+
+	VkPipelineCacheCreateInfo createInfo{};
+	createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	createInfo.initialDataSize = cacheData.size();
+	createInfo.pInitialData = cacheData.empty() ? nullptr : cacheData.data();
+
+	if (vkCreatePipelineCache(m_Device, &createInfo, nullptr, &m_PipelineCache) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createPipelineCache]: Error: Failed to create pipeline cache!");
+	}
+
+	m_PipelineCacheWarm = !cacheData.empty();
+}
+
+void Vulkan::savePipelineCache() {
+	size_t dataSize = 0;
+	if (vkGetPipelineCacheData(m_Device, m_PipelineCache, &dataSize, nullptr) != VK_SUCCESS || dataSize == 0) {
+		return;
+	}
+	std::vector<char> cacheData(dataSize);
+	if (vkGetPipelineCacheData(m_Device, m_PipelineCache, &dataSize, cacheData.data()) != VK_SUCCESS) {
+		return;
+	}
+
+	// Write next to the real file and rename over it, so a crash halfway never leaves a truncated cache behind
+	std::string tempFile = std::string(g_PIPELINE_CACHE_FILE) + ".tmp";
+	std::ofstream file(tempFile, std::ios::binary | std::ios::trunc);
+	if (!file.is_open()) {
+		std::cerr << "[Vulkan#savePipelineCache]: Warning: Failed to open " << tempFile << " for writing" << std::endl;
+		return;
+	}
+	file.write(cacheData.data(), dataSize);
+	file.close();
+
+	if (!file || std::rename(tempFile.c_str(), g_PIPELINE_CACHE_FILE) != 0) {
+		std::cerr << "[Vulkan#savePipelineCache]: Warning: Failed to write pipeline cache" << std::endl;
+		std::remove(tempFile.c_str());
+	}
+}
+
 VkShaderModule Vulkan::createShaderModule(const std::vector<char>& code) {
 	VkShaderModuleCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
@@ -634,6 +1381,26 @@ void Vulkan::createGraphicsPipeline(const std::vector<VkDescriptorSetLayout>& de
 	vertShaderStageInfo.module = vertShaderModule;
 	vertShaderStageInfo.pName = "main";
 
+	// Vertex shaders either read the output of the deformation pass or deform by themselves, with either palette layout
+	std::array<VkBool32, 2> vertConstants = {
+		m_Skinning != SKINNING_VERTEX_SHADER ? VK_TRUE : VK_FALSE,
+		m_DualQuaternionSkinning ? VK_TRUE : VK_FALSE
+	};
+	std::array<VkSpecializationMapEntry, 2> vertEntries{};
+	vertEntries[0].constantID = 1;
+	vertEntries[0].offset = 0;
+	vertEntries[0].size = sizeof(VkBool32);
+	vertEntries[1].constantID = 2;
+	vertEntries[1].offset = sizeof(VkBool32);
+	vertEntries[1].size = sizeof(VkBool32);
+
+	VkSpecializationInfo vertSpecializationInfo{};
+	vertSpecializationInfo.mapEntryCount = static_cast<uint32_t>(vertEntries.size());
+	vertSpecializationInfo.pMapEntries = vertEntries.data();
+	vertSpecializationInfo.dataSize = sizeof(vertConstants);
+	vertSpecializationInfo.pData = vertConstants.data();
+	vertShaderStageInfo.pSpecializationInfo = &vertSpecializationInfo;
+
 	VkPipelineShaderStageCreateInfo fragShaderStageInfo{};
 	fragShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
 	fragShaderStageInfo.stage = VK_SHADER_STAGE_FRAGMENT_BIT;
@@ -659,6 +1426,15 @@ void Vulkan::createGraphicsPipeline(const std::vector<VkDescriptorSetLayout>& de
 		VK_DYNAMIC_STATE_SCISSOR
 	};
 
+	// Cull mode and depth state are set while recording when possible, so double sided materials and
+	// the depth pre-pass don't need their own pipelines
+	bool dynamicCulling = m_Capabilities.extendedDynamicState;
+	if (dynamicCulling) {
+		dynamicStates.push_back(VK_DYNAMIC_STATE_CULL_MODE_EXT);
+		dynamicStates.push_back(VK_DYNAMIC_STATE_DEPTH_WRITE_ENABLE_EXT);
+		dynamicStates.push_back(VK_DYNAMIC_STATE_DEPTH_COMPARE_OP_EXT);
+	}
+
 	VkPipelineDynamicStateCreateInfo dynamicState{};
 	dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
 	dynamicState.dynamicStateCount = static_cast<uint32_t>(dynamicStates.size());
@@ -757,7 +1533,6 @@ void Vulkan::createGraphicsPipeline(const std::vector<VkDescriptorSetLayout>& de
 	VkGraphicsPipelineCreateInfo pipelineInfo{};
 	pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
 	pipelineInfo.stageCount = 2;
-	pipelineInfo.pStages = shaderStages;
 	pipelineInfo.pVertexInputState = &vertexInputInfo;
 	pipelineInfo.pInputAssemblyState = &inputAssembly;
 	pipelineInfo.pViewportState = &viewportState;
@@ -773,20 +1548,223 @@ void Vulkan::createGraphicsPipeline(const std::vector<VkDescriptorSetLayout>& de
 	pipelineInfo.basePipelineHandle = VK_NULL_HANDLE; // Optional
 	pipelineInfo.basePipelineIndex = -1; // Optional
 
-	if (vkCreateGraphicsPipelines(m_Device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &m_GraphicsPipeline) != VK_SUCCESS) {
+	// ------------ Variants ------------
+	// The EQUAL depth test is only needed by opaque geometry that was laid down by the depth pre-pass
+	std::vector<uint32_t> variants;
+	for (uint32_t alphaMode = 0; alphaMode < g_ALPHA_MODE_COUNT; alphaMode++) {
+		bool hasDepthEqual = !dynamicCulling && alphaMode == VRM::ALPHA_MODE_OPAQUE;
+		for (uint32_t depthEqual = 0; depthEqual <= (hasDepthEqual ? 1u : 0u); depthEqual++) {
+			variants.push_back(pipelineVariantIndex(alphaMode, false, depthEqual));
+			if (!dynamicCulling)
+				variants.push_back(pipelineVariantIndex(alphaMode, true, depthEqual));
+		}
+	}
+
+	// The alpha mode is a specialization constant, so only the MASK variant compiles the discard
+	VkSpecializationMapEntry alphaModeEntry{};
+	alphaModeEntry.constantID = 0;
+	alphaModeEntry.offset = 0;
+	alphaModeEntry.size = sizeof(int32_t);
+
+	size_t variantCount = variants.size();
+	std::vector<int32_t> alphaModes(variantCount);
+	std::vector<VkSpecializationInfo> specializationInfos(variantCount);
+	std::vector<std::array<VkPipelineShaderStageCreateInfo, 2>> variantStages(variantCount);
+	std::vector<VkPipelineRasterizationStateCreateInfo> rasterizers(variantCount, rasterizer);
+	std::vector<VkPipelineColorBlendAttachmentState> colourBlendAttachments(variantCount, colourBlendAttachment);
+	std::vector<VkPipelineColorBlendStateCreateInfo> colourBlendings(variantCount, colourBlending);
+	std::vector<VkPipelineDepthStencilStateCreateInfo> depthStencils(variantCount, depthStencil);
+	std::vector<VkGraphicsPipelineCreateInfo> pipelineInfos(variantCount, pipelineInfo);
+
+	for (size_t i = 0; i < variantCount; i++) {
+		alphaModes[i] = variants[i] / 4;
+		bool depthEqual = (variants[i] / 2) % 2 == 1;
+		bool doubleSided = variants[i] % 2 == 1;
+		bool blend = alphaModes[i] == VRM::ALPHA_MODE_BLEND;
+
+		specializationInfos[i].mapEntryCount = 1;
+		specializationInfos[i].pMapEntries = &alphaModeEntry;
+		specializationInfos[i].dataSize = sizeof(int32_t);
+		specializationInfos[i].pData = &alphaModes[i];
+
+		variantStages[i] = {shaderStages[0], shaderStages[1]};
+		variantStages[i][1].pSpecializationInfo = &specializationInfos[i];
+
+		rasterizers[i].cullMode = doubleSided ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+		colourBlendAttachments[i].blendEnable = blend ? VK_TRUE : VK_FALSE;
+		colourBlendings[i].pAttachments = &colourBlendAttachments[i];
+		depthStencils[i].depthWriteEnable = blend || depthEqual ? VK_FALSE : VK_TRUE;
+		depthStencils[i].depthCompareOp = depthEqual ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS;
+
+		pipelineInfos[i].pStages = variantStages[i].data();
+		pipelineInfos[i].pRasterizationState = &rasterizers[i];
+		pipelineInfos[i].pColorBlendState = &colourBlendings[i];
+		pipelineInfos[i].pDepthStencilState = &depthStencils[i];
+	}
+
+	// ------------ Depth pre-pass ------------
+	// Vertex stage only, fed by the position-only stream. The colour attachment stays bound but is never written
+	auto depthShaderCode = readFile("depth_vert.spv");
+	VkShaderModule depthShaderModule = createShaderModule(depthShaderCode);
+
+	VkPipelineShaderStageCreateInfo depthShaderStageInfo = vertShaderStageInfo;
+	depthShaderStageInfo.module = depthShaderModule;
+
+	auto depthBindingDescription = DepthVertex::getBindingDescription();
+	auto depthAttributeDescriptions = DepthVertex::getAttributeDescriptions();
+
+	VkPipelineVertexInputStateCreateInfo depthVertexInputInfo = vertexInputInfo;
+	depthVertexInputInfo.vertexAttributeDescriptionCount = static_cast<uint32_t>(depthAttributeDescriptions.size());
+	depthVertexInputInfo.pVertexBindingDescriptions = &depthBindingDescription;
+	depthVertexInputInfo.pVertexAttributeDescriptions = depthAttributeDescriptions.data();
+
+	VkPipelineColorBlendAttachmentState depthColourBlendAttachment{};
+	depthColourBlendAttachment.colorWriteMask = 0;
+	depthColourBlendAttachment.blendEnable = VK_FALSE;
+
+	VkPipelineColorBlendStateCreateInfo depthColourBlending = colourBlending;
+	depthColourBlending.pAttachments = &depthColourBlendAttachment;
+
+	size_t prepassCount = dynamicCulling ? 1 : 2;
+	std::vector<VkPipelineRasterizationStateCreateInfo> depthRasterizers(prepassCount, rasterizer);
+	for (size_t i = 0; i < prepassCount; i++) {
+		depthRasterizers[i].cullMode = i == 1 ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT;
+
+		VkGraphicsPipelineCreateInfo depthPipelineInfo = pipelineInfo;
+		depthPipelineInfo.stageCount = 1;
+		depthPipelineInfo.pStages = &depthShaderStageInfo;
+		depthPipelineInfo.pVertexInputState = &depthVertexInputInfo;
+		depthPipelineInfo.pRasterizationState = &depthRasterizers[i];
+		depthPipelineInfo.pColorBlendState = &depthColourBlending;
+		pipelineInfos.push_back(depthPipelineInfo);
+	}
+
+	std::vector<VkPipeline> pipelines(pipelineInfos.size());
+	auto startTime = std::chrono::high_resolution_clock::now();
+	if (vkCreateGraphicsPipelines(m_Device, m_PipelineCache, static_cast<uint32_t>(pipelineInfos.size()), pipelineInfos.data(), nullptr, pipelines.data()) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#createGraphicsPipeline]: Error: Failed to create graphics pipeline!");
 	}
+	auto endTime = std::chrono::high_resolution_clock::now();
+	float creationTime = std::chrono::duration<float, std::chrono::milliseconds::period>(endTime - startTime).count();
+	std::cout << "[Vulkan#createGraphicsPipeline]: Info: Creating " << pipelines.size() << " pipelines took " << creationTime << "ms (" << (m_PipelineCacheWarm ? "warm" : "cold") << " cache)" << std::endl;
+
+	for (size_t i = 0; i < variantCount; i++) {
+		m_GraphicsPipelines[variants[i]] = pipelines[i];
+	}
+	// Everything that was not created falls back to the variant whose state gets changed while recording instead
+	for (uint32_t alphaMode = 0; alphaMode < g_ALPHA_MODE_COUNT; alphaMode++) {
+		bool hasDepthEqual = !dynamicCulling && alphaMode == VRM::ALPHA_MODE_OPAQUE;
+		for (uint32_t i = 0; i < 4; i++) {
+			bool depthEqual = i / 2 == 1;
+			bool doubleSided = i % 2 == 1;
+			uint32_t index = pipelineVariantIndex(alphaMode, doubleSided, depthEqual);
+			if (m_GraphicsPipelines[index] == VK_NULL_HANDLE)
+				m_GraphicsPipelines[index] = m_GraphicsPipelines[pipelineVariantIndex(alphaMode, doubleSided && !dynamicCulling, depthEqual && hasDepthEqual)];
+		}
+	}
+
+	m_DepthPrepassPipelines[0] = pipelines[variantCount];
+	m_DepthPrepassPipelines[1] = pipelines[variantCount + prepassCount - 1];
 
+	vkDestroyShaderModule(m_Device, depthShaderModule, nullptr);
 	vkDestroyShaderModule(m_Device, fragShaderModule, nullptr);
 	vkDestroyShaderModule(m_Device, vertShaderModule, nullptr);
 }
 
+uint32_t Vulkan::pipelineVariantIndex(int alphaMode, bool doubleSided, bool depthEqual) {
+	uint32_t mode = glm::clamp(alphaMode, 0, int(g_ALPHA_MODE_COUNT) - 1);
+	return (mode * 2 + (depthEqual ? 1 : 0)) * 2 + (doubleSided ? 1 : 0);
+}
+
+void Vulkan::bindGraphicsPipeline(VkCommandBuffer commandBuffer, const VRM::Material& material) {
+	bool blend = material.alphaMode == VRM::ALPHA_MODE_BLEND;
+	// Opaque geometry was already written by the pre-pass, so only the exactly matching fragments get shaded
+	bool depthEqual = m_DepthPrepass && material.alphaMode == VRM::ALPHA_MODE_OPAQUE;
+
+	VkPipeline pipeline = m_GraphicsPipelines[pipelineVariantIndex(material.alphaMode, material.doubleSided, depthEqual)];
+	if (pipeline != m_BoundPipeline) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		m_BoundPipeline = pipeline;
+	}
+
+	if (m_Capabilities.extendedDynamicState) {
+		pvkCmdSetCullModeEXT(commandBuffer, material.doubleSided ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT);
+		pvkCmdSetDepthWriteEnableEXT(commandBuffer, blend || depthEqual ? VK_FALSE : VK_TRUE);
+		pvkCmdSetDepthCompareOpEXT(commandBuffer, depthEqual ? VK_COMPARE_OP_EQUAL : VK_COMPARE_OP_LESS);
+	}
+}
+
+void Vulkan::bindDepthPrepassPipeline(VkCommandBuffer commandBuffer, bool doubleSided) {
+	VkPipeline pipeline = m_DepthPrepassPipelines[doubleSided ? 1 : 0];
+	if (pipeline != m_BoundPipeline) {
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+		m_BoundPipeline = pipeline;
+	}
+
+	if (m_Capabilities.extendedDynamicState) {
+		pvkCmdSetCullModeEXT(commandBuffer, doubleSided ? VK_CULL_MODE_NONE : VK_CULL_MODE_BACK_BIT);
+		pvkCmdSetDepthWriteEnableEXT(commandBuffer, VK_TRUE);
+		pvkCmdSetDepthCompareOpEXT(commandBuffer, VK_COMPARE_OP_LESS);
+	}
+}
+
+void Vulkan::createComputePipeline(const std::vector<VkDescriptorSetLayout>& descriptorSetLayouts) {
+	VkPushConstantRange pushConstantRange{};
+	pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+	pushConstantRange.offset = 0;
+	pushConstantRange.size = sizeof(DeformConstants);
+
+	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+	pipelineLayoutInfo.setLayoutCount = static_cast<uint32_t>(descriptorSetLayouts.size());
+	pipelineLayoutInfo.pSetLayouts = descriptorSetLayouts.data();
+	pipelineLayoutInfo.pushConstantRangeCount = 1;
+	pipelineLayoutInfo.pPushConstantRanges = &pushConstantRange;
+
+	if (vkCreatePipelineLayout(m_Device, &pipelineLayoutInfo, nullptr, &m_ComputePipelineLayout) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createComputePipeline]: Error: Failed to create pipeline layout!");
+	}
+
+	auto compShaderCode = readFile("deform_comp.spv");
+	VkShaderModule compShaderModule = createShaderModule(compShaderCode);
+
+	VkPipelineShaderStageCreateInfo compShaderStageInfo{};
+	compShaderStageInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	compShaderStageInfo.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+	compShaderStageInfo.module = compShaderModule;
+	compShaderStageInfo.pName = "main";
+
+	VkBool32 dualQuaternion = m_DualQuaternionSkinning ? VK_TRUE : VK_FALSE;
+	VkSpecializationMapEntry dualQuaternionEntry{};
+	dualQuaternionEntry.constantID = 2;
+	dualQuaternionEntry.offset = 0;
+	dualQuaternionEntry.size = sizeof(VkBool32);
+
+	VkSpecializationInfo compSpecializationInfo{};
+	compSpecializationInfo.mapEntryCount = 1;
+	compSpecializationInfo.pMapEntries = &dualQuaternionEntry;
+	compSpecializationInfo.dataSize = sizeof(VkBool32);
+	compSpecializationInfo.pData = &dualQuaternion;
+	compShaderStageInfo.pSpecializationInfo = &compSpecializationInfo;
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage = compShaderStageInfo;
+	pipelineInfo.layout = m_ComputePipelineLayout;
+
+	if (vkCreateComputePipelines(m_Device, m_PipelineCache, 1, &pipelineInfo, nullptr, &m_DeformPipeline) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createComputePipeline]: Error: Failed to create compute pipeline!");
+	}
+
+	vkDestroyShaderModule(m_Device, compShaderModule, nullptr);
+}
+
 void Vulkan::createFramebuffers() {
 	m_SwapChainFramebuffers.resize(m_SwapChainImageViews.size());
 	for (size_t i = 0; i < m_SwapChainImageViews.size(); i++) {
 		std::array<VkImageView, 2> attachments = {
 			m_SwapChainImageViews[i],
-			m_DepthImageView
+			m_FrameGraph.getImageView(m_DepthResource)
 		};
 
 		VkFramebufferCreateInfo framebufferInfo{};
@@ -815,9 +1793,16 @@ void Vulkan::createCommandPool() {
 	if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_CommandPool) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#createCommandPool]: Error: Failed to create command pool!");
 	}
+
+	if (m_AsyncCompute) {
+		poolInfo.queueFamilyIndex = queueFamilyIndices.computeFamily.value();
+		if (vkCreateCommandPool(m_Device, &poolInfo, nullptr, &m_ComputeCommandPool) != VK_SUCCESS) {
+			throw std::runtime_error("[Vulkan#createCommandPool]: Error: Failed to create compute command pool!");
+		}
+	}
 }
 
-void Vulkan::beginRecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex) {
+void Vulkan::beginRecordCommandBuffer(VkCommandBuffer commandBuffer) {
 	VkCommandBufferBeginInfo beginInfo{};
 	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
 	beginInfo.flags = 0; // Optional
@@ -827,6 +1812,14 @@ void Vulkan::beginRecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 		throw std::runtime_error("[Vulkan#recordCommandBuffer]: Error: Failed to begin recording command buffer!");
 	}
 
+	// Queries have to be reset outside of the render pass
+	if (m_StatisticsQueryPool != VK_NULL_HANDLE)
+		vkCmdResetQueryPool(commandBuffer, m_StatisticsQueryPool, m_CurrentFrame, 1);
+}
+
+void Vulkan::beginRenderPass(uint32_t imageIndex, VkSubpassContents contents) {
+	VkCommandBuffer commandBuffer = m_CommandBuffers[m_CurrentFrame];
+
 	VkRenderPassBeginInfo renderPassInfo{};
 	renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
 	renderPassInfo.renderPass = m_RenderPass;
@@ -842,9 +1835,14 @@ void Vulkan::beginRecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 	renderPassInfo.clearValueCount = static_cast<uint32_t>(clearValues.size());
 	renderPassInfo.pClearValues = clearValues.data();
 
-	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
-	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, m_GraphicsPipeline);
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);
+	m_BoundPipeline = VK_NULL_HANDLE;
 
+	if (m_StatisticsQueryPool != VK_NULL_HANDLE)
+		vkCmdBeginQuery(commandBuffer, m_StatisticsQueryPool, m_CurrentFrame, 0);
+}
+
+void Vulkan::setViewport(VkCommandBuffer commandBuffer) {
 	VkViewport viewport{};
 	viewport.x = 0.0f;
 	viewport.y = 0.0f;
@@ -862,6 +1860,38 @@ void Vulkan::beginRecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t im
 	//pvkCmdSetDepthTestEnableEXT(commandBuffer, VK_FALSE);
 }
 
+void Vulkan::beginSceneCommands(VkCommandBuffer commandBuffer) {
+	// No framebuffer, so the same commands run inside the render pass of every swap chain image
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass = m_RenderPass;
+	inheritanceInfo.subpass = 0;
+	inheritanceInfo.framebuffer = VK_NULL_HANDLE;
+	if (m_StatisticsQueryPool != VK_NULL_HANDLE)
+		inheritanceInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+	beginInfo.pInheritanceInfo = &inheritanceInfo;
+
+	if (vkBeginCommandBuffer(commandBuffer, &beginInfo) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#beginSceneCommands]: Error: Failed to begin recording scene commands!");
+	}
+	// Bound state is not inherited from the primary command buffer
+	m_BoundPipeline = VK_NULL_HANDLE;
+	setViewport(commandBuffer);
+}
+
+void Vulkan::invalidateSceneCommands() {
+	m_SceneCommandsValid.assign(m_SceneCommandsValid.size(), false);
+}
+
+void Vulkan::invalidateSceneCommands(uint32_t frame) {
+	if (frame < m_SceneCommandsValid.size())
+		m_SceneCommandsValid[frame] = false;
+}
+
 uint32_t Vulkan::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties) {
 	VkPhysicalDeviceMemoryProperties memProperties;
 	vkGetPhysicalDeviceMemoryProperties(m_PhysicalDevice, &memProperties);
@@ -901,12 +1931,6 @@ bool Vulkan::hasStencilComponent(VkFormat format) {
 	return format == VK_FORMAT_D32_SFLOAT_S8_UINT || format == VK_FORMAT_D24_UNORM_S8_UINT;
 }
 
-void Vulkan::createDepthResources() {
-	VkFormat depthFormat = findDepthFormat();
-	createImage(m_SwapChainExtent.width, m_SwapChainExtent.height, depthFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, m_DepthImage, m_DepthImageMemory);
-	m_DepthImageView = createImageView(m_DepthImage, depthFormat, VK_IMAGE_ASPECT_DEPTH_BIT);
-}
-
 void Vulkan::createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory) {
 	VkImageCreateInfo imageInfo{};
 	imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -1053,6 +2077,44 @@ void Vulkan::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryP
 	vkBindBufferMemory(m_Device, buffer, bufferMemory, 0);
 }
 
+void Vulkan::createSharedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory) {
+	if (!m_AsyncCompute) {
+		createBuffer(size, usage, properties, buffer, bufferMemory);
+		return;
+	}
+
+	// Read or written by both the graphics and the compute queue, concurrent sharing saves the ownership transfers
+	QueueFamilyIndices indices = findQueueFamilies(m_PhysicalDevice);
+	std::array<uint32_t, 2> queueFamilies = {indices.graphicsFamily.value(), indices.computeFamily.value()};
+
+	assert(size > 0);
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size = size;
+	bufferInfo.usage = usage;
+	bufferInfo.sharingMode = VK_SHARING_MODE_CONCURRENT;
+	bufferInfo.queueFamilyIndexCount = static_cast<uint32_t>(queueFamilies.size());
+	bufferInfo.pQueueFamilyIndices = queueFamilies.data();
+
+	if (vkCreateBuffer(m_Device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createSharedBuffer]: Error: Failed to create buffer!");
+	}
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(m_Device, buffer, &memRequirements);
+
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize = memRequirements.size;
+	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
+
+	if (vkAllocateMemory(m_Device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createSharedBuffer]: Error: Failed to allocate buffer memory!");
+	}
+
+	vkBindBufferMemory(m_Device, buffer, bufferMemory, 0);
+}
+
 VkCommandBuffer Vulkan::beginSingleTimeCommands() {
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
@@ -1098,7 +2160,7 @@ void Vulkan::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize siz
 
 
 void Vulkan::createCommandBuffers() {
-	m_CommandBuffers.resize(g_MAX_FRAMES_IN_FLIGHT);
+	m_CommandBuffers.resize(m_FramesInFlight);
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool = m_CommandPool;
@@ -1108,27 +2170,94 @@ void Vulkan::createCommandBuffers() {
 	if (vkAllocateCommandBuffers(m_Device, &allocInfo, m_CommandBuffers.data()) != VK_SUCCESS) {
 		throw std::runtime_error("[Vulkan#createCommandBuffer]: Error: Failed to allocate command buffers!");
 	}
+
+	if (m_ReuseCommandBuffers) {
+		m_SceneCommandBuffers.resize(m_FramesInFlight);
+		m_SceneCommandsValid.assign(m_FramesInFlight, false);
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+		allocInfo.commandBufferCount = (uint32_t) m_SceneCommandBuffers.size();
+
+		if (vkAllocateCommandBuffers(m_Device, &allocInfo, m_SceneCommandBuffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("[Vulkan#createCommandBuffer]: Error: Failed to allocate scene command buffers!");
+		}
+		allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+	}
+
+	if (m_AsyncCompute) {
+		m_ComputeCommandBuffers.resize(m_FramesInFlight);
+		allocInfo.commandPool = m_ComputeCommandPool;
+		allocInfo.commandBufferCount = (uint32_t) m_ComputeCommandBuffers.size();
+
+		if (vkAllocateCommandBuffers(m_Device, &allocInfo, m_ComputeCommandBuffers.data()) != VK_SUCCESS) {
+			throw std::runtime_error("[Vulkan#createCommandBuffer]: Error: Failed to allocate compute command buffers!");
+		}
+	}
 }
 
 void Vulkan::createSyncObjects() {
-	m_ImageAvailableSemaphores.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_RenderFinishedSemaphores.resize(g_MAX_FRAMES_IN_FLIGHT);
-	m_InFlightFences.resize(g_MAX_FRAMES_IN_FLIGHT);
+	m_ImageAvailableSemaphores.resize(m_FramesInFlight);
+	m_RenderFinishedSemaphores.resize(m_FramesInFlight);
 
 	VkSemaphoreCreateInfo semaphoreInfo{};
 	semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-	VkFenceCreateInfo fenceInfo{};
-	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-	fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT; // Set it so the first frame does not block indefinitely
-
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < m_FramesInFlight; i++) {
 		if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_ImageAvailableSemaphores[i]) != VK_SUCCESS ||
-			vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_RenderFinishedSemaphores[i]) != VK_SUCCESS ||
-			vkCreateFence(m_Device, &fenceInfo, nullptr, &m_InFlightFences[i]) != VK_SUCCESS) {
+			vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_RenderFinishedSemaphores[i]) != VK_SUCCESS) {
 				throw std::runtime_error("[Vulkan#createSyncObjects]: Error: Failed to create semaphores!");
 		}
 	}
+
+	VkSemaphoreTypeCreateInfoKHR typeInfo{};
+	typeInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO_KHR;
+	typeInfo.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE_KHR;
+	typeInfo.initialValue = 0;
+	semaphoreInfo.pNext = &typeInfo;
+
+	// Every slot starts out as done with frame 0, so the first frames do not block
+	m_FrameNumber = 0;
+	m_FrameTimelineValues.assign(m_FramesInFlight, 0);
+	if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_FrameTimeline) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createSyncObjects]: Error: Failed to create frame timeline semaphore!");
+	}
+
+	m_ComputePending = false;
+	if (m_AsyncCompute) {
+		if (vkCreateSemaphore(m_Device, &semaphoreInfo, nullptr, &m_ComputeTimeline) != VK_SUCCESS) {
+			throw std::runtime_error("[Vulkan#createSyncObjects]: Error: Failed to create compute timeline semaphore!");
+		}
+	}
+}
+
+void Vulkan::createQueryPool() {
+	if (!m_CollectPipelineStatistics)
+		return;
+
+	// One query per frame in flight, counting how often the fragment shader ran for the whole render pass
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType = VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	poolInfo.queryCount = m_FramesInFlight;
+	poolInfo.pipelineStatistics = VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT;
+
+	if (vkCreateQueryPool(m_Device, &poolInfo, nullptr, &m_StatisticsQueryPool) != VK_SUCCESS) {
+		throw std::runtime_error("[Vulkan#createQueryPool]: Error: Failed to create query pool!");
+	}
+	m_StatisticsWritten.assign(m_FramesInFlight, false);
+}
+
+void Vulkan::readPipelineStatistics() {
+	if (m_StatisticsQueryPool == VK_NULL_HANDLE || !m_StatisticsWritten[m_CurrentFrame])
+		return;
+
+	// The timeline wait for this slot just returned, so the result is available without stalling
+	uint64_t fragmentInvocations = 0;
+	VkResult result = vkGetQueryPoolResults(m_Device, m_StatisticsQueryPool, m_CurrentFrame, 1, sizeof(uint64_t), &fragmentInvocations, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+	if (result == VK_SUCCESS) {
+		m_FragmentInvocations += fragmentInvocations;
+		m_StatisticsFrames++;
+	}
+	m_StatisticsWritten[m_CurrentFrame] = false;
 }
 
 void Vulkan::populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo) {
@@ -1158,21 +2287,57 @@ void Vulkan::cleanup() {
 	}
 
 	cleanupSwapChain();
+	m_FrameGraph.cleanup(*this);
+	for (const auto& retired : m_RetiredSwapChains) {
+		destroyRetiredSwapChain(retired);
+	}
+	m_RetiredSwapChains.clear();
+	releaseRetiredBuffers(UINT64_MAX);
+	for (ReadbackSlot& slot : m_ReadbackSlots) {
+		destroyReadbackSlot(slot);
+	}
 
 	vkDestroyCommandPool(m_Device, m_CommandPool, nullptr);
+	if (m_ComputeCommandPool != VK_NULL_HANDLE)
+		vkDestroyCommandPool(m_Device, m_ComputeCommandPool, nullptr);
 
-	for (size_t i = 0; i < g_MAX_FRAMES_IN_FLIGHT; i++) {
+	for (size_t i = 0; i < m_FramesInFlight; i++) {
 		vkDestroySemaphore(m_Device, m_RenderFinishedSemaphores[i], nullptr);
 		vkDestroySemaphore(m_Device, m_ImageAvailableSemaphores[i], nullptr);
-		vkDestroyFence(m_Device, m_InFlightFences[i], nullptr);
 	}
+	vkDestroySemaphore(m_Device, m_FrameTimeline, nullptr);
+	if (m_ComputeTimeline != VK_NULL_HANDLE)
+		vkDestroySemaphore(m_Device, m_ComputeTimeline, nullptr);
+
+	if (m_DeformPipeline != VK_NULL_HANDLE) {
+		vkDestroyPipeline(m_Device, m_DeformPipeline, nullptr);
+		vkDestroyPipelineLayout(m_Device, m_ComputePipelineLayout, nullptr);
+	}
+
+	if (m_StatisticsQueryPool != VK_NULL_HANDLE)
+		vkDestroyQueryPool(m_Device, m_StatisticsQueryPool, nullptr);
 
-	vkDestroyPipeline(m_Device, m_GraphicsPipeline, nullptr);
+	for (size_t i = 0; i < m_DepthPrepassPipelines.size(); i++) {
+		if (i == 0 || m_DepthPrepassPipelines[i] != m_DepthPrepassPipelines[0])
+			vkDestroyPipeline(m_Device, m_DepthPrepassPipelines[i], nullptr);
+	}
+	for (uint32_t i = 0; i < g_PIPELINE_VARIANT_COUNT; i++) {
+		// Variants that share a pipeline with an earlier one only get destroyed once
+		bool shared = false;
+		for (uint32_t j = 0; j < i; j++) {
+			shared |= m_GraphicsPipelines[j] == m_GraphicsPipelines[i];
+		}
+		if (!shared)
+			vkDestroyPipeline(m_Device, m_GraphicsPipelines[i], nullptr);
+	}
+	savePipelineCache();
+	vkDestroyPipelineCache(m_Device, m_PipelineCache, nullptr);
 	vkDestroyPipelineLayout(m_Device, m_PipelineLayout, nullptr);
 	vkDestroyRenderPass(m_Device, m_RenderPass, nullptr);
 	vkDestroyDevice(m_Device, nullptr);
 
-	vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
+	if (m_Surface != VK_NULL_HANDLE)
+		vkDestroySurfaceKHR(m_Instance, m_Surface, nullptr);
 	vkDestroyInstance(m_Instance, nullptr);
 
 }
@@ -2,11 +2,20 @@
 #define VULKAN_HPP
 
 #include <vulkan/vulkan_core.h>
+#include <string>
 #include <vector>
+#include <functional>
 #include <iostream>
 #include "structs.hpp"
+#include "Options.hpp"
+#include "RenderGraph.hpp"
+#include "importer/VRMImporter.hpp"
 
-const int g_MAX_FRAMES_IN_FLIGHT = 2;
+// One graphics pipeline per alpha mode (opaque, mask, blend), depth test (less, equal after the pre-pass) and cull mode (back, none)
+const uint32_t g_ALPHA_MODE_COUNT = 3;
+const uint32_t g_PIPELINE_VARIANT_COUNT = g_ALPHA_MODE_COUNT * 2 * 2;
+
+const char* const g_PIPELINE_CACHE_FILE = "pipeline_cache.bin";
 
 const std::vector<const char*> validationLayers = {
 	"VK_LAYER_KHRONOS_validation",
@@ -22,7 +31,9 @@ const std::vector<const char*> deviceExtensions = {
 	VK_KHR_DEPTH_STENCIL_RESOLVE_EXTENSION_NAME,
 	VK_KHR_CREATE_RENDERPASS_2_EXTENSION_NAME,
 	VK_KHR_MAINTENANCE2_EXTENSION_NAME,
-	VK_KHR_MULTIVIEW_EXTENSION_NAME
+	VK_KHR_MULTIVIEW_EXTENSION_NAME,
+	VK_KHR_TIMELINE_SEMAPHORE_EXTENSION_NAME,
+	VK_KHR_SYNCHRONIZATION_2_EXTENSION_NAME
 };
 
 #ifdef NDEBUG
@@ -36,7 +47,24 @@ const bool g_ValidateExtensions = true;
 class Vulkan {
 public:
 	uint32_t m_CurrentFrame = 0;
+	// Between 1 and g_MAX_FRAMES_IN_FLIGHT, every per frame resource is created this many times
+	uint32_t m_FramesInFlight = 2;
 	bool m_Invalidated = false;
+	// Renders into offscreen images without a surface or swap chain, m_SwapChainImages then holds those images
+	bool m_Headless = false;
+	// Index or part of the name of the device to use instead of the best rated one, empty to rate them
+	std::string m_DeviceOverride;
+	bool m_DepthPrepass = false;
+	bool m_CollectPipelineStatistics = false;
+	SkinningMode m_Skinning = SKINNING_VERTEX_SHADER;
+	// Layout of the palette the shaders read, follows the model's VRMImporter::m_SkinningMethod
+	bool m_DualQuaternionSkinning = false;
+	bool m_AsyncCompute = false;
+	PresentPolicy m_PresentPolicy;
+	// Mode the current swap chain was created with
+	VkPresentModeKHR m_PresentMode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+	// Id the last present was tagged with, 0 when present wait is off or nothing was presented to this swap chain yet
+	uint64_t m_LastPresentId = 0;
 	size_t m_SurfaceWidth = 0;
 	size_t m_SurfaceHeight = 0;
 	std::vector<const char*> m_Extensions;
@@ -44,30 +72,111 @@ public:
 	VkInstance m_Instance;
 	VkDebugUtilsMessengerEXT m_DebugMessenger;
 	VkPhysicalDevice m_PhysicalDevice = VK_NULL_HANDLE;
+	DeviceCapabilities m_Capabilities;
 	VkDevice m_Device;
-	VkSurfaceKHR m_Surface;
+	VkSurfaceKHR m_Surface = VK_NULL_HANDLE;
 	VkQueue m_GraphicsQueue;
 	VkQueue m_PresentQueue;
+	VkQueue m_ComputeQueue = VK_NULL_HANDLE;
 
-	VkSwapchainKHR m_SwapChain;
+	VkSwapchainKHR m_SwapChain = VK_NULL_HANDLE;
 	std::vector<VkImage> m_SwapChainImages;
 	VkFormat m_SwapChainImageFormat;
 	VkExtent2D m_SwapChainExtent;
 	std::vector<VkImageView> m_SwapChainImageViews;
 	std::vector<VkFramebuffer> m_SwapChainFramebuffers;
+	std::vector<VkDeviceMemory> m_OffscreenImagesMemory;
 
 	VkRenderPass m_RenderPass;
 	VkPipelineLayout m_PipelineLayout;
-	VkPipeline m_GraphicsPipeline;
+	std::array<VkPipeline, g_PIPELINE_VARIANT_COUNT> m_GraphicsPipelines{};
+	std::array<VkPipeline, 2> m_DepthPrepassPipelines{};
+	VkPipeline m_BoundPipeline = VK_NULL_HANDLE;
+	VkPipelineCache m_PipelineCache = VK_NULL_HANDLE;
+	bool m_PipelineCacheWarm = false;
 	VkCommandPool m_CommandPool;
 	std::vector<VkCommandBuffer> m_CommandBuffers;
 	std::vector<VkSemaphore> m_ImageAvailableSemaphores;
 	std::vector<VkSemaphore> m_RenderFinishedSemaphores;
-	std::vector<VkFence> m_InFlightFences;
+	// Timeline semaphore the graphics submit of every frame signals with that frame's number,
+	// a frame slot is free again once the value it was last submitted with has been reached
+	VkSemaphore m_FrameTimeline = VK_NULL_HANDLE;
+	uint64_t m_FrameNumber = 0;
+	std::vector<uint64_t> m_FrameTimelineValues;
+
+	// Vertex deformation pass, only has its own queue when the device exposes a compute-only family
+	VkPipelineLayout m_ComputePipelineLayout = VK_NULL_HANDLE;
+	VkPipeline m_DeformPipeline = VK_NULL_HANDLE;
+	VkCommandPool m_ComputeCommandPool = VK_NULL_HANDLE;
+	std::vector<VkCommandBuffer> m_ComputeCommandBuffers;
+	// Signalled with the frame's number by the compute submit, the graphics submit of the same frame waits on it
+	VkSemaphore m_ComputeTimeline = VK_NULL_HANDLE;
+	bool m_ComputePending = false;
+
+	VkQueryPool m_StatisticsQueryPool = VK_NULL_HANDLE;
+	std::vector<bool> m_StatisticsWritten;
+	uint64_t m_FragmentInvocations = 0;
+	uint32_t m_StatisticsFrames = 0;
+
+	PFN_vkCmdSetCullModeEXT pvkCmdSetCullModeEXT = nullptr;
+	PFN_vkCmdSetDepthWriteEnableEXT pvkCmdSetDepthWriteEnableEXT = nullptr;
+	PFN_vkCmdSetDepthCompareOpEXT pvkCmdSetDepthCompareOpEXT = nullptr;
+	PFN_vkWaitSemaphoresKHR pvkWaitSemaphoresKHR = nullptr;
+	PFN_vkWaitForPresentKHR pvkWaitForPresentKHR = nullptr;
+	PFN_vkCmdPipelineBarrier2KHR pvkCmdPipelineBarrier2KHR = nullptr;
 
-	VkImage m_DepthImage;
-	VkDeviceMemory m_DepthImageMemory;
-	VkImageView m_DepthImageView;
+	// Passes of a frame, declared by createFrameGraph. The depth buffer is one of its transient images
+	RenderGraph m_FrameGraph;
+	uint32_t m_SwapChainResource = 0;
+	uint32_t m_DepthResource = 0;
+	// Swap chain image the frame graph is being recorded for
+	uint32_t m_ImageIndex = 0;
+
+	// Records the scene body of the render pass into a secondary command buffer per frame slot and replays it until
+	// invalidateSceneCommands, instead of recording it every frame. Everything else reaches the GPU through buffers
+	bool m_ReuseCommandBuffers = false;
+	std::vector<VkCommandBuffer> m_SceneCommandBuffers;
+	std::vector<bool> m_SceneCommandsValid;
+	// Times the scene commands were recorded since the application last reset it
+	uint32_t m_SceneCommandsRecorded = 0;
+
+	// Swap chain resources replaced by a resize, destroyed once the last frame that could still use them is done
+	// and the presentation engine let go of its images
+	struct RetiredSwapChain {
+		uint64_t frameNumber;
+		// Last present id of the old swap chain, 0 when present wait can not tell when it was shown
+		uint64_t presentId = 0;
+		VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+		std::vector<VkImageView> imageViews;
+		std::vector<VkFramebuffer> framebuffers;
+		RenderGraph::Transients transients;
+	};
+	std::vector<RetiredSwapChain> m_RetiredSwapChains;
+	// Buffers replaced while frames in flight may still read them, released like the swap chains
+	struct RetiredBuffer {
+		uint64_t frameNumber;
+		VkBuffer buffer;
+		VkDeviceMemory memory;
+	};
+	std::vector<RetiredBuffer> m_RetiredBuffers;
+
+	// Gets every frame asked for with requestReadback, m_FramesInFlight frames after it was rendered, once the copy is done.
+	// Must be set before init2, leaving it empty keeps the readback pass and its buffers out of the frame
+	std::function<void(const ReadbackFrame&)> m_ReadbackConsumer;
+	// Host visible copy of the frame a slot rendered last, reused by that slot and only grown when the frame gets bigger
+	struct ReadbackSlot {
+		VkBuffer buffer = VK_NULL_HANDLE;
+		VkDeviceMemory memory = VK_NULL_HANDLE;
+		void* mapped = nullptr;
+		VkDeviceSize size = 0;
+		bool coherent = false;
+		VkExtent2D extent{0, 0};
+		bool bgra = false;
+		// Frame the copy belongs to, 0 when there is nothing to hand out
+		uint64_t frameNumber = 0;
+	};
+	std::vector<ReadbackSlot> m_ReadbackSlots;
+	bool m_ReadbackRequested = false;
 
 	void init(std::vector<const char*>& extensions, size_t width, size_t height);
 	void init2();
@@ -79,8 +188,39 @@ public:
 	std::vector<const char*> getRequiredExtensions();
 	bool checkValidationLayerSupport();
 
-	void beginDrawFrame(uint32_t* imageIndex);
+	// Waits until the resources of m_CurrentFrame are no longer used by the GPU, they may be written after this returns
+	void waitForFrame();
+	// Acquires an image and begins the command buffer of m_CurrentFrame. Callers have to call waitForFrame first,
+	// usually before writing the frame's buffers. Returns false when the swap chain had to be recreated
+	bool beginDrawFrame(uint32_t* imageIndex);
+	// Declares the frame: an optional compute pass running deform, then the render pass running draw inside it
+	void createFrameGraph(const RenderGraph::Record& deform, const RenderGraph::Record& draw);
+	// Records the frame graph into the current command buffer, between beginDrawFrame and endDrawFrame
+	void recordFrameGraph(uint32_t imageIndex);
+	// Copies the frame being recorded to host memory for m_ReadbackConsumer, call before recordFrameGraph
+	void requestReadback();
+	// Hands out the copies still waiting, oldest first. Only after deviceWaitIdle
+	void flushReadbacks();
+	void beginRenderPass(uint32_t imageIndex, VkSubpassContents contents);
+	// Viewport and scissor covering the swap chain
+	void setViewport(VkCommandBuffer commandBuffer);
+	// Starts a secondary command buffer that continues the render pass
+	void beginSceneCommands(VkCommandBuffer commandBuffer);
+	// The scene commands of every frame slot, or just of frame, get recorded again the next time they are used.
+	// Needed whenever a draw call, a bound pipeline or a bound descriptor set would change
+	void invalidateSceneCommands();
+	void invalidateSceneCommands(uint32_t frame);
+	// Destroys buffer and its memory once every frame submitted so far is done, instead of waiting for the device
+	void retireBuffer(VkBuffer buffer, VkDeviceMemory memory);
+	void endRenderPass(VkCommandBuffer commandBuffer);
+	// Only used with async compute, on the graphics queue deformation is a pass of the frame graph
+	VkCommandBuffer beginComputeCommands();
+	void endComputeCommands(VkCommandBuffer commandBuffer);
 	void endDrawFrame(uint32_t* imageIndex);
+	// Takes effect with the next present, a different mode recreates the swap chain
+	void setPresentPolicy(const PresentPolicy& policy);
+	// Blocks until the present tagged presentId is visible or timeout nanoseconds passed, false if it is not known to be
+	bool waitForPresent(uint64_t presentId, uint64_t timeout);
 
 	void createInstance();
 	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);
@@ -91,38 +231,63 @@ public:
 	bool isDeviceSuitable(VkPhysicalDevice device);
 	bool checkDeviceExtensionSupport(VkPhysicalDevice device);
 	void pickPhysicalDevice();
+	// Higher is better, only meaningful for devices that passed isDeviceSuitable
+	int64_t rateDevice(VkPhysicalDevice device, const DeviceCapabilities& capabilities);
+	DeviceCapabilities queryCapabilities(VkPhysicalDevice device);
+	// Fills m_Capabilities for the picked device and settles the options that depend on them
+	void queryDeviceCapabilities();
 	void createLogicalDevice();
+	void loadDeviceFunctions();
 	void createSwapChain();
+	void createOffscreenImages();
 	void cleanupSwapChain();
 	void recreateSwapChain();
+	void destroyRetiredSwapChain(const RetiredSwapChain& retired);
+	// Destroys the retired resources of every frame up to completedFrame whose last present is done
+	void releaseRetiredSwapChains(uint64_t completedFrame);
+	void releaseRetiredBuffers(uint64_t completedFrame);
+	// Makes sure the slot's buffer fits the current frame, its previous copy has to be handed out already
+	void prepareReadbackSlot(ReadbackSlot& slot);
+	void recordReadback(VkCommandBuffer commandBuffer);
+	void deliverReadback(ReadbackSlot& slot);
+	void destroyReadbackSlot(ReadbackSlot& slot);
 	VkImageView createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags);
 	void createImageViews();
 	void createRenderPass();
 
+	void createPipelineCache();
+	void savePipelineCache();
+
 	VkShaderModule createShaderModule(const std::vector<char>& code);
 	void createGraphicsPipeline(const std::vector<VkDescriptorSetLayout>& descriptorSetLayouts);
+	static uint32_t pipelineVariantIndex(int alphaMode, bool doubleSided, bool depthEqual);
+	void bindGraphicsPipeline(VkCommandBuffer commandBuffer, const VRM::Material& material);
+	void bindDepthPrepassPipeline(VkCommandBuffer commandBuffer, bool doubleSided);
+	void createComputePipeline(const std::vector<VkDescriptorSetLayout>& descriptorSetLayouts);
 	void createFramebuffers();
 	void createCommandPool();
 
-	void beginRecordCommandBuffer(VkCommandBuffer commandBuffer, uint32_t imageIndex);
+	void beginRecordCommandBuffer(VkCommandBuffer commandBuffer);
 	void endRecordCommandBuffer(VkCommandBuffer commandBuffer);
 
 	uint32_t findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
 	VkFormat findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);
 	VkFormat findDepthFormat();
 	bool hasStencilComponent(VkFormat format);
-	void createDepthResources();
 	void createImage(uint32_t width, uint32_t height, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
 	void transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout);
 	void copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
 
 	void createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
+	void createSharedBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);
 	VkCommandBuffer beginSingleTimeCommands();
 	void endSingleTimeCommands(VkCommandBuffer commandBuffer);
 
 	void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
 	void createCommandBuffers();
 	void createSyncObjects();
+	void createQueryPool();
+	void readPipelineStatistics();
 	void populateDebugMessengerCreateInfo(VkDebugUtilsMessengerCreateInfoEXT& createInfo);
 	void setupDebugMessenger();
 	void cleanup();
@@ -0,0 +1,18 @@
+#version 450
+#extension GL_GOOGLE_include_directive : require
+
+#include "vertex_common.glsl"
+
+// Position-only stream split out of Vertex, plus what skinning and morphing need
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in uvec4 inJoints;
+layout(location = 2) in vec4 inWeights;
+layout(location = 3) in int inIndex;
+
+invariant gl_Position;
+
+void main() {
+	InstanceData instance = instanceBuffer.instances[gl_InstanceIndex];
+	vec3 posAfterBone = vertexPosition(inPosition, inJoints, inWeights, inIndex, instance);
+	gl_Position = projectPosition(posAfterBone, instance);
+}
@@ -1,4 +1,6 @@
 #include "VRMImporter.hpp"
+#include "../SimdMath.hpp"
+#include <algorithm>
 #include <fstream>
 #include <iostream>
 #include <glm/gtc/matrix_transform.hpp>
@@ -47,6 +49,9 @@ void VRMImporter::loadModel(const std::string& path) {
 	file.close();
 
 	loadNodes();
+	loadSkins();
+	loadAnimations();
+	loadSpringBones();
 }
 
 void VRMImporter::loadNodes() {
@@ -58,29 +63,24 @@ void VRMImporter::loadNodes() {
 		node.localTransform = glm::mat4(1.0);
 		auto& n = m_Header["nodes"][i];
 
-		glm::mat4 translation;
-		glm::mat4 rotation;
-		glm::mat4 scaling;
+		glm::vec3 translation(0.0f);
+		glm::quat rotation(1.0f, 0.0f, 0.0f, 0.0f);
+		glm::vec3 scaling(1.0f);
 
 		if (n.contains("translation")) {
 			auto& trans = n["translation"];
-			translation = glm::translate(glm::mat4(1.0f), glm::vec3(trans[0], trans[1], trans[2]));
-		} else {
-			translation = glm::translate(glm::mat4(1.0), glm::vec3(0));
+			translation = glm::vec3(trans[0], trans[1], trans[2]);
 		}
 
 		if (n.contains("rotation")) {
 			auto& trans = n["rotation"];
-			rotation = glm::mat4(glm::quat(trans[0], trans[1], trans[2], trans[3]));
-		} else {
-			rotation = glm::mat4(glm::quat(0, 0, 0, 1));
+			// glTF stores x, y, z, w but glm takes w first
+			rotation = SimdMath::normalize(glm::quat(float(trans[3]), float(trans[0]), float(trans[1]), float(trans[2])));
 		}
 
 		if (n.contains("scale")) {
 			auto& trans = n["scale"];
-			scaling = glm::scale(glm::mat4(1.0), glm::vec3(trans[0], trans[1], trans[2]));
-		} else {
-			scaling = glm::scale(glm::mat4(1.0), glm::vec3(1));
+			scaling = glm::vec3(trans[0], trans[1], trans[2]);
 		}
 
 		if (n.contains("mesh")) {
@@ -102,29 +102,25 @@ void VRMImporter::loadNodes() {
 			node.firstChild = -1;
 		}
 
-		node.localTransform = translation * rotation * scaling;
+		node.translation = translation;
+		node.rotation = rotation;
+		node.scale = scaling;
+		SimdMath::composeTRS(translation, rotation, scaling, node.localTransform);
 		node.globalTransform = node.localTransform;
-		node.jointMatrix = glm::mat4(1.0);
 		node.parent = -1;
 		node.nextSibling = -1;
+		node.dirty = true;
+		node.childDirty = false;
+		node.version = 0;
 		m_Nodes.push_back(node);
 	}
 
 	// Next sibling loop
 	for (size_t i = 0; i < size; i++) {
 		auto& n = m_Header["nodes"][i];
-		VRM::FCNSNode& parent = m_Nodes[i];
-
 		if (!n.contains("children")) continue;
 		size_t childrenCount = n["children"].size();
 
-		// Update global transform
-		for (size_t j = 0; j < childrenCount; j++) {
-			size_t childIndex = n["children"][j];
-			VRM::FCNSNode& child = m_Nodes[childIndex];
-			child.globalTransform = child.localTransform * parent.localTransform;
-		}
-
 		if (childrenCount == 1) {
 			size_t childIndex = n["children"][0];
 			VRM::FCNSNode& child = m_Nodes[childIndex];
@@ -142,55 +138,258 @@ void VRMImporter::loadNodes() {
 			child.nextSibling = siblingIndex;
 		}
 	}
+
+	m_TransformsDirty = true;
+	recalculateMatrices();
 }
 
-void VRMImporter::calculateJoints() {
-	auto& accessor = m_Header["accessors"][0];
-	size_t bufferViewIndex = accessor["bufferView"];
-
-	auto& bufferView = m_Header["bufferViews"][bufferViewIndex];
-	size_t byteOffset = bufferView["byteOffset"];
-	glm::mat4* inverseBinds = reinterpret_cast<glm::mat4*>(&m_Buffer.at(byteOffset));
-
-	for (size_t i = 0; i < m_Nodes.size(); i++) {
-		VRM::FCNSNode& node = m_Nodes[i];
-
-		if (node.skin != -1) {
-			glm::mat4 inverseTransform = glm::inverse(node.globalTransform);
-			auto& joints = m_Header["skins"][node.skin]["joints"];
-			size_t jointsCount = joints.size();
-			std::vector<glm::mat4> localJoints(jointsCount);
-
-			for (size_t j = 0; j < jointsCount; j++) {
-				size_t jointIndex = joints[j];
-				VRM::FCNSNode& joint = m_Nodes[jointIndex];
-				glm::mat4 jointMat = joint.globalTransform * inverseBinds[j];
-				jointMat = inverseTransform * jointMat;
-				joint.jointMatrix = jointMat;
-				localJoints.push_back(jointMat);
+void VRMImporter::loadSkins() {
+	if (!m_Header.contains("skins"))
+		return;
+
+	size_t skinCount = m_Header["skins"].size();
+	m_Skins.resize(skinCount);
+	m_PaletteSize = 0;
+	for (size_t i = 0; i < skinCount; i++) {
+		auto& s = m_Header["skins"][i];
+		VRM::Skin& skin = m_Skins[i];
+
+		for (auto& joint : s["joints"]) {
+			skin.joints.push_back(joint);
+		}
+		skin.inverseBindMatrices.resize(skin.joints.size(), glm::mat4(1.0f));
+
+		if (s.contains("inverseBindMatrices")) {
+			size_t accessorIndex = s["inverseBindMatrices"];
+			auto& accessor = m_Header["accessors"][accessorIndex];
+			size_t bufferViewIndex = accessor["bufferView"];
+			size_t byteOffset = m_Header["bufferViews"][bufferViewIndex]["byteOffset"];
+			if (accessor.contains("byteOffset"))
+				byteOffset += size_t(accessor["byteOffset"]);
+
+			const glm::mat4* inverseBinds = reinterpret_cast<const glm::mat4*>(&m_Buffer.at(byteOffset));
+			for (size_t j = 0; j < skin.joints.size(); j++) {
+				skin.inverseBindMatrices[j] = inverseBinds[j];
 			}
-			this->m_Joints[node.skin] = localJoints;
 		}
+
+		skin.paletteOffset = m_PaletteSize;
+		m_PaletteSize += skin.joints.size();
 	}
 }
 
-void VRMImporter::recalculateMatrices() {
-	for (size_t i = 0; i < m_Nodes.size(); i++) {
-		VRM::FCNSNode& parent = m_Nodes[i];
-		auto& n = m_Header["nodes"][i];
-		if (parent.parent == -1)
-			parent.globalTransform = parent.localTransform;
+void VRMImporter::loadAnimations() {
+	if (!m_Header.contains("animations"))
+		return;
+
+	for (auto& a : m_Header["animations"]) {
+		VRM::AnimationClip clip;
+		clip.name = a.value("name", std::string());
+		clip.duration = 0.0f;
+		// Samplers often share their input accessor, so the key times are only stored once per accessor
+		std::unordered_map<size_t, uint32_t> timeOffsets;
+
+		for (auto& c : a["channels"]) {
+			auto& target = c["target"];
+			if (!target.contains("node"))
+				continue;
+			auto& sampler = a["samplers"][size_t(c["sampler"])];
+
+			VRM::AnimationChannel channel;
+			channel.node = target["node"];
+			std::string path = target["path"];
+			if (path == "translation") {
+				channel.path = VRM::ANIMATION_PATH_TRANSLATION;
+			} else if (path == "rotation") {
+				channel.path = VRM::ANIMATION_PATH_ROTATION;
+			} else if (path == "scale") {
+				channel.path = VRM::ANIMATION_PATH_SCALE;
+			} else if (path == "weights") {
+				channel.path = VRM::ANIMATION_PATH_WEIGHTS;
+			} else {
+				continue;
+			}
 
-		if (!n.contains("children")) continue;
-		size_t childrenCount = n["children"].size();
+			std::string interpolation = sampler.value("interpolation", std::string("LINEAR"));
+			if (interpolation == "STEP")
+				channel.interpolation = VRM::INTERPOLATION_STEP;
+			else if (interpolation == "CUBICSPLINE")
+				channel.interpolation = VRM::INTERPOLATION_CUBICSPLINE;
+			else
+				channel.interpolation = VRM::INTERPOLATION_LINEAR;
+
+			size_t inputIndex = sampler["input"];
+			size_t outputIndex = sampler["output"];
+			// Quantized keyframes from KHR_mesh_quantization are not supported
+			if (m_Header["accessors"][inputIndex]["componentType"] != 5126 || m_Header["accessors"][outputIndex]["componentType"] != 5126) {
+				std::cout << "[VRMImporter#loadAnimations]: Info: Skipping non-float channel of " << clip.name << std::endl;
+				continue;
+			}
 
-		// Update global transform
-		for (size_t j = 0; j < childrenCount; j++) {
-			size_t childIndex = n["children"][j];
-			VRM::FCNSNode& child = m_Nodes[childIndex];
-			child.globalTransform = child.localTransform * parent.localTransform;
+			Array<float> times = getAccessor<float>(inputIndex);
+			if (times.count == 0)
+				continue;
+			channel.keyCount = static_cast<uint32_t>(times.count);
+			auto it = timeOffsets.find(inputIndex);
+			if (it == timeOffsets.end()) {
+				it = timeOffsets.emplace(inputIndex, static_cast<uint32_t>(clip.times.size())).first;
+				clip.times.insert(clip.times.end(), times.data, times.data + times.count);
+			}
+			channel.timeOffset = it->second;
+			clip.duration = std::max(clip.duration, times.data[times.count - 1]);
+
+			size_t valuesPerKey = channel.interpolation == VRM::INTERPOLATION_CUBICSPLINE ? 3 : 1;
+			Array<float> values = getAccessor<float>(outputIndex);
+			if (channel.path == VRM::ANIMATION_PATH_WEIGHTS) {
+				// SCALAR accessor holding one weight per morph target per key
+				channel.components = static_cast<uint32_t>(values.count / (times.count * valuesPerKey));
+				values.count = size_t(channel.components) * times.count * valuesPerKey;
+			} else {
+				channel.components = channel.path == VRM::ANIMATION_PATH_ROTATION ? 4 : 3;
+				values.count *= channel.components;
+			}
+			channel.valueOffset = static_cast<uint32_t>(clip.values.size());
+			clip.values.insert(clip.values.end(), values.data, values.data + values.count);
+
+			clip.channels.push_back(channel);
+		}
+
+		std::cout << "[VRMImporter#loadAnimations]: Info: Loaded clip " << clip.name << " with " << clip.channels.size() << " channels, " << clip.duration << "s" << std::endl;
+		m_Animations.push_back(std::move(clip));
+	}
+}
+
+// VRM 0.x writes its vectors in Unity's left-handed space, flipping z brings them into glTF space
+static glm::vec3 readVRMVector(const nlohmann::json& vector) {
+	return glm::vec3(vector.value("x", 0.0f), vector.value("y", 0.0f), -vector.value("z", 0.0f));
+}
+
+void VRMImporter::loadSpringBones() {
+	if (!m_Header.contains("extensions") || !m_Header["extensions"].contains("VRM"))
+		return;
+	auto& vrm = m_Header["extensions"]["VRM"];
+	if (!vrm.contains("secondaryAnimation"))
+		return;
+	auto& secondary = vrm["secondaryAnimation"];
+
+	if (secondary.contains("colliderGroups")) {
+		for (auto& g : secondary["colliderGroups"]) {
+			VRM::SpringColliderGroup group;
+			group.node = g["node"];
+			if (g.contains("colliders")) {
+				for (auto& c : g["colliders"]) {
+					group.colliders.push_back({readVRMVector(c["offset"]), c.value("radius", 0.0f)});
+				}
+			}
+			m_SpringColliderGroups.push_back(std::move(group));
 		}
 	}
 
-	calculateJoints();
+	if (secondary.contains("boneGroups")) {
+		for (auto& g : secondary["boneGroups"]) {
+			VRM::SpringBoneGroup group;
+			// The misspelling is part of the VRM 0.x schema
+			group.stiffness = g.value("stiffiness", 1.0f);
+			group.gravityPower = g.value("gravityPower", 0.0f);
+			group.gravityDir = g.contains("gravityDir") ? readVRMVector(g["gravityDir"]) : glm::vec3(0.0f, -1.0f, 0.0f);
+			group.dragForce = g.value("dragForce", 0.4f);
+			group.hitRadius = g.value("hitRadius", 0.02f);
+			if (g.contains("bones")) {
+				for (auto& bone : g["bones"]) {
+					group.bones.push_back(bone);
+				}
+			}
+			if (g.contains("colliderGroups")) {
+				for (auto& colliderGroup : g["colliderGroups"]) {
+					group.colliderGroups.push_back(colliderGroup);
+				}
+			}
+			m_SpringBoneGroups.push_back(std::move(group));
+		}
+	}
+
+	std::cout << "[VRMImporter#loadSpringBones]: Info: Loaded " << m_SpringBoneGroups.size() << " spring bone groups and " << m_SpringColliderGroups.size() << " collider groups" << std::endl;
+}
+
+void VRMImporter::writePalette(glm::vec4* palette, const glm::mat4& basis, uint64_t sinceVersion) {
+	writePalette(m_Nodes, palette, basis, sinceVersion);
+}
+
+void VRMImporter::writePalette(const std::vector<VRM::FCNSNode>& nodes, glm::vec4* palette, const glm::mat4& basis, uint64_t sinceVersion) const {
+	size_t stride = getPaletteStride();
+	// JOINTS_0 indexes into the joint list of the skin, not into the nodes
+	for (const auto& skin : m_Skins) {
+		for (size_t j = 0; j < skin.joints.size(); j++) {
+			if (nodes[skin.joints[j]].version <= sinceVersion)
+				continue;
+			glm::mat4 skinMatrix;
+			SimdMath::multiply(basis, nodes[skin.joints[j]].globalTransform, skinMatrix);
+			SimdMath::multiply(skinMatrix, skin.inverseBindMatrices[j], skinMatrix);
+			glm::vec4* entry = palette + (skin.paletteOffset + j) * stride;
+			if (m_SkinningMethod == VRM::SKINNING_METHOD_LINEAR) {
+				SimdMath::multiplyAffineRows(skinMatrix, basis, entry);
+				continue;
+			}
+
+			// Basis * skin * basis is still a rigid transform, the swap on both sides cancels out
+			SimdMath::multiply(skinMatrix, basis, skinMatrix);
+			glm::mat3 rotation(glm::normalize(glm::vec3(skinMatrix[0])), glm::normalize(glm::vec3(skinMatrix[1])), glm::normalize(glm::vec3(skinMatrix[2])));
+			glm::quat real = glm::normalize(glm::quat_cast(rotation));
+			glm::quat dual = glm::quat(0.0f, glm::vec3(skinMatrix[3])) * real * 0.5f;
+			entry[0] = glm::vec4(real.x, real.y, real.z, real.w);
+			entry[1] = glm::vec4(dual.x, dual.y, dual.z, dual.w);
+		}
+	}
+}
+
+size_t VRMImporter::getPaletteStride() const {
+	return m_SkinningMethod == VRM::SKINNING_METHOD_DUAL_QUATERNION ? 2 : 3;
+}
+
+void VRMImporter::setLocalTransform(int nodeIndex, const glm::mat4& transform) {
+	m_Nodes[nodeIndex].localTransform = transform;
+	markDirty(m_Nodes, nodeIndex);
+	m_TransformsDirty = true;
+}
+
+void VRMImporter::recalculateMatrices() {
+	if (!m_TransformsDirty)
+		return;
+
+	m_TransformsDirty = false;
+	m_TransformVersion++;
+	propagateTransforms(m_Nodes, m_TransformVersion);
+}
+
+void VRMImporter::markDirty(std::vector<VRM::FCNSNode>& nodes, int nodeIndex) {
+	nodes[nodeIndex].dirty = true;
+	// Stop at the first ancestor that is already marked, everything above it is too
+	for (int parent = nodes[nodeIndex].parent; parent != -1 && !nodes[parent].childDirty; parent = nodes[parent].parent) {
+		nodes[parent].childDirty = true;
+	}
+}
+
+void VRMImporter::propagateTransforms(std::vector<VRM::FCNSNode>& nodes, uint64_t version) {
+	for (size_t i = 0; i < nodes.size(); i++) {
+		if (nodes[i].parent == -1)
+			updateGlobalTransform(nodes, i, glm::mat4(1.0f), false, version);
+	}
+}
+
+void VRMImporter::updateGlobalTransform(std::vector<VRM::FCNSNode>& nodes, int nodeIndex, const glm::mat4& parentTransform, bool parentChanged, uint64_t version) {
+	VRM::FCNSNode& node = nodes[nodeIndex];
+	if (!parentChanged && !node.dirty && !node.childDirty)
+		return;
+
+	bool changed = parentChanged || node.dirty;
+	if (changed) {
+		SimdMath::multiply(parentTransform, node.localTransform, node.globalTransform);
+		node.version = version;
+	}
+	node.dirty = false;
+	node.childDirty = false;
+
+	for (int child = node.firstChild; child != -1; child = nodes[child].nextSibling) {
+		updateGlobalTransform(nodes, child, node.globalTransform, changed, version);
+	}
 }
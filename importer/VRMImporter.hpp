@@ -10,6 +10,7 @@
 #define GLM_FORCE_DEFAULT_ALIGNED_GENTYPES
 #include <glm/glm.hpp>
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/quaternion.hpp>
 
 template<class T>
 struct Array {
@@ -18,12 +19,19 @@ struct Array {
 };
 
 namespace VRM {
+	enum AlphaMode : int {
+		ALPHA_MODE_OPAQUE = 0,
+		ALPHA_MODE_MASK = 1,
+		ALPHA_MODE_BLEND = 2
+	};
+
 	struct Material {
 		bool doubleSided;
 		int alphaMode;
 		int normalTextureIndex;
 		int emissiveTextureIndex;
 		int baseColourTextureIndex;
+		float alphaCutoff;
 	};
 
 	struct TextureData {
@@ -34,12 +42,101 @@ namespace VRM {
 	struct FCNSNode {
 		alignas(16) glm::mat4 localTransform;
 		alignas(16) glm::mat4 globalTransform;
-		alignas(16) glm::mat4 jointMatrix;
+		// Components localTransform is composed from, animation channels replace them one at a time
+		glm::vec3 translation;
+		glm::quat rotation;
+		glm::vec3 scale;
 		int mesh;
 		int skin;
 		int parent;
 		int firstChild;
 		int nextSibling;
+		// localTransform changed, so globalTransform of this node and everything below it is stale
+		bool dirty;
+		// Some descendant is dirty, untouched subtrees are skipped entirely
+		bool childDirty;
+		// VRMImporter::m_TransformVersion at which globalTransform last changed
+		uint64_t version;
+	};
+
+	struct Skin {
+		std::vector<int> joints;
+		std::vector<glm::mat4> inverseBindMatrices;
+		// Where this skin's matrices start in the palette
+		uint32_t paletteOffset;
+	};
+
+	enum AnimationPath : int {
+		ANIMATION_PATH_TRANSLATION = 0,
+		ANIMATION_PATH_ROTATION = 1,
+		ANIMATION_PATH_SCALE = 2,
+		ANIMATION_PATH_WEIGHTS = 3
+	};
+
+	enum Interpolation : int {
+		INTERPOLATION_STEP = 0,
+		INTERPOLATION_LINEAR = 1,
+		INTERPOLATION_CUBICSPLINE = 2
+	};
+
+	// One animated property of one node, its keys live in the flat arrays of the clip
+	struct AnimationChannel {
+		int node;
+		AnimationPath path;
+		Interpolation interpolation;
+		uint32_t keyCount;
+		// First key time in AnimationClip::times, channels sharing a sampler input share the times
+		uint32_t timeOffset;
+		// First value in AnimationClip::values, cubic splines store in-tangent, value and out-tangent per key
+		uint32_t valueOffset;
+		uint32_t components;
+	};
+
+	struct AnimationClip {
+		std::string name;
+		float duration;
+		std::vector<AnimationChannel> channels;
+		std::vector<float> times;
+		std::vector<float> values;
+	};
+
+	// Final skinning matrix of one joint, only the top three rows since the bottom one of an affine matrix is always (0, 0, 0, 1)
+	struct PaletteMatrix {
+		glm::vec4 rows[3];
+	};
+
+	// Same transform as a unit dual quaternion, both parts as x, y, z, w. Drops scale and shear but blends without collapsing twisted joints
+	struct PaletteDualQuaternion {
+		glm::vec4 real;
+		glm::vec4 dual;
+	};
+
+	// Sphere attached to a node that spring bones can not enter
+	struct SpringCollider {
+		glm::vec3 offset;
+		float radius;
+	};
+
+	struct SpringColliderGroup {
+		int node;
+		std::vector<SpringCollider> colliders;
+	};
+
+	// One boneGroups entry of VRM's secondaryAnimation, every listed bone starts a chain through all of its descendants
+	struct SpringBoneGroup {
+		float stiffness;
+		float gravityPower;
+		glm::vec3 gravityDir;
+		float dragForce;
+		float hitRadius;
+		std::vector<int> bones;
+		// Indices into VRMImporter::m_SpringColliderGroups
+		std::vector<int> colliderGroups;
+	};
+
+	enum SkinningMethod {
+		SKINNING_METHOD_LINEAR = 0,
+		SKINNING_METHOD_DUAL_QUATERNION = 1
 	};
 }
 
@@ -48,10 +145,34 @@ public:
 	nlohmann::json m_Header;
 	std::vector<char> m_Buffer;
 	std::vector<VRM::FCNSNode> m_Nodes;
-	std::unordered_map<size_t, std::vector<glm::mat4>> m_Joints;
+	std::vector<VRM::Skin> m_Skins;
+	std::vector<VRM::AnimationClip> m_Animations;
+	std::vector<VRM::SpringBoneGroup> m_SpringBoneGroups;
+	std::vector<VRM::SpringColliderGroup> m_SpringColliderGroups;
+	// Joint count of all skins together
+	size_t m_PaletteSize = 0;
+	// Decides the layout of the palette, has to be set before the palette buffers are created
+	VRM::SkinningMethod m_SkinningMethod = VRM::SKINNING_METHOD_LINEAR;
+	// Bumped by every recalculateMatrices that changed something, lets palette copies tell whether they are stale
+	uint64_t m_TransformVersion = 0;
+	bool m_TransformsDirty = false;
 	void loadModel(const std::string& path);
 
 	void loadNodes();
+	void loadSkins();
+	void loadAnimations();
+	void loadSpringBones();
+
+	template<class T>
+	Array<T> getAccessor(size_t accessorIndex) {
+		auto& accessor = m_Header["accessors"][accessorIndex];
+		size_t bufferViewIndex = accessor["bufferView"];
+		size_t byteOffset = m_Header["bufferViews"][bufferViewIndex].value("byteOffset", size_t(0));
+		if (accessor.contains("byteOffset"))
+			byteOffset += size_t(accessor["byteOffset"]);
+		size_t count = accessor["count"];
+		return {reinterpret_cast<T*>(&m_Buffer.at(byteOffset)), count};
+	}
 
 	template<class T>
 	Array<T> getMeshAttribute(int meshIndex, int primitiveIndex, const std::string& attribute) {
@@ -115,10 +236,19 @@ public:
 	VRM::Material getMaterial(size_t materialIndex) {
 		VRM::Material material;
 		auto& mat = m_Header["materials"][materialIndex];
-		if (mat.contains("alphaMode"))
-			material.alphaMode = mat["alphaMode"] == "MASK" ? 0 : 1;
+		// glTF defaults to OPAQUE when alphaMode is missing
+		material.alphaMode = VRM::ALPHA_MODE_OPAQUE;
+		if (mat.contains("alphaMode")) {
+			if (mat["alphaMode"] == "MASK")
+				material.alphaMode = VRM::ALPHA_MODE_MASK;
+			else if (mat["alphaMode"] == "BLEND")
+				material.alphaMode = VRM::ALPHA_MODE_BLEND;
+		}
+
+		if (mat.contains("alphaCutoff"))
+			material.alphaCutoff = mat["alphaCutoff"];
 		else
-			material.alphaMode = -1;
+			material.alphaCutoff = 0.5f;
 
 		if (mat.contains("doubleSided"))
 			material.doubleSided = mat["doubleSided"];
@@ -177,8 +307,27 @@ public:
 		return count;
 	}
 
-	void calculateJoints();
+	int getSkinPaletteOffset(int nodeIndex) {
+		if (nodeIndex == -1 || m_Nodes[nodeIndex].skin == -1)
+			return -1;
+		return m_Skins[m_Nodes[nodeIndex].skin].paletteOffset;
+	}
+
+	// Only writes the joints that moved after sinceVersion, a palette that was never written passes 0
+	void writePalette(glm::vec4* palette, const glm::mat4& basis, uint64_t sinceVersion);
+	// Same for a copy of m_Nodes posed by someone else, like an animated character
+	void writePalette(const std::vector<VRM::FCNSNode>& nodes, glm::vec4* palette, const glm::mat4& basis, uint64_t sinceVersion) const;
+	// vec4s per joint in the palette, a PaletteMatrix or a PaletteDualQuaternion
+	size_t getPaletteStride() const;
+	// Marks the node and its ancestors so the next recalculateMatrices picks it up
+	void setLocalTransform(int nodeIndex, const glm::mat4& transform);
 	void recalculateMatrices();
+
+	// Marks a node whose localTransform changed and flags its ancestors, so propagateTransforms finds it
+	static void markDirty(std::vector<VRM::FCNSNode>& nodes, int nodeIndex);
+	// Recomputes the global transforms of the dirty subtrees and stamps them with version
+	static void propagateTransforms(std::vector<VRM::FCNSNode>& nodes, uint64_t version);
+	static void updateGlobalTransform(std::vector<VRM::FCNSNode>& nodes, int nodeIndex, const glm::mat4& parentTransform, bool parentChanged, uint64_t version);
 };
 
 #endif
@@ -1,9 +1,15 @@
 #include "Application.hpp"
+#include "SimdMath.hpp"
 
-int main() {
+int main(int argc, char** argv) {
 	Application app;
 
 	try {
+		app.options = Options::parse(argc, argv);
+		if (app.options.mathBenchmark) {
+			SimdMath::runBenchmarks();
+			return EXIT_SUCCESS;
+		}
 		app.run();
 	} catch (const std::exception& e) {
 
@@ -7,8 +7,16 @@ struct Material {
 	int normalTextureIndex;
 	int emissiveTextureIndex;
 	int baseColourTextureIndex;
+	float alphaCutoff;
 };
 
+const int ALPHA_MODE_OPAQUE = 0;
+const int ALPHA_MODE_MASK = 1;
+const int ALPHA_MODE_BLEND = 2;
+
+// Baked in per pipeline variant
+layout(constant_id = 0) const int ALPHA_MODE = ALPHA_MODE_OPAQUE;
+
 layout(location = 0) in vec3 fragColour;
 layout(location = 1) in vec2 fragTexCoord;
 layout(location = 2) in vec3 fragNormal;
@@ -30,9 +38,9 @@ layout(std140, set = 0, binding = 1) readonly buffer MaterialBuffer {
 
 layout (push_constant) uniform PushConstant {
 	int materialIndex;
-	float value;
+	int morphCount;
 	int numVertices;
-	int nodeIndex;
+	int skinOffset;
 } constants;
 
 void main() {
@@ -46,6 +54,12 @@ void main() {
 	} else {
 		outColour = vec4(fragTexCoord, 0, 1);
 	}
+
+	// Only the MASK pipeline contains the discard, so the others keep early depth testing
+	if (ALPHA_MODE == ALPHA_MODE_MASK && outColour.a < materialBuffer.material.alphaCutoff)
+		discard;
+	if (ALPHA_MODE != ALPHA_MODE_BLEND)
+		outColour.a = 1.0;
 	//outColour = max(dot(fragNormal, L), 0.1) * texture(texSamplers[materialBuffer.materials[matIndex.mIndex].textures[0].tex_index], fragTexCoord);
 	//outColour = vec4(fragNormal, 1.0);
 }
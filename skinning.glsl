@@ -0,0 +1,75 @@
+// Vertex deformation shared by the deformation compute pass and the vertex shaders.
+// The depth pre-pass relies on all of them producing bit-identical positions, so keep the maths in here.
+
+// Every joint is either the top three rows of its final skinning matrix, or a unit dual quaternion (real part, dual part)
+layout(constant_id = 2) const bool DUAL_QUATERNION = false;
+
+layout(std140, set = 0, binding = 2) readonly buffer AnimBuffer {
+	vec4 anims[];
+} animBuffer;
+
+// Blend shapes with a non-zero weight this frame, compacted by Mesh::updateMorphBuffer
+struct ActiveMorph {
+	int target;
+	float weight;
+};
+
+layout(std430, set = 0, binding = 5) readonly buffer MorphBuffer {
+	ActiveMorph morphs[];
+} morphBuffer;
+
+layout(std430, set = 1, binding = 1) readonly buffer PaletteBuffer {
+	vec4 rows[];
+} paletteBuffer;
+
+// posePaletteOffset selects the pose, skinOffset the mesh's skin within it (-1 when the mesh is not skinned)
+// morphWeight scales all blend shapes of the pose, 0 turns them off
+vec3 deformPosition(vec3 pos, uvec4 joints, vec4 weights, int index, int posePaletteOffset, int skinOffset, int numVertices, int morphCount, float morphWeight) {
+	// Morph targets are defined in the bind pose, so they go before skinning
+	if (morphWeight != 0.0) {
+		for (int i = 0; i < morphCount; i++) {
+			ActiveMorph morph = morphBuffer.morphs[i];
+			pos += (morphWeight * morph.weight) * animBuffer.anims[morph.target * numVertices + index].xzy;
+		}
+	}
+
+	if (skinOffset < 0 || weights == vec4(0))
+		return pos;
+
+	int base = posePaletteOffset + skinOffset;
+	if (DUAL_QUATERNION) {
+		// q and -q are the same rotation, blending has to use the one on the first joint's side
+		vec4 pivot = paletteBuffer.rows[(base + int(joints[0])) * 2];
+		vec4 real = vec4(0);
+		vec4 dual = vec4(0);
+		for (int i = 0; i < 4; i++) {
+			int joint = (base + int(joints[i])) * 2;
+			vec4 jointReal = paletteBuffer.rows[joint];
+			float weight = dot(jointReal, pivot) < 0.0 ? -weights[i] : weights[i];
+			real += weight * jointReal;
+			dual += weight * paletteBuffer.rows[joint + 1];
+		}
+		float len = length(real);
+		if (len == 0.0)
+			return pos;
+		real /= len;
+		dual /= len;
+
+		vec3 rotated = pos + 2.0 * cross(real.xyz, cross(real.xyz, pos) + real.w * pos);
+		vec3 translation = 2.0 * (real.w * dual.xyz - dual.w * real.xyz + cross(real.xyz, dual.xyz));
+		return rotated + translation;
+	}
+
+	// Blending the rows first means only one matrix-vector product per vertex
+	vec4 row0 = vec4(0);
+	vec4 row1 = vec4(0);
+	vec4 row2 = vec4(0);
+	for (int i = 0; i < 4; i++) {
+		int joint = (base + int(joints[i])) * 3;
+		row0 += weights[i] * paletteBuffer.rows[joint];
+		row1 += weights[i] * paletteBuffer.rows[joint + 1];
+		row2 += weights[i] * paletteBuffer.rows[joint + 2];
+	}
+	vec4 p = vec4(pos, 1.0);
+	return vec3(dot(row0, p), dot(row1, p), dot(row2, p));
+}
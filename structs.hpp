@@ -14,12 +14,65 @@
 struct QueueFamilyIndices {
 	std::optional<uint32_t> graphicsFamily;
 	std::optional<uint32_t> presentFamily;
+	// Compute-only family, lets vertex deformation overlap with rendering
+	std::optional<uint32_t> computeFamily;
 
 	bool isComplete() {
 		return graphicsFamily.has_value() && presentFamily.has_value();
 	}
 };
 
+// Optional device features that have a fast path when present
+struct DeviceCapabilities {
+	bool extendedDynamicState = false;
+	bool pipelineStatisticsQuery = false;
+	// Statistics queries may stay active across secondary command buffers
+	bool inheritedQueries = false;
+	bool asyncCompute = false;
+	// Software rasterizer like lavapipe, shaders run on the same cores as the application
+	bool cpuDevice = false;
+	// VK_KHR_present_id and VK_KHR_present_wait, lets the application wait until a frame is on screen
+	bool presentWait = false;
+	// Required and always enabled, only recorded to be reported
+	bool timelineSemaphore = false;
+	// Non-uniformly indexed, partially bound texture arrays (VK_EXT_descriptor_indexing)
+	bool descriptorIndexing = false;
+	// Texture uploads straight from host memory without a staging buffer (VK_EXT_host_image_copy)
+	bool hostImageCopy = false;
+	// A transfer-only queue family, copies can run next to rendering
+	bool dedicatedTransfer = false;
+	// Sum of the device local heaps in bytes, shared system memory on integrated and CPU devices
+	uint64_t deviceLocalMemory = 0;
+};
+
+// How finished frames reach the screen, see Vulkan::setPresentPolicy
+struct PresentPolicy {
+	// VK_PRESENT_MODE_MAX_ENUM_KHR lets the device pick, mailbox when the surface has it and fifo otherwise
+	VkPresentModeKHR mode = VK_PRESENT_MODE_MAX_ENUM_KHR;
+	// Tags every present with an id so the application can wait for a frame to be on screen before starting the next
+	bool presentWait = false;
+};
+
+// A finished frame copied to host memory, see Vulkan::m_ReadbackConsumer. The pixels are only valid during the call
+struct ReadbackFrame {
+	// Tightly packed rows of four bytes per pixel, top row first
+	const uint8_t* pixels;
+	uint32_t width;
+	uint32_t height;
+	// Channel order of the swap chain, BGRA on most surfaces and RGBA otherwise
+	bool bgra;
+	uint64_t frameNumber;
+};
+
+// Where vertices get skinned and morphed
+enum SkinningMode : int {
+	// Resolved per device once it is picked
+	SKINNING_AUTO = 0,
+	SKINNING_VERTEX_SHADER = 1,
+	SKINNING_COMPUTE = 2,
+	SKINNING_CPU = 3
+};
+
 struct SwapChainSupportDetails {
 	VkSurfaceCapabilitiesKHR capabilities;
 	std::vector<VkSurfaceFormatKHR> formats;
@@ -85,15 +138,88 @@ struct Vertex {
 	}
 };
 
+// Vertex stream for the depth pre-pass, what skinning and morphing need but no shading attributes
+struct DepthVertex {
+	glm::vec3 pos;
+	glm::uvec4 joints;
+	glm::vec4 weights;
+	int index;
+
+	static VkVertexInputBindingDescription getBindingDescription() {
+		VkVertexInputBindingDescription bindingDescription{};
+		bindingDescription.binding = 0;
+		bindingDescription.stride = sizeof(DepthVertex);
+		bindingDescription.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
+
+		return bindingDescription;
+	}
+
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions() {
+		std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
+		attributeDescriptions[0].binding = 0;
+		attributeDescriptions[0].location = 0;
+		attributeDescriptions[0].format = VK_FORMAT_R32G32B32_SFLOAT;
+		attributeDescriptions[0].offset = offsetof(DepthVertex, pos);
+
+		attributeDescriptions[1].binding = 0;
+		attributeDescriptions[1].location = 1;
+		attributeDescriptions[1].format = VK_FORMAT_R32G32B32A32_UINT;
+		attributeDescriptions[1].offset = offsetof(DepthVertex, joints);
+
+		attributeDescriptions[2].binding = 0;
+		attributeDescriptions[2].location = 2;
+		attributeDescriptions[2].format = VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[2].offset = offsetof(DepthVertex, weights);
+
+		attributeDescriptions[3].binding = 0;
+		attributeDescriptions[3].location = 3;
+		attributeDescriptions[3].format = VK_FORMAT_R32_SINT;
+		attributeDescriptions[3].offset = offsetof(DepthVertex, index);
+
+		return attributeDescriptions;
+	}
+};
+
 struct AnimMesh {
 	std::vector<glm::vec4> verts;
 };
 
+// One blend shape with a non-zero weight, see Mesh::collectActiveMorphs
+struct ActiveMorph {
+	int target;
+	float weight;
+};
+
 struct PushConstants {
 	int materialIndex;
-	float value;
+	// Entries in the mesh's active morph buffer
+	int morphCount;
+	int numVertices;
+	int skinOffset;
+};
+
+// Per instance state read by the vertex shader through gl_InstanceIndex
+struct InstanceData {
+	glm::mat4 transform;
+	float morphWeight;
+	// First palette matrix of the pose this instance is skinned with, instances share the pose at offset 0 by default
+	int paletteOffset;
+	// Block of pre-deformed vertices written for this instance's pose, assigned by Scene every frame
+	int poseIndex;
+	int padding;
+};
+
+// Everything that makes two instances deform differently, instances with equal poses share deformed vertices
+struct PoseData {
+	int paletteOffset;
+	float morphWeight;
+};
+
+struct DeformConstants {
 	int numVertices;
-	int nodeIndex;
+	int skinOffset;
+	int poseCount;
+	int morphCount;
 };
 
 struct UniformBufferObject {
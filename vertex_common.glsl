@@ -0,0 +1,47 @@
+// Inputs shared by every vertex shader that draws the model.
+
+#include "skinning.glsl"
+
+struct InstanceData {
+	mat4 transform;
+	float morphWeight;
+	int paletteOffset;
+	int poseIndex;
+};
+
+layout(set = 0, binding = 0) uniform UniformBufferObject {
+	mat4 model;
+	mat4 view;
+	mat4 proj;
+	float time;
+} ubo;
+
+// Written once per frame by deform.comp, one block of numVertices positions per pose
+layout(std430, set = 0, binding = 3) readonly buffer DeformedBuffer {
+	vec4 positions[];
+} deformedBuffer;
+
+layout(std140, set = 1, binding = 2) readonly buffer InstanceBuffer {
+	InstanceData instances[];
+} instanceBuffer;
+
+layout (push_constant) uniform PushConstant {
+	int materialIndex;
+	int morphCount;
+	int numVertices;
+	int skinOffset;
+} constants;
+
+layout(constant_id = 1) const bool PRE_DEFORMED = false;
+
+vec3 vertexPosition(vec3 pos, uvec4 joints, vec4 weights, int index, InstanceData instance) {
+	if (PRE_DEFORMED)
+		return deformedBuffer.positions[instance.poseIndex * constants.numVertices + gl_VertexIndex].xyz;
+	return deformPosition(pos, joints, weights, index, instance.paletteOffset, constants.skinOffset, constants.numVertices, constants.morphCount, instance.morphWeight);
+}
+
+vec4 projectPosition(vec3 pos, InstanceData instance) {
+	mat4 mv = ubo.view * instance.transform * ubo.model;
+	vec4 P = mv * vec4(pos, 1.0);
+	return ubo.proj * P;
+}